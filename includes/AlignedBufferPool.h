@@ -0,0 +1,35 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_ALIGNEDBUFFERPOOL_H
+#define MYFS_ALIGNEDBUFFERPOOL_H
+
+#include <cstddef>
+#include <vector>
+
+/// @brief Pool of equally sized buffers with a fixed memory alignment.
+///
+/// Used as bounce buffers for O_DIRECT transfers. At most maxFree buffers are kept for reuse, so the memory held by
+/// the pool stays bounded.
+class AlignedBufferPool {
+private:
+    size_t bufferSize = 0;
+    size_t alignment = 0;
+    size_t maxFree = 0;
+    std::vector<char *> freeBuffers;
+
+public:
+    AlignedBufferPool();
+    ~AlignedBufferPool();
+
+    void init(size_t bufferSize, size_t alignment, size_t maxFree);
+    void clear();
+
+    size_t getBufferSize();
+
+    char *get();
+    void put(char *buffer);
+};
+
+#endif //MYFS_ALIGNEDBUFFERPOOL_H
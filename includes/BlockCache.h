@@ -0,0 +1,189 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_BLOCKCACHE_H
+#define MYFS_BLOCKCACHE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "blockdevice.h"
+
+#define BC_DEFAULT_SIZE_MB 16  // cache size used if no size is given at mount time
+#define BC_DIRTY_RATIO 4  // in write-back mode, flushing starts once more than 1/BC_DIRTY_RATIO of the cache is dirty
+#define BC_DIRTY_AGE_MS 5000  // dirty blocks are written back after this time at the latest
+#define BC_FLUSH_INTERVAL_MS 1000  // how often the flusher looks for expired dirty blocks
+
+/// @brief Size-bounded block cache in front of the block device.
+///
+/// Every block read or written by the file system passes through this cache, including the DMap, FAT and RootDir
+/// regions. Blocks are replaced with the 2Q policy: blocks seen for the first time are kept in a small FIFO queue
+/// (A1in), and only blocks referenced again after they dropped out of it (remembered in the ghost queue A1out) enter
+/// the main LRU queue (Am). A single scan through a large file therefore cannot flush the frequently used blocks.
+///
+/// By default writes go through to the device immediately and the cache only keeps a copy. In write-back mode written
+/// blocks are only marked as dirty. A background thread writes them back once too many of them are dirty or they
+/// are older than BC_DIRTY_AGE_MS, flush() writes them back at once.
+///
+/// The cache steps aside while the container file is mapped, the mapping already is an in-memory copy.
+class BlockCache {
+private:
+    // position of a cached block in one of the queues
+    struct Entry {
+        uint32_t blockNo;
+        int prev;
+        int next;
+        bool isMain;  // entry is part of Am, otherwise of A1in
+        bool isDirty;  // content has not been written to the device yet
+        bool isWriting;  // content is being written back by the flusher, the entry must not be reused
+        bool isLoading;  // content is being read by a prefetch, the entry must not be accessed yet
+        std::chrono::steady_clock::time_point dirtySince;
+    };
+
+    // doubly linked list of entries, most recently inserted/used at the head
+    struct Queue {
+        int head = -1;
+        int tail = -1;
+        uint32_t size = 0;
+    };
+
+    BlockDevice *device;
+    uint32_t blockSize;
+
+    uint32_t capacity = 0;  // number of blocks, 0 disables the cache
+    uint32_t inLimit = 0;  // maximum size of A1in before it gets reclaimed first
+    uint32_t ghostLimit = 0;  // maximum number of block numbers remembered in A1out
+    char *data = nullptr;  // content of the cached blocks, one block per entry
+    Entry *entries = nullptr;
+    std::vector<int> freeEntries;
+    std::unordered_map<uint32_t, int> index;  // block number -> entry
+    Queue in;
+    Queue main;
+    std::list<uint32_t> ghosts;  // A1out, most recently evicted at the front
+    std::unordered_map<uint32_t, std::list<uint32_t>::iterator> ghostIndex;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    std::vector<int> pendingLoads;  // entries filled by queued prefetch reads
+    bool writesQueued = false;  // write-through writes are queued on the device
+    int queuedError = 0;  // error of queued writes reaped while completing prefetch reads
+
+    bool writeBack = false;
+    uint32_t dirtyCount = 0;
+    uint32_t dirtyLimit = 0;  // number of dirty blocks that wakes up the flusher
+    int flushError = 0;  // first failed write back since the last flush()
+    bool isFlushing = false;  // the flusher is writing blocks without holding the lock
+    bool stopFlusher = false;
+    std::thread flusher;
+    std::condition_variable flusherWakeup;
+    std::condition_variable flushFinished;
+
+    std::mutex lock;  // protects the cache content, the flusher runs concurrently to the file system
+    std::mutex deviceLock;  // serialises all access to the device
+
+    void clearEntries();
+    bool isBypassed();
+    char *lookup(uint32_t blockNo);
+    int insert(uint32_t blockNo, const char *content);
+    int allocate(uint32_t blockNo);
+    void completeLoads();
+    void remove(uint32_t blockNo);
+    int reclaim();
+    int findVictim(Queue &queue);
+    int writeThrough(uint32_t blockNo, const char *content);
+    void markDirty(int entry);
+    int flushDirty(std::unique_lock<std::mutex> &guard);
+    void runFlusher();
+    void rememberGhost(uint32_t blockNo);
+    void pushFront(Queue &queue, int entry);
+    void unlink(Queue &queue, int entry);
+
+public:
+    BlockCache(BlockDevice *device, uint32_t blockSize);
+    ~BlockCache();
+
+    /// @brief Resize the cache.
+    ///
+    /// All cached blocks are dropped, so there must not be any dirty blocks.
+    /// \param [in] blockCount Maximum number of cached blocks, 0 disables the cache.
+    void setCapacity(uint32_t blockCount);
+    uint32_t getCapacity();
+
+    /// @brief Drop all cached blocks.
+    ///
+    /// Dirty blocks are written back first.
+    void clear();
+
+    /// @brief Switch between write-through and write-back mode.
+    ///
+    /// Enabling write-back mode starts the flusher thread. Disabling it stops the thread and writes back all dirty
+    /// blocks. Write-back mode requires a cache size greater than 0.
+    /// \param [in] enable true for write-back mode, false for write-through mode.
+    /// \return 0 on success, -ERRNO on failure.
+    int setWriteBack(bool enable);
+    bool isWriteBack();
+
+    /// @brief Write back all dirty blocks.
+    ///
+    /// \return 0 on success, -ERRNO of the first write back that failed since the last call otherwise.
+    int flush();
+
+    /// @brief Write back all dirty blocks and flush the container, see BlockDevice::sync().
+    int sync();
+
+    /// @brief Read a block, see BlockDevice::read().
+    int read(uint32_t blockNo, char *buffer);
+
+    /// @brief Write a block and keep a copy, see BlockDevice::write().
+    ///
+    /// In write-back mode the block is only marked as dirty.
+    int write(uint32_t blockNo, char *buffer);
+
+    /// @brief Read a list of blocks, see BlockDevice::readBlocks().
+    ///
+    /// Cached blocks are copied, all missing blocks are read from the device with a single readBlocks() call.
+    int readBlocks(const uint32_t *blockNos, uint32_t count, char **buffers);
+
+    /// @brief Queue writing a list of blocks and keep a copy, see BlockDevice::submitWriteBlocks().
+    ///
+    /// In write-back mode the blocks are only marked as dirty, so the buffers may be reused right away.
+    int submitWriteBlocks(const uint32_t *blockNos, uint32_t count, char **buffers);
+
+    /// @brief Queue writing a contiguous range of blocks and keep a copy, see BlockDevice::submitWriteBlocks().
+    ///
+    /// In write-back mode the blocks are only marked as dirty, so the buffer may be reused right away.
+    int submitWriteBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Start reading blocks into the cache in the background.
+    ///
+    /// The blocks that are not cached yet are read with BlockDevice::submitReadBlocks(), the reads complete with the
+    /// next access to the cache. At most a quarter of the cache is filled at once.
+    /// \param [in] blockNos Numbers of the blocks to read.
+    /// \param [in] count Number of entries in blockNos.
+    /// \return 0 on success, -ERRNO on failure.
+    int prefetch(const uint32_t *blockNos, uint32_t count);
+
+    /// @brief Wait for all queued writes, see BlockDevice::waitForCompletion().
+    ///
+    /// If a write failed, the content of the container is unknown and the whole cache is dropped.
+    int waitForCompletion();
+
+    /// @brief Access a mapped block in place, see BlockDevice::getBlockPointer().
+    char *getBlockPointer(uint32_t blockNo);
+
+    /// \return Number of blocks served from the cache.
+    uint64_t getHits();
+
+    /// \return Number of blocks that had to be read from the device.
+    uint64_t getMisses();
+};
+
+#endif //MYFS_BLOCKCACHE_H
@@ -0,0 +1,54 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_BLOCKINDEX_H
+#define MYFS_BLOCKINDEX_H
+
+#include <vector>
+
+#include "DMap.h"
+#include "FAT.h"
+#include "FileMap.h"
+#include "myfs-structs.h"
+
+/// @brief In-memory index of the FAT chain of a file.
+///
+/// The data block of every block of the file is kept in an array, so a block is found without walking the chain.
+/// The array is filled lazily: a lookup only follows the chain from the last known block up to the requested one, so
+/// every FAT entry of the file is read at most once. Appending and truncating update the chain and the array together.
+///
+/// The last block of the chain is kept in the file metadata. Appending links the new blocks to it directly, the
+/// blocks from the old last block on are remembered separately until the walk from the front reaches them. Appending
+/// to a large file therefore neither walks the chain nor needs the index of the whole file.
+class BlockIndex : public FileMap {
+private:
+    FAT *fat;
+    DMap *dMap;
+    rootFile *file;
+    std::vector<int32_t> blocks;  // data blocks of the first blocks of the file
+    bool isComplete = false;  // blocks holds the whole chain
+    std::vector<int32_t> tail;  // data blocks at the end of the file, known without walking to them
+    uint32_t tailStart = 0;  // index of the first block of tail inside the file
+
+    void extend(uint32_t count);
+
+public:
+    BlockIndex(FAT *fat, DMap *dMap, rootFile *file);
+
+    virtual int load();
+    virtual int getBlocks(uint32_t first, uint32_t count, int *blocks);
+    virtual void append(const int *blocks, uint32_t count);
+    virtual void map(uint32_t first, const int *blocks, uint32_t count);
+    virtual int unmap(uint32_t first, uint32_t count);
+    virtual uint32_t findBlock(uint32_t from, bool isMapped);
+    virtual bool supportsHoles();
+    virtual void truncate(uint32_t count);
+    virtual int persist();
+    virtual uint32_t getBlockCount();
+    virtual uint32_t getMappedBlockCount();
+    virtual uint32_t getNodeReserve(uint32_t count);
+    virtual int getGoal();
+};
+
+#endif //MYFS_BLOCKINDEX_H
@@ -6,33 +6,78 @@
 #define MYFS_DMAP_H
 
 
-#include "blockdevice.h"
+#include <map>
+#include <set>
+
+#include "BlockCache.h"
 #include "myfs-structs.h"
 #include "FShelper.h"
+#include "SuperBlock.h"
 
+// Bitmap of the data blocks, a set bit marks a block in use. The bitmap is stored as 64 bit words, the bits behind the
+// last data block are always set.
+// The runs of free blocks are indexed by their start and by their length. A request is served from the smallest run
+// that holds all blocks, only if there is none it is put together from the largest runs, so files get as few extents
+// as possible. A goal block lets a file continue right behind its last block.
+// The bitmap is summarised in groups of 4096 blocks: every group keeps its number of free blocks, and a mask with one
+// bit per group marks the groups that are not full. The free block count is the sum of the groups, and searches of the
+// bitmap skip the groups that cannot hold a match, which keeps them short on a nearly full container.
+// Free blocks can be reserved for data whose allocation is delayed, they are not handed out to other requests.
 class DMap {
 private:
-    BlockDevice *device;
-    bool blocks[DATA_BLOCKS];  // array of all blocks which contains true if the block is in use
-    int freeBlockCounter = DATA_BLOCKS;  // keep track of all blocks currently available to use
+    BlockCache *device;
+    uint32_t blockSize;
+    uint32_t dataBlocks;  // number of valid bits in words
+    uint32_t wordCount;  // number of entries in words
+    uint32_t offset;  // first block of the DMap region
+    uint32_t size;  // number of blocks of the DMap region
+    uint64_t *words;  // one bit per data block
+    bool isMapped = false;  // words points into the mapped container file
+    bool isByteFormat;  // the container still stores one byte per block, see convert()
+    std::map<uint32_t, uint32_t> freeRuns;  // start -> length of every run of free blocks
+    std::set<std::pair<uint32_t, uint32_t>> runsBySize;  // (length, start) of the same runs
+    uint32_t groupCount;  // number of groups of the summary
+    std::vector<uint32_t> groupFree;  // free blocks per group
+    std::vector<uint64_t> groupMask;  // one bit per group, set if the group has a free block
+    uint32_t freeBlocks;  // free blocks of all groups
+    uint32_t reservedBlocks = 0;  // free blocks promised to data that has no data blocks yet
+    char *persistBuffer;  // on-disk image of the DMap, must stay untouched while a persist is in flight
+    std::vector<bool> isDirty;  // DMap blocks modified since the last persist
+
+    void markDirty(uint32_t word);
+    void setRange(uint32_t first, uint32_t count, bool isUsed);
+    uint32_t findBit(uint32_t from, bool isUsed);
+    uint32_t findGroup(uint32_t from, bool isUsed);
+    uint32_t getGroupBits(uint32_t group);
+    void updateGroup(uint32_t group, int delta);
+    void buildSummary();
+    void buildRuns();
+    void addRun(uint32_t start, uint32_t length);
+    void removeRun(std::map<uint32_t, uint32_t>::iterator run);
+    uint32_t takeBlocks(uint32_t start, uint32_t amount, int *blocks);
+    void setPadding();
+    void loadByteFormat();
 
 public:
-    DMap(BlockDevice *device);
+    DMap(BlockCache *device, SuperBlock *superBlock);
     ~DMap();
 
     int getNextFreeBlock();
-    int* getXAmountOfFreeBlocks(int amount);
+    int* getXAmountOfFreeBlocks(int amount, int goal = -1);
 
     void setBlockState(int dataBlockNum, bool isUsed);
     bool getBlockState(int dataBlockNum);
 
-    void increaseFreeBlockCounterBy(int amount);
-    void decreaseFreeBlockCounterBy(int amount);
+    uint32_t getFreeBlockCount();
+    bool reserveBlocks(uint32_t amount);
+    void releaseBlocks(uint32_t amount);
 
     bool persist();
+    void convert(SuperBlock *superBlock);
 
     void initDMap();
     void initialInitDMap();
+    bool useMappedRegion();
 
 };
 
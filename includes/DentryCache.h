@@ -0,0 +1,51 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_DENTRYCACHE_H
+#define MYFS_DENTRYCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#define DENTRY_NEGATIVE -1  // cached result for a name that does not exist
+
+/// @brief Cache of the results of directory lookups.
+///
+/// Every entry maps the inode of a directory and a name in it to the inode of the file, so walking a path that is in
+/// the cache takes one hash probe per component and no access to the directory trees. Names that were looked up
+/// without success are cached as DENTRY_NEGATIVE, so that repeated lookups of missing files, like the ones of a search
+/// path, do not reach the directory trees either. The caller updates the entries of every name it creates, removes or
+/// renames.
+///
+/// Once the cache holds its capacity, half of the entries are dropped.
+class DentryCache {
+private:
+    typedef struct {
+        uint32_t parent;  // inode of the directory
+        std::string name;
+    } dentryKey;
+
+    struct keyHash {
+        size_t operator()(const dentryKey &key) const;
+    };
+    struct keyEqual {
+        bool operator()(const dentryKey &a, const dentryKey &b) const;
+    };
+
+    std::unordered_map<dentryKey, int, keyHash, keyEqual> entries;  // inode or DENTRY_NEGATIVE
+    uint32_t capacity;
+    dentryKey probe;  // key of the last lookup, keeps its buffer between lookups
+
+public:
+    explicit DentryCache(uint32_t capacity);
+
+    bool find(uint32_t parent, const char *name, size_t length, int *block);
+    void insert(uint32_t parent, const std::string &name, int block);
+    void removeChildren(uint32_t parent);
+    void clear();
+};
+
+#endif //MYFS_DENTRYCACHE_H
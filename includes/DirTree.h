@@ -0,0 +1,105 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_DIRTREE_H
+#define MYFS_DIRTREE_H
+
+#include <string>
+#include <vector>
+
+#include "BlockCache.h"
+#include "DMap.h"
+#include "myfs-structs.h"
+#include "SuperBlock.h"
+
+/// @brief Index from the file names of a directory to the inodes of the files.
+///
+/// The entries are kept in a B+tree of data blocks that is sorted by a 64 bit key: the upper 32 bits hold a 30 bit
+/// hash of the name, the lower 32 bits tell apart names with the same hash. Hashing keeps the keys of the index nodes
+/// at a fixed size, so even with the smallest block size and names of NAME_LENGTH characters every node has a large
+/// fan-out. A lookup reads one node per level, a million names need five levels with the smallest block size and
+/// three with 4096 byte blocks.
+///
+/// A key never changes while its name exists, which lets readdir continue at the key behind the last returned entry.
+/// The root node stays in its block, a tree grows and shrinks at the root by moving its entries into new nodes below
+/// it or back. Every change is written to disk before it returns, the caller persists the DMap.
+class DirTree {
+private:
+    typedef struct {
+        uint16_t depth;  // 0 for leaves
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> blocks;  // inodes of the files in a leaf, nodes below in an index node
+        std::vector<std::string> names;  // names of the files, only used in leaves
+    } dirNode;
+
+    typedef struct {
+        uint32_t block;
+        dirNode node;
+        size_t slot;  // entry of the index node that was followed, unused in the leaf
+    } pathStep;
+
+    BlockCache *device;
+    DMap *dMap;
+    uint32_t blockSize;
+    uint32_t dataOffset;  // first block of the data region
+    uint32_t root = 0;  // data block of the root node
+
+    size_t entrySize(const dirNode &node, size_t i);
+    size_t nodeSize(const dirNode &node, size_t from, size_t to);
+    std::vector<dirNode> split(const dirNode &node);
+    int readNode(uint32_t block, dirNode *node);
+    int writeNode(uint32_t block, const dirNode &node);
+    int descend(uint64_t key, std::vector<pathStep> *path);
+    int lookup(const char *name, uint64_t *key, uint32_t *block);
+    int update(std::vector<pathStep> &path);
+
+public:
+    DirTree(BlockCache *device, DMap *dMap, SuperBlock *superBlock);
+
+    /// @brief Allocate the root of a new, empty tree.
+    ///
+    /// \return 0 on success, -ENOSPC if there is no free data block, -EIO if the root cannot be written.
+    int create();
+
+    /// @brief Use an existing tree.
+    ///
+    /// \param [in] root Data block of the root node.
+    void open(uint32_t root);
+
+    /// \return The data block of the root node.
+    uint32_t getRoot();
+
+    /// @brief Find the inode of a file.
+    ///
+    /// \param [in] name Name of the file without path.
+    /// \return The inode on success, -ENOENT if there is no file with this name, -EIO if a node is damaged.
+    int find(const char *name);
+
+    /// @brief Add a file.
+    ///
+    /// \param [in] name Name of the file without path, shorter than NAME_LENGTH characters.
+    /// \param [in] block Inode of the file.
+    /// \return 0 on success, -EEXIST if the name exists already, -ENOSPC if there are no data blocks for new nodes,
+    /// -EIO on failure.
+    int insert(const char *name, uint32_t block);
+
+    /// @brief Remove a file, nodes that become empty are freed.
+    ///
+    /// \param [in] name Name of the file without path.
+    /// \return 0 on success, -ENOENT if there is no file with this name, -EIO on failure.
+    int remove(const char *name);
+
+    /// @brief Return the entry with the lowest key that is not below the given one.
+    ///
+    /// \param [in] from Lowest key to return, 0 for the first entry.
+    /// \param [out] key Key of the entry, the next call continues at key + 1.
+    /// \param [out] block Inode of the file.
+    /// \param [out] name Name of the file.
+    /// \return 0 on success, -ENOENT if there is no such entry, -EIO if a node is damaged.
+    int next(uint64_t from, uint64_t *key, uint32_t *block, std::string *name);
+
+    static uint64_t hashName(const char *name);
+};
+
+#endif //MYFS_DIRTREE_H
@@ -0,0 +1,64 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_EXTENTTREE_H
+#define MYFS_EXTENTTREE_H
+
+#include <vector>
+
+#include "BlockCache.h"
+#include "DMap.h"
+#include "FileMap.h"
+#include "myfs-structs.h"
+#include "SuperBlock.h"
+
+/// @brief Maps the blocks of a file by runs of consecutive data blocks.
+///
+/// The extents of a file are kept sorted in memory, so a block is found with a binary search and appending to the last
+/// extent costs constant time. On disk, up to EXTENT_ROOT_ENTRIES extents are stored in the root inside the file
+/// metadata. Larger files get a tree: the extents are packed into leaf nodes of one data block each, the nodes of a
+/// level are indexed by the level above, up to a level that fits into the root. persist() only writes the nodes whose
+/// entries changed since the previous call, for an append these are the last node of every level.
+///
+/// The ranges of the file between the extents are holes without data blocks.
+class ExtentTree : public FileMap {
+private:
+    BlockCache *device;
+    DMap *dMap;
+    uint32_t blockSize;
+    uint32_t dataOffset;  // first block of the data region
+    uint32_t nodeEntries;  // entries per tree node
+    rootFile *file;
+    std::vector<fileExtent> extents;  // sorted by logical block, runs that continue each other are merged, the gaps
+                                      // between them are holes
+    std::vector<std::vector<uint32_t>> nodes;  // data blocks of the tree nodes per level, the leaves first
+    size_t dirtyFrom = 0;  // first extent changed since the last persist
+    uint32_t blockCount = 0;  // index behind the last block mapped by the extents
+
+    std::vector<fileExtent>::iterator findExtent(uint32_t block);
+    int loadNode(uint32_t block, uint16_t depth);
+    int writeNode(uint32_t block, uint16_t depth, const fileExtent *entries, size_t count);
+    void freeBlocks(uint32_t physical, uint32_t length);
+
+public:
+    ExtentTree(BlockCache *device, DMap *dMap, SuperBlock *superBlock, rootFile *file);
+
+    virtual int load();
+    virtual int getBlocks(uint32_t first, uint32_t count, int *blocks);
+    virtual void append(const int *blocks, uint32_t count);
+    virtual void map(uint32_t first, const int *blocks, uint32_t count);
+    virtual int unmap(uint32_t first, uint32_t count);
+    virtual uint32_t findBlock(uint32_t from, bool isMapped);
+    virtual bool supportsHoles();
+    virtual void truncate(uint32_t count);
+    virtual int persist();
+    virtual uint32_t getBlockCount();
+    virtual uint32_t getMappedBlockCount();
+    virtual uint32_t getNodeReserve(uint32_t count);
+    virtual int getGoal();
+
+    size_t getExtentCount();
+};
+
+#endif //MYFS_EXTENTTREE_H
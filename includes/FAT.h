@@ -5,23 +5,30 @@
 #ifndef MYFS_FAT_H
 #define MYFS_FAT_H
 
+#include "BlockCache.h"
 #include "myfs-structs.h"
+#include "SuperBlock.h"
 
 class FAT {
 private:
-    BlockDevice *device;
+    BlockCache *device;
+    uint32_t blockSize;
+    uint32_t dataBlocks;  // number of entries in fatArray
+    uint32_t offset;  // first block of the FAT region
+    uint32_t size;  // number of blocks of the FAT region
     // map the entry to the next corresponding data block of a file
     // and write 'FAT_EOF' to mark the last block of a file
-    int32_t fatArray[DATA_BLOCKS];
-    int modifiedBlocks[DATA_BLOCKS];  // keep track of the modified blocks currently held in memory
-    int modifiedBlocksCounter = 0;
+    int32_t *fatArray;
+    bool isMapped = false;  // fatArray points into the mapped container file
+    std::vector<bool> isDirty;  // FAT blocks holding entries modified since the last persist
+    uint32_t dirtyFirst = 0;  // range of FAT blocks that contains all dirty ones
+    uint32_t dirtyEnd = 0;
+
+    void markDirty(int index);
 public:
-    FAT(BlockDevice *device);
+    FAT(BlockCache *device, SuperBlock *superBlock);
     ~FAT();
 
-    void insertModifiedBlock(int index);
-    void clearModifiedBlocks();
-
     int setNextBlock(int currentBlock, int nextBlock);
     int getNextBlock(int currentBlock);
 
@@ -31,6 +38,7 @@ public:
 
     void initFAT();
     void initialInitFAT();
+    bool useMappedRegion();
 
 };
 
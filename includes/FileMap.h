@@ -0,0 +1,84 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_FILEMAP_H
+#define MYFS_FILEMAP_H
+
+#include <cstdint>
+#include <cstddef>
+
+/// @brief Maps the blocks of a file to data blocks.
+///
+/// MyOnDiskFS keeps one map per file, shared by all open handles of the file. Depending on the container it is a
+/// BlockIndex over the FAT chain or an ExtentTree. An ExtentTree can leave ranges of the file unmapped, these holes
+/// have no data blocks and read as zeros.
+class FileMap {
+public:
+    virtual ~FileMap() {}
+
+    /// @brief Read the mapping of the file.
+    /// \return 0 on success, -EIO if the on-disk mapping is damaged.
+    virtual int load() = 0;
+
+    /// @brief Look up the data blocks holding a range of blocks of the file.
+    /// \param [in] first Index of the first block inside the file.
+    /// \param [in] count Number of blocks.
+    /// \param [out] blocks Data block of every block of the range, -1 for the blocks in a hole.
+    /// \return 0 on success, -EINVAL if the range is not mapped completely by a map without holes.
+    virtual int getBlocks(uint32_t first, uint32_t count, int *blocks) = 0;
+
+    /// @brief Add data blocks behind the last block of the file.
+    ///
+    /// The blocks have to be marked as used in the DMap already.
+    virtual void append(const int *blocks, uint32_t count) = 0;
+
+    /// @brief Map data blocks to a range of the file that is a hole or lies behind the last block.
+    ///
+    /// The blocks have to be marked as used in the DMap already. A map without holes only maps the range right behind
+    /// the last block.
+    /// \param [in] first Index of the first block of the range inside the file.
+    virtual void map(uint32_t first, const int *blocks, uint32_t count) = 0;
+
+    /// @brief Turn a range of the file into a hole, its data blocks are freed in the DMap.
+    /// \return 0 on success, -EOPNOTSUPP if the map has no holes.
+    virtual int unmap(uint32_t first, uint32_t count) = 0;
+
+    /// @brief Find the next data or the next hole.
+    /// \param [in] from Index of the block inside the file to start at.
+    /// \param [in] isMapped Search for a block with a data block if set, for a block in a hole otherwise.
+    /// \return First matching block at or behind from. UINT32_MAX if there is no data behind from, the range behind
+    /// the last block counts as hole.
+    virtual uint32_t findBlock(uint32_t from, bool isMapped) = 0;
+
+    /// \return true if the map can leave ranges of the file unmapped.
+    virtual bool supportsHoles() = 0;
+
+    /// @brief Shorten the file to the given number of blocks, the blocks behind it are freed in the DMap.
+    virtual void truncate(uint32_t count) = 0;
+
+    /// @brief Write the changed mapping and update the file metadata.
+    ///
+    /// The caller has to persist the DMap, the FAT and the file metadata afterwards.
+    /// \return 0 on success, -ENOSPC if the mapping needs a data block and there is none left, -EIO on write errors.
+    virtual int persist() = 0;
+
+    /// \return Index behind the last mapped block of the file.
+    virtual uint32_t getBlockCount() = 0;
+
+    /// \return Number of blocks of the file that have a data block, the holes do not count.
+    virtual uint32_t getMappedBlockCount() = 0;
+
+    /// @brief Number of blocks the mapping itself may need once count more blocks get data blocks, in the worst case
+    /// that every one of them becomes a run of its own.
+    ///
+    /// The value holds for the mapping as it was persisted last.
+    /// \return 0 if the mapping does not live in the data region.
+    virtual uint32_t getNodeReserve(uint32_t count) = 0;
+
+    /// \return Data block right behind the last block of the file, where new blocks are allocated preferably. -1 if
+    /// the file is empty or its last block is not known.
+    virtual int getGoal() = 0;
+};
+
+#endif //MYFS_FILEMAP_H
@@ -0,0 +1,81 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_IOSTATS_H
+#define MYFS_IOSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#define IOS_MAX_REGIONS 8
+#define IOS_LATENCY_BUCKETS 32  // bucket i > 0 counts latencies of [2^(i-1), 2^i) microseconds
+
+/// @brief Kinds of container requests counted by IOStats.
+enum IOStatsOp {
+    IOS_READ = 0,
+    IOS_WRITE = 1,
+    IOS_SYNC = 2,
+    IOS_OPS = 3
+};
+
+/// @brief Request counters and latency histograms of a block device.
+///
+/// Read and write requests are counted per region of the container. A region starts at its first block and ends at
+/// the first block of the next region, a request spanning several regions is counted in each of them with its share
+/// of the bytes. Latencies are collected per kind of request in log2 buckets.
+///
+/// All counters are updated with relaxed atomic increments, so they can be read at any time from any thread.
+class IOStats {
+private:
+    int regionCount = 1;
+    const char *regionNames[IOS_MAX_REGIONS] = { "all" };
+    uint32_t regionStarts[IOS_MAX_REGIONS] = { 0 };
+
+    std::atomic<uint64_t> requests[2][IOS_MAX_REGIONS];
+    std::atomic<uint64_t> bytes[2][IOS_MAX_REGIONS];
+    std::atomic<uint64_t> latencies[IOS_OPS][IOS_LATENCY_BUCKETS];
+
+    int findRegion(uint32_t blockNo);
+
+public:
+    IOStats();
+
+    /// @brief Name the regions of the container.
+    ///
+    /// \param [in] names Name of each region, the strings must stay valid.
+    /// \param [in] firstBlocks First block of each region in ascending order, the first one should be 0.
+    /// \param [in] count Number of regions, at most IOS_MAX_REGIONS.
+    void setRegions(const char **names, const uint32_t *firstBlocks, int count);
+
+    /// @brief Count a finished read or write request.
+    ///
+    /// \param [in] op IOS_READ or IOS_WRITE.
+    /// \param [in] firstBlockNo Number of the first block of the request.
+    /// \param [in] blockCount Number of blocks of the request.
+    /// \param [in] blockSize Size of a block in bytes.
+    /// \param [in] latency Duration of the request in nanoseconds.
+    void recordTransfer(IOStatsOp op, uint32_t firstBlockNo, uint32_t blockCount, uint32_t blockSize,
+                        uint64_t latency);
+
+    /// @brief Count a request that is not bound to a region, e.g. IOS_SYNC.
+    void recordLatency(IOStatsOp op, uint64_t latency);
+
+    /// @brief Reset all counters to 0.
+    void reset();
+
+    int getRegionCount();
+    const char *getRegionName(int region);
+    uint64_t getRequests(IOStatsOp op, int region);
+    uint64_t getBytes(IOStatsOp op, int region);
+    uint64_t getLatencyCount(IOStatsOp op, int bucket);
+
+    /// @brief Write the counters as a table.
+    void dump(FILE *file);
+
+    /// \return Monotonic time in nanoseconds, used to measure latencies.
+    static uint64_t now();
+};
+
+#endif //MYFS_IOSTATS_H
@@ -0,0 +1,55 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_IOURING_H
+#define MYFS_IOURING_H
+
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/// @brief Minimal io_uring submission/completion queue.
+///
+/// Talks to the kernel through the raw io_uring syscalls so no additional library is required. If the kernel (or the
+/// build environment, see HAVE_IO_URING) does not support io_uring, init() fails and the caller has to fall back to
+/// synchronous I/O.
+class IOUring {
+private:
+    int ringFd = -1;
+    unsigned entries = 0;
+    unsigned toSubmit = 0;
+
+    void *sqRing = nullptr;
+    void *cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+
+public:
+    IOUring();
+    ~IOUring();
+
+    int init(unsigned entries);
+    void exit();
+
+    bool isAvailable();
+    unsigned getEntries();
+
+    int prepare(bool isWrite, int fd, const struct iovec *iov, int iovCount, off_t pos, uint64_t userData);
+    int submit(unsigned waitCount);
+    bool popCompletion(uint64_t *userData, int *result);
+};
+
+#endif //MYFS_IOURING_H
@@ -0,0 +1,44 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_NAMEINDEX_H
+#define MYFS_NAMEINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// @brief Hash index from file names to directory entries.
+///
+/// The index is an open addressing table with linear probing that has at least twice as many slots as names, so a
+/// lookup usually probes one or two slots. Every slot keeps the hash and the length of its name, a name is only
+/// compared if both match. The names themselves are not copied, a slot points to the name stored in the directory
+/// entry, so the entry has to be removed before its name changes.
+class NameIndex {
+private:
+    typedef struct {
+        uint32_t hash;
+        uint32_t length;
+        const char *name;  // name of the directory entry
+        int value;  // directory entry, SLOT_EMPTY or SLOT_DELETED
+    } nameSlot;
+
+    std::vector<nameSlot> slots;  // the number of slots is a power of two
+    uint32_t mask;  // number of slots - 1
+    uint32_t used = 0;  // slots holding a name
+    uint32_t deleted = 0;  // slots of removed names, they keep the probe sequences of other names intact
+
+    static uint32_t hashName(const char *name, uint32_t *length);
+    void rebuild();
+
+public:
+    explicit NameIndex(uint32_t capacity);
+
+    int find(const char *name);
+    void insert(const char *name, int value);
+    void remove(const char *name, int value);
+    void clear();
+};
+
+#endif //MYFS_NAMEINDEX_H
@@ -2,34 +2,94 @@
 // Created by user on 11.11.20.
 //
 #include <FShelper.h>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BlockCache.h"
+#include "DentryCache.h"
+#include "DirTree.h"
+#include "DMap.h"
 #include "myfs-structs.h"
+#include "SuperBlock.h"
 
 #ifndef MYFS_ROOTDIR_H
 #define MYFS_ROOTDIR_H
 
+// Every directory has a directory tree, which maps the names in it to the inodes holding the metadata of the files.
+// The tree of the root directory is announced by the superblock, the tree of a subdirectory by its metadata. The
+// inodes are packed into the blocks of the RootDir region and into inode blocks taken from the data blocks, the region
+// is used first. Containers without inode table store the metadata with the name in a block per file, a block is then
+// an inode of its own.
+// The free inodes are known for the blocks that have been read since the mount, the RootDir region is read on mount.
+// An inode block among the data blocks is freed with its last inode. Changed inodes are collected and written by
+// flush(), the inodes sharing a block are written with one access.
+// A path is resolved one component at a time, the results of the lookups are kept in the dentry cache, also for
+// names that do not exist.
+// The metadata of the files is loaded on first access and kept in a cache of FILE_CACHE_ENTRIES files. Once the cache
+// is full, half of it is dropped, except the pinned files, whose metadata is referenced from outside, and the file
+// returned last. A pinned file that is deleted keeps its inode until it is unpinned for the last time.
 class RootDir {
 private:
-    // Existing files
-    rootFile* files[NUM_DIR_ENTRIES];
-    int existingFilesCounter = 0;
-    BlockDevice* device;
+    BlockCache* device;
+    SuperBlock* superBlock;
+    DMap* dMap;
+    DirTree* tree;  // opened at the directory that is accessed
+    uint32_t blockSize;
+    uint32_t inodesPerBlock;  // 1 if every file has a block of its own
+    uint32_t inodeSize;  // bytes of an inode on disk
+    uint32_t offset;  // first block of the RootDir region
+    uint32_t rootDirSize;  // blocks of the RootDir region
+    uint32_t dataOffset;  // first block of the data region
+    std::set<uint32_t> freeInodes;  // free inodes of the blocks that have been read, the lowest is taken first
+    std::unordered_map<uint32_t, uint32_t> inodeBlocks;  // used inodes of the blocks that have been read
+    std::set<uint32_t> dirty;  // changed inodes, sorted by their block
+    std::unordered_map<uint32_t, rootFile*> files;  // loaded files by inode
+    std::unordered_map<uint32_t, uint32_t> pins;  // number of pins by inode
+    std::set<uint32_t> orphans;  // deleted files that are still pinned, their inode is freed with the last pin
+    DentryCache *dentries;  // inode of a name in a directory
+    rootFile* lastFile = nullptr;  // kept in the cache until the next file is returned
+
+    rootFile* cache(rootFile *file);
+    void evict();
+    int allocateInode();
+    void freeInode(uint32_t inode);
+    int readInodeBlock(uint32_t block, char *buffer);
+    bool isUsed(const char *record);
+    void encode(rootFile *file, char *record);
+    rootFile* decode(const char *record, uint32_t inode);
+    int openDir(uint32_t dir);
+    int lookup(uint32_t dir, const char *name, size_t length);
+    int walk(const char *path, uint32_t *parent, std::string *name);
+    void addLink(uint32_t dir, int count);
+    void dropFile(rootFile *file);
 
 public:
-    RootDir(BlockDevice *device);
+    RootDir(BlockCache *device, SuperBlock *superBlock, DMap *dMap);
     ~RootDir();
 
-    rootFile* createFile(const char *path);
-    void deleteFile(rootFile *file);
+    int createFile(const char *path, mode_t mode, rootFile **file);
+    int deleteFile(rootFile *file);
+    int renameFile(rootFile *file, const char *path);
 
+    int findFile(const char *path, rootFile **file);
     rootFile* getFile(const char *path);
-    rootFile** getFiles();
+    rootFile* getFileByBlock(uint32_t inode);
+    int getNextEntry(uint32_t dir, uint64_t from, uint64_t *key, std::string *name);
+
+    void pinFile(rootFile *file);
+    uint32_t unpinFile(rootFile *file);
+    uint32_t getPinCount(rootFile *file);
 
-    rootFile* load(int index);
+    rootFile* load(uint32_t inode);
 
+    void markDirty(rootFile *file);
+    int flush();
     bool persist(rootFile *file);
 
-    void initRootDir();
-    void initialInitRootDir();
+    int initRootDir();
+    int initialInitRootDir();
 };
 
 #endif //MYFS_ROOTDIR_H
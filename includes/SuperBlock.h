@@ -0,0 +1,106 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_SUPERBLOCK_H
+#define MYFS_SUPERBLOCK_H
+
+#include "BlockCache.h"
+#include "myfs-structs.h"
+
+#define SB_MIN_BLOCK_SIZE BD_BLOCK_SIZE
+#define SB_MAX_BLOCK_SIZE 65536
+#define SB_MAX_BLOCKS 0x7fffffff  // block numbers are stored as int in the FAT and the RootDir
+
+/// @brief Geometry of a container file.
+///
+/// The superblock records the block size, the number of data blocks, the capacity of the root directory and where
+/// the DMap, FAT, RootDir and data regions start. It is written when a container is formatted and read first when a
+/// container is opened, DMap, FAT and RootDir are sized from it. Since version 3 it also carries feature flags, a
+/// container with SB_FEATURE_EXTENTS maps its files by extent trees and has an empty FAT region. A container with
+/// SB_FEATURE_DIR_TREE finds its files through the directory tree starting at dirRoot, older containers get the tree
+/// when they are mounted. A container with SB_FEATURE_INODE_TABLE stores the metadata of the files as packed inodes
+/// of INODE_SIZE bytes, its RootDir region holds dirEntries of them. Older containers keep one block per file.
+///
+/// Containers created before the superblock existed start with the DMap in block 0. They are recognised by the
+/// missing magic number and are mounted with the default geometry they were built with. Like version 1 containers
+/// they store one byte per block in the DMap and are converted to the bitmap with upgrade().
+class SuperBlock {
+private:
+    superBlockData data = {};
+    bool isLegacy = false;
+
+    void layout(uint32_t dmapOffset, uint64_t dmapBytes);
+    bool isValid();
+
+public:
+    /// @brief Compute the layout of a new container.
+    ///
+    /// \param [in] blockSize Size of a block in bytes, a power of 2 between SB_MIN_BLOCK_SIZE and SB_MAX_BLOCK_SIZE.
+    /// \param [in] dataBlocks Number of data blocks.
+    /// \param [in] dirEntries Number of files the RootDir region holds.
+    /// \param [in] features SB_FEATURE_* flags of the new container.
+    /// \return 0 on success, -EINVAL if the geometry is not supported.
+    int format(uint32_t blockSize, uint32_t dataBlocks, uint32_t dirEntries, uint32_t features = 0);
+
+    /// @brief Read the superblock of an existing container file.
+    ///
+    /// The block size is not known before the superblock has been read, so the first BD_BLOCK_SIZE bytes of the
+    /// container file are read with a block device of its own.
+    /// \param [in] path Path of the container file.
+    /// \return 0 on success, -ENOENT if the container file does not exist, -EINVAL if the superblock is damaged,
+    /// -ERRNO on other failures.
+    int load(const char *path);
+
+    /// @brief Write the superblock into the first block of the container.
+    ///
+    /// The write goes through the cache, the caller has to make sure it reaches the container file.
+    /// \return 0 on success, -ERRNO on failure.
+    int persist(BlockCache *device);
+
+    /// \return true if the container has no superblock and uses the default geometry.
+    bool isLegacyLayout();
+
+    /// \return true if the DMap region stores one byte per data block instead of one bit.
+    bool hasByteDMap();
+
+    /// \return true if the files are mapped by extent trees instead of FAT chains.
+    bool hasExtents();
+
+    /// \return true if the files are found through a directory tree.
+    bool hasDirTree();
+
+    /// \return true if the files are described by packed inodes instead of a block each.
+    bool hasInodeTable();
+
+    /// \return The number of inodes stored in a block, 1 if every file has a block of its own.
+    uint32_t getInodesPerBlock();
+
+    /// @brief Announce the directory tree of the container.
+    ///
+    /// The caller has to write the tree and the DMap before it persists the superblock.
+    /// \param [in] root Data block of the root node of the tree.
+    void setDirRoot(uint32_t root);
+
+    /// @brief Switch an old container to the current version.
+    ///
+    /// Only the DMap region changes: the bitmap starts where the byte DMap started, or behind the superblock of a
+    /// legacy container, and takes an eighth of its size. The remaining blocks of the old region stay unused. The
+    /// caller has to write the converted DMap before it persists the superblock.
+    void upgrade();
+
+    uint32_t getBlockSize();
+    uint32_t getDataBlocks();
+    uint32_t getDirEntries();
+    uint32_t getDMapOffset();
+    uint32_t getDMapSize();
+    uint32_t getFATOffset();
+    uint32_t getFATSize();
+    uint32_t getRootDirOffset();
+    uint32_t getRootDirSize();
+    uint32_t getDataOffset();
+    uint32_t getTotalBlocks();
+    uint32_t getDirRoot();
+};
+
+#endif //MYFS_SUPERBLOCK_H
@@ -13,8 +13,17 @@
 
 #include <stdio.h>
 #include <cstdint>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "IOUring.h"
+#include "AlignedBufferPool.h"
+#include "IOStats.h"
 
 #define BD_BLOCK_SIZE 512
+#define BD_RING_ENTRIES 64  // maximum number of runs in flight when io_uring is available
+#define BD_BOUNCE_SIZE (128 * 1024)  // size of the aligned bounce buffers used for O_DIRECT
 
 /// @brief Emulate a block device
 ///
@@ -25,6 +34,49 @@ private:
     uint32_t blockSize;
     int contFile;
     // uint32_t size;
+
+    // a run of adjacent blocks that is transferred with a single request
+    struct BlockRun {
+        bool isWrite;
+        off_t pos;
+        std::vector<struct iovec> iov;
+        char *bounce = nullptr;  // aligned copy of the data for O_DIRECT
+        std::vector<struct iovec> userIov;  // where the data of a bounced run actually belongs
+        size_t size = 0;  // bytes of the whole run, iov is advanced by partial transfers
+        int error = 0;  // the run is not transferred but completed with this error
+        uint64_t startTime = 0;
+    };
+
+    IOUring ring;
+    std::vector<BlockRun *> inFlight;  // indexed by the io_uring user data, nullptr for free slots
+    uint32_t inFlightCount = 0;
+    int pendingError = 0;  // first error of the queued requests, reported by waitForCompletion()
+
+    char *mapping = nullptr;  // whole container file if map() has been called
+    size_t mappingSize = 0;
+    uint32_t dirtyFirst = 0;  // range of mapped blocks modified since the last sync()
+    uint32_t dirtyEnd = 0;
+
+    bool directIO = false;  // container file is opened with O_DIRECT
+    AlignedBufferPool bouncePool;
+
+    IOStats stats;
+
+    void setUpRing();
+    int switchDirectIO(bool enable);
+    int probeDirectIO();
+    int transfer(bool isWrite, off_t pos, struct iovec *iov, int iovCount);
+    int copyMapped(bool isWrite, off_t pos, struct iovec *iov, int iovCount);
+    void splitRuns(bool isWrite, const uint32_t *blockNos, uint32_t count, char **buffers,
+                   std::vector<BlockRun *> &runs);
+    BlockRun *makeRun(bool isWrite, uint32_t firstBlockNo, uint32_t count, char *buffer);
+    void bounceRuns(std::vector<BlockRun *> &runs);
+    bool isAligned(BlockRun *run);
+    int runBatch(std::vector<BlockRun *> &runs, bool wait);
+    void queueRun(BlockRun *run);
+    void finishRun(BlockRun *run, int result);
+    int reapCompletions();
+    void completeAll();
     
 public:
     /// @brief Create a new block device.
@@ -72,6 +124,153 @@ public:
     /// \param [out] buffer Buffer storing the content to write.
     /// \return 0 on success, -ERRNO on failure.
     int write(uint32_t blockNo, char *buffer);
+
+    /// @brief Read a list of blocks.
+    ///
+    /// This method reads the blocks with the numbers given in blockNos from the container file. The content of
+    /// blockNos[i] is stored in buffers[i], each buffer must be at least one block large. Runs of adjacent block
+    /// numbers are merged and transferred with a single preadv() call. Blocks beyond the end of the container file
+    /// are read as zeros.
+    /// \param [in] blockNos Numbers of the blocks to read.
+    /// \param [in] count Number of entries in blockNos and buffers.
+    /// \param [out] buffers One buffer per block for storing its content.
+    /// \return 0 on success, -ERRNO on failure.
+    int readBlocks(const uint32_t *blockNos, uint32_t count, char **buffers);
+
+    /// @brief Read a contiguous range of blocks.
+    ///
+    /// This method reads count blocks starting at firstBlockNo into one buffer with a single preadv() call. Note that
+    /// the size of the buffer must be at least count blocks.
+    /// \param [in] firstBlockNo Number of the first block to read.
+    /// \param [in] count Number of blocks to read.
+    /// \param [out] buffer Buffer for storing the content of the blocks.
+    /// \return 0 on success, -ERRNO on failure.
+    int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Write a list of blocks.
+    ///
+    /// This method writes buffers[i] into the block blockNos[i] of the container file. Runs of adjacent block numbers
+    /// are merged and transferred with a single pwritev() call.
+    /// \param [in] blockNos Numbers of the blocks to write.
+    /// \param [in] count Number of entries in blockNos and buffers.
+    /// \param [in] buffers One buffer per block storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    int writeBlocks(const uint32_t *blockNos, uint32_t count, char **buffers);
+
+    /// @brief Write a contiguous range of blocks.
+    ///
+    /// This method writes count blocks starting at firstBlockNo from one buffer with a single pwritev() call. Note
+    /// that the size of the buffer must be at least count blocks.
+    /// \param [in] firstBlockNo Number of the first block to write.
+    /// \param [in] count Number of blocks to write.
+    /// \param [in] buffer Buffer storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    int writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Queue reading a list of blocks.
+    ///
+    /// Same as readBlocks(), but the method returns as soon as the requests have been handed to the kernel. All runs
+    /// of adjacent blocks are in flight at the same time if io_uring is available, otherwise they are read
+    /// synchronously. The buffers must not be touched until waitForCompletion() has returned.
+    /// \param [in] blockNos Numbers of the blocks to read.
+    /// \param [in] count Number of entries in blockNos and buffers.
+    /// \param [out] buffers One buffer per block for storing its content.
+    /// \return 0 on success, -ERRNO on failure.
+    int submitReadBlocks(const uint32_t *blockNos, uint32_t count, char **buffers);
+
+    /// @brief Queue reading a contiguous range of blocks.
+    ///
+    /// Asynchronous version of readBlocks(firstBlockNo, count, buffer), see submitReadBlocks().
+    /// \param [in] firstBlockNo Number of the first block to read.
+    /// \param [in] count Number of blocks to read.
+    /// \param [out] buffer Buffer for storing the content of the blocks.
+    /// \return 0 on success, -ERRNO on failure.
+    int submitReadBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Queue writing a list of blocks.
+    ///
+    /// Same as writeBlocks(), but the method returns as soon as the requests have been handed to the kernel. All
+    /// runs of adjacent blocks are in flight at the same time if io_uring is available, otherwise they are written
+    /// synchronously. The buffers must not be touched until waitForCompletion() has returned.
+    /// \param [in] blockNos Numbers of the blocks to write.
+    /// \param [in] count Number of entries in blockNos and buffers.
+    /// \param [in] buffers One buffer per block storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    int submitWriteBlocks(const uint32_t *blockNos, uint32_t count, char **buffers);
+
+    /// @brief Queue writing a contiguous range of blocks.
+    ///
+    /// Asynchronous version of writeBlocks(firstBlockNo, count, buffer), see submitWriteBlocks().
+    /// \param [in] firstBlockNo Number of the first block to write.
+    /// \param [in] count Number of blocks to write.
+    /// \param [in] buffer Buffer storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    int submitWriteBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Wait for all queued requests.
+    ///
+    /// This method blocks until every request queued with submitReadBlocks()/submitWriteBlocks() has completed.
+    /// Synchronous reads and writes wait for queued requests as well, so they never overtake them.
+    /// \return 0 on success, -ERRNO of the first failed request otherwise.
+    int waitForCompletion();
+
+    /// @brief Map the container file into memory.
+    ///
+    /// This method maps the first blockCount blocks of the container file into memory, the file is extended if it is
+    /// smaller. Afterwards all reads and writes are plain copies from/to the mapping and modified blocks are written
+    /// back by sync() or close().
+    /// \param [in] blockCount Number of blocks to map.
+    /// \return 0 on success, -ERRNO on failure.
+    int map(uint32_t blockCount);
+
+    /// @brief Check whether the container file is mapped.
+    ///
+    /// \return true if map() has been called successfully.
+    bool isMapped();
+
+    /// @brief Access a block in place.
+    ///
+    /// Callers that modify the block have to report it with markDirty().
+    /// \param [in] blockNo Number of the block.
+    /// \return Pointer to the block inside the mapping, nullptr if the container file is not mapped.
+    char *getBlockPointer(uint32_t blockNo);
+
+    /// @brief Mark mapped blocks as modified.
+    ///
+    /// \param [in] firstBlockNo Number of the first modified block.
+    /// \param [in] count Number of modified blocks.
+    void markDirty(uint32_t firstBlockNo, uint32_t count);
+
+    /// @brief Flush the container file.
+    ///
+    /// Writes the blocks modified through the mapping back with msync(), or calls fsync() if the container file is
+    /// not mapped.
+    /// \return 0 on success, -ERRNO on failure.
+    int sync();
+
+    /// @brief Bypass the page cache of the host.
+    ///
+    /// This method switches the container file to O_DIRECT. Buffers that are not aligned to the block size are
+    /// transferred through aligned bounce buffers taken from a pool. The block size has to be a multiple of the
+    /// logical block size of the underlying disk (e.g. 4096 for 4K sector disks), this is checked by a direct transfer
+    /// of the first block. If the host file system rejects it, the container file stays on buffered I/O and the error
+    /// is returned. Later transfers never switch back to buffered I/O on their own.
+    /// \param [in] enable true to use O_DIRECT, false for buffered I/O.
+    /// \return 0 on success, -ERRNO on failure.
+    int setDirectIO(bool enable);
+
+    /// @brief Check whether O_DIRECT is used.
+    ///
+    /// \return true if the container file is accessed with O_DIRECT.
+    bool isDirectIO();
+
+    /// @brief Access the I/O statistics.
+    ///
+    /// Every read and write request is counted when it completes, with its size, the container region it touched
+    /// and its latency from submission to completion. sync() calls are timed as well. The counters can be read and
+    /// reset at any time.
+    /// \return Statistics of this block device.
+    IOStats *getStats();
 };
 
 #endif /* blockdevice_h */
@@ -0,0 +1,25 @@
+//
+// Created by user on 18.10.26.
+//
+
+#ifndef MYFS_OPTIONS_H
+#define MYFS_OPTIONS_H
+
+/// @brief Mount options of the file system.
+///
+/// The options are parsed by mount.myfs and handed to the file system instance before FUSE is started. The struct is
+/// shared with the C code of mount.myfs, so it only holds plain ints.
+struct MyFsOptions {
+    int useMmap;  // map the whole container file into memory
+    int useDirectIO;  // bypass the page cache of the host with O_DIRECT
+    int useWriteBack;  // keep written blocks in the block cache and write them back in the background
+    int cacheSize;  // size of the block cache in MiB, 0 disables it, negative for the default size
+    int blockSize;  // block size of a new container in bytes, 0 for the default
+    int fsSize;  // size of the data region of a new container in MiB, 0 for the default
+    int dirEntries;  // number of inodes in the RootDir region of a new container, 0 for the default
+    int useExtents;  // map the files of a new container by extent trees instead of the FAT
+    int noAtime;  // do not update the access time of a file when it is read
+    int relAtime;  // update the access time only if it is not newer than the last change or older than a day
+};
+
+#endif //MYFS_OPTIONS_H
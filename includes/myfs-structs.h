@@ -16,28 +16,40 @@
 #include <ctime>
 
 #define NAME_LENGTH 255
-#define BLOCK_SIZE 512
 #define NUM_DIR_ENTRIES 64
 #define NUM_OPEN_FILES NUM_DIR_ENTRIES
+
+// default geometry of a newly formatted container, an existing container describes itself in its superblock
+#define BLOCK_SIZE 512
 #define DATA_BLOCKS 262144 // approx 134 MB total FS size
 
-#define BD_SIZE 0
+#define READAHEAD_MIN_BLOCKS 8    // first readahead window of a sequential stream
+#define READAHEAD_MAX_BLOCKS 512  // the window doubles with every readahead up to this size
 
-#define DMAP_OFFSET BD_SIZE  // specify where to start if we want to add a superblock later
-#define DMAP_SIZE 512
+#define DELAYED_ALLOC_MAX_BYTES (16 * 1024 * 1024)  // data of all files waiting for data blocks
 
-#define FAT_OFFSET DMAP_OFFSET + DMAP_SIZE
-#define FAT_SIZE 2048
-#define FAT_EOF -1    // set a terminator to mark a last block of a file
+#define SUPERBLOCK_MAGIC 0x5346594d  // "MYFS" in little endian
+#define SUPERBLOCK_VERSION 3  // version 1 stored one byte per block in the DMap, version 2 one bit, version 3 added
+                              // the feature flags
+#define SUPERBLOCK_BLOCK 0  // the superblock occupies the first block of the container
+
+#define SB_FEATURE_EXTENTS 0x1  // files are mapped by extent trees instead of FAT chains, there is no FAT region
+#define SB_FEATURE_DIR_TREE 0x2  // the names of the files are indexed by a tree in data blocks, new files keep their
+                                 // metadata in data blocks instead of the RootDir region, directories can be nested
+#define SB_FEATURE_INODE_TABLE 0x4  // the files are described by packed inodes of INODE_SIZE bytes without names, the
+                                    // RootDir region and the inode blocks taken from the data blocks hold many of them
 
-#define ROOT_DIR_OFFSET FAT_OFFSET + FAT_SIZE
-#define ROOT_DIR_SIZE NUM_DIR_ENTRIES
+#define FAT_EOF -1    // set a terminator to mark a last block of a file
 
-// offset for actual data blocks
-#define DATA_OFFSET ROOT_DIR_OFFSET + ROOT_DIR_SIZE
+#define EXTENT_ROOT_ENTRIES 4  // entries of the extent tree root kept in the file metadata
+#define EXTENT_NODE_MAGIC 0xf30a  // marks the data blocks holding extent tree nodes
 
-// define the total amount of blocks given to the FS
-#define TOTAL_FS_BLOCKS DMAP_SIZE + FAT_SIZE + ROOT_DIR_SIZE + DATA_BLOCKS
+#define DIR_NODE_MAGIC 0xd17e  // marks the data blocks holding directory tree nodes
+#define FILE_CACHE_ENTRIES 4096  // metadata of files kept in memory, the metadata of open files is never dropped
+#define DENTRY_CACHE_ENTRIES 16384  // results of name lookups kept in memory, including names that do not exist
+#define ROOT_DIR_BLOCK 0  // stands for the root directory, which has no inode
+#define INODE_SIZE 128  // bytes of an inode, see inodeData
+#define RELATIME_INTERVAL (24 * 60 * 60)  // seconds after which a read updates the access time again with relatime
 
 
 // this becomes obsolete for the ondiskfs as the data pointer
@@ -56,21 +68,113 @@ typedef struct {
 
 } MyFSFileInfo;
 
+// Run of data blocks holding consecutive blocks of a file. In the index nodes of an extent tree, physical is the data
+// block of the child node and logical the first block of the file it maps, length is unused there.
+typedef struct {
+    uint32_t logical;  // index of the first block inside the file
+    uint32_t physical;  // first data block of the run
+    uint32_t length;  // number of blocks
+} fileExtent;
+
+// Start of every extent tree node, followed by the entries sorted by their logical block
+typedef struct {
+    uint16_t magic;  // EXTENT_NODE_MAGIC, not used by the root
+    uint16_t depth;  // 0 if the entries are extents, otherwise the number of index levels below
+    uint32_t count;  // number of used entries
+} extentHeader;
+
+// Start of every directory tree node. A leaf is followed by its entries packed behind each other: the 64 bit key, the
+// inode of the file (32 bit), the length of the name (8 bit) and the name without terminator. An index node is
+// followed by the 64 bit key and the 32 bit data block of every child, the key is the lowest key below the child.
+typedef struct {
+    uint16_t magic;  // DIR_NODE_MAGIC
+    uint16_t depth;  // 0 for leaves, otherwise the number of index levels below
+    uint32_t count;  // number of entries
+} dirNodeHeader;
+
 // We're using one Block per struct to store the metadata
 typedef struct {
     char name[NAME_LENGTH];
     struct stat stat = {};  // store file metadata
     int firstBlock;  // index of first data block
-    int rootDirBlock;  // index of the data block for the metadata
+    int rootDirBlock;  // inode number of the file, the block holding the metadata without SB_FEATURE_INODE_TABLE
+
+    // root of the extent tree, only used if the container has SB_FEATURE_EXTENTS
+    extentHeader extentRoot;
+    fileExtent extents[EXTENT_ROOT_ENTRIES];
+
+    // last data block of the FAT chain + 1, so that appending does not have to walk the chain. 0 if it is not known,
+    // which is the case for files written before it was introduced.
+    uint32_t tailBlock;
+
+    // first block of a preallocated range that has never been written + 1, 0 if all blocks hold data. The blocks from
+    // there on up to the end of the file read as zeros.
+    uint32_t unwrittenBlock;
+
+    // inode of the directory holding the file, ROOT_DIR_BLOCK for the root directory
+    uint32_t parentBlock;
+
+    // data block of the root node of the directory tree, only used by directories
+    uint32_t dirRoot;
+
+    // number of blocks of the file, the index behind its last mapped block. stat.st_blocks is only filled in when the
+    // attributes are read, in units of 512 bytes. Without SB_FEATURE_INODE_TABLE the count is stored in stat.st_blocks.
+    uint32_t blockCount;
+
+    // number of blocks of the file that have a data block + 1, only kept by extent trees as a FAT chain has no holes.
+    // 0 if it is not known, which is the case for files written before it was introduced.
+    uint32_t mappedBlocks;
 } rootFile;
 
+// On-disk metadata of a file in a container with SB_FEATURE_INODE_TABLE. The name is only stored in the directory tree,
+// the inodes are packed into the blocks of the RootDir region and into inode blocks among the data blocks. The number
+// of an inode is its block times the inodes per block plus its slot in the block. A free slot has mode 0.
+typedef struct {
+    int64_t size;
+    int64_t atime;
+    int64_t mtime;
+    int64_t ctime;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t blocks;  // blockCount of the file
+    int32_t firstBlock;
+    uint32_t tailBlock;  // mappedBlocks of the file with SB_FEATURE_EXTENTS, there is no FAT chain then
+    uint32_t unwrittenBlock;
+    uint32_t parentBlock;  // inode of the directory holding the file
+    uint32_t dirRoot;
+    extentHeader extentRoot;
+    fileExtent extents[EXTENT_ROOT_ENTRIES];
+} inodeData;
+
+// On-disk superblock, stored at the start of block SUPERBLOCK_BLOCK. All offsets and sizes are given in blocks.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blockSize;  // in bytes
+    uint32_t dataBlocks;
+    uint32_t dirEntries;
+    uint32_t dmapOffset;
+    uint32_t dmapSize;
+    uint32_t fatOffset;
+    uint32_t fatSize;
+    uint32_t rootDirOffset;
+    uint32_t rootDirSize;
+    uint32_t dataOffset;
+    uint32_t totalBlocks;
+    uint32_t features;  // SB_FEATURE_* flags, always 0 before version 3
+    uint32_t dirRoot;  // data block of the root node of the directory tree, only set with SB_FEATURE_DIR_TREE
+} superBlockData;
+
 // Information on opened files
 typedef struct {
-    char readCache[BLOCK_SIZE];
-    int readCacheBlock = -1;
-    char writeCache[BLOCK_SIZE];
-    int writeCacheBlock = -1;
     rootFile *file;
+
+    // sequential read detection
+    off_t nextReadOffset = 0;  // offset right behind the previous read
+    int readaheadWindow = 0;  // number of blocks prefetched ahead, 0 while the file is read randomly
+    int readaheadEnd = 0;  // index of the block behind the last prefetched block
 } openFile;
 
 
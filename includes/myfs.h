@@ -13,6 +13,7 @@
 #include <cmath>
 
 #include "blockdevice.h"
+#include "myfs-options.h"
 #include "myfs-structs.h"
 
 class MyFS
@@ -20,6 +21,7 @@ class MyFS
 protected:
     static MyFS *_instance;
     FILE *logFile;
+    MyFsOptions options = {0, 0, 0, -1};  // mount options, the block cache has its default size
 
     BlockDevice *blockDevice;
 
@@ -27,7 +29,9 @@ public:
     static MyFS *Instance();
 
     MyFS();
-    ~MyFS();
+    virtual ~MyFS();
+
+    void setOptions(const MyFsOptions *options);
 
     // --- Methods called by FUSE ---
     // For Documentation see https://libfuse.github.io/doxygen/structfuse__operations.html
@@ -67,6 +71,7 @@ public:
     virtual int fuseFsyncdir(const char *path, int datasync, struct fuse_file_info *fileInfo);
     virtual int fuseTruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseCreate(const char *, mode_t, struct fuse_file_info *);
+    virtual int fuseFallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo);
     virtual void fuseDestroy();
 };
 
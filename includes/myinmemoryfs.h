@@ -13,6 +13,7 @@
 #include "myfs.h"
 #include "blockdevice.h"
 #include "myfs-structs.h"
+#include "NameIndex.h"
 
 /// @brief In-memory implementation of a simple file system.
 class MyInMemoryFS : public MyFS {
@@ -25,6 +26,7 @@ public:
 
     // declare files
     MyFSFileInfo *files;
+    NameIndex *names;  // index into files by file name
     int *openFiles;
     int openFileCount = 0;
 
@@ -8,19 +8,38 @@
 
 #include "myfs.h"
 
+#include <unordered_map>
+#include <vector>
+
+#include "BlockCache.h"
+#include "BlockIndex.h"
 #include "DMap.h"
+#include "ExtentTree.h"
 #include "FAT.h"
 #include "RootDir.h"
+#include "SuperBlock.h"
 
 /// @brief On-disk implementation of a simple file system.
 class MyOnDiskFS : public MyFS
 {
 protected:
+    SuperBlock superBlock;    // geometry of the container
+    uint32_t blockSize = 0;   // copied from the superblock, used by every read and write
+    uint32_t dataOffset = 0;  // first block of the data region
     BlockDevice *blockDevice; // added pointer because error from CLion
+    BlockCache *blockCache;   // every block access of the file system goes through the cache
     char *buffer;
     RootDir *rootDir;
     DMap *dMap;
-    FAT *fat;
+    FAT *fat;                 // only used if the files are mapped by FAT chains
+    std::unordered_map<int, FileMap *> fileMaps; // block maps of the files by inode, created on first access
+    std::unordered_map<int, std::vector<char>> delayedData; // content of the blocks behind the allocated end of the
+                              // files by inode, they get data blocks when the file is flushed
+    uint32_t delayedBlockCount = 0; // blocks held in delayedData of all files
+    std::unordered_map<int, uint32_t> nodeReservations; // blocks reserved for the map nodes the data in delayedData
+                              // may need once it gets its data blocks, by inode
+    bool noAtime = false;     // reads leave the access time alone
+    bool relAtime = false;    // reads update the access time only if it is not newer than the last change or old
 
     int openFileCount = 0;
     openFile *openFiles[NUM_OPEN_FILES];
@@ -39,6 +58,8 @@ public:
     virtual int fuseMknod(const char *path, mode_t mode, dev_t dev);
     virtual int fuseUnlink(const char *path);
     virtual int fuseRename(const char *path, const char *newpath);
+    virtual int fuseMkdir(const char *path, mode_t mode);
+    virtual int fuseRmdir(const char *path);
     virtual int fuseChmod(const char *path, mode_t mode);
     virtual int fuseChown(const char *path, uid_t uid, gid_t gid);
     virtual int fuseTruncate(const char *path, off_t newSize);
@@ -46,14 +67,39 @@ public:
     virtual int fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseRelease(const char *path, struct fuse_file_info *fileInfo);
+    virtual int fuseFlush(const char *path, struct fuse_file_info *fileInfo);
+    virtual int fuseFsync(const char *path, int datasync, struct fuse_file_info *fileInfo);
     virtual void *fuseInit(struct fuse_conn_info *conn);
+    virtual int fuseOpendir(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseTruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseFallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo);
     virtual void fuseDestroy();
 
     int getNextFreeIndexOpenFiles();
+    FileMap *getFileMap(rootFile *file);
+    void releaseFileMap(rootFile *file);
+    bool isFileOpen(rootFile *file);
+    int freeFileBlocks(rootFile *file);
     int readFile(int *blocks, int blockCount, int offset, size_t size, char *buf, openFile *openFile);
     int writeFile(int *blocks, int blockCount, int offset, size_t size, const char *buf, openFile *file);
+    void readahead(openFile *handle, off_t offset, size_t size, int lastIndex);
+    int flushDelayedBlocks(rootFile *file);
+    int flushAllDelayedBlocks();
+    void dropDelayedBlocks(rootFile *file, uint32_t count);
+    int reserveNodeBlocks(rootFile *file, FileMap *map, uint32_t count);
+    void releaseNodeBlocks(rootFile *file);
+    int preallocate(rootFile *file, off_t offset, off_t end, bool keepSize, struct fuse_file_info *fileInfo);
+    int punchHole(rootFile *file, off_t offset, off_t length, struct fuse_file_info *fileInfo);
+    int writeZeros(off_t offset, off_t size, struct fuse_file_info *fileInfo);
+    int mapHoles(rootFile *file, uint32_t first, uint32_t end, off_t offset, size_t size);
+    int fillUnwrittenBlocks(rootFile *file, off_t offset, size_t size);
+    int zeroBlocks(FileMap *map, uint32_t first, uint32_t count);
+    int copyMappedFile(int *blocks, int blockCount, int offset, size_t size, char *buf, bool isWrite);
+    void updateAccessTime(rootFile *file);
+    void applyMountOptions();
+    int openContainer(const char *path);
+    int setUpContainer(const char *path, bool create);
 };
 
 #endif //MYFS_MYONDISKFS_H
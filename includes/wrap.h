@@ -25,10 +25,13 @@
 #include <sys/types.h>
 #include <sys/xattr.h>
 
+#include "myfs-options.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
     void setInstance(int onDisk);
+    void setOptions(const struct MyFsOptions *options);
 
     int wrap_getattr(const char *path, struct stat *statbuf);
     int wrap_readlink(const char *path, char *link, size_t size);
@@ -66,6 +69,7 @@ extern "C" {
     int wrap_fsyncdir(const char *path, int datasync, struct fuse_file_info *fileInfo);
     int wrap_ftruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
     int wrap_create(const char *, mode_t, struct fuse_file_info *);
+    int wrap_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo);
     void wrap_destroy(void *userdata);
     
 #ifdef __cplusplus
@@ -0,0 +1,62 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "AlignedBufferPool.h"
+
+#include <cstdlib>
+
+// AlignedBufferPool constructor
+AlignedBufferPool::AlignedBufferPool() {
+
+}
+
+// AlignedBufferPool destructor
+AlignedBufferPool::~AlignedBufferPool() {
+    clear();
+}
+
+// set the size and alignment of the buffers, buffers handed out before must not be returned anymore
+void AlignedBufferPool::init(size_t bufferSize, size_t alignment, size_t maxFree) {
+    clear();
+    this->bufferSize = bufferSize;
+    this->alignment = alignment;
+    this->maxFree = maxFree;
+}
+
+// release all buffers that are currently kept for reuse
+void AlignedBufferPool::clear() {
+    for (size_t i = 0; i < freeBuffers.size(); i++) {
+        free(freeBuffers[i]);
+    }
+    freeBuffers.clear();
+}
+
+// return the size of every buffer of the pool
+size_t AlignedBufferPool::getBufferSize() {
+    return bufferSize;
+}
+
+// hand out a buffer, return nullptr if no memory is available
+char *AlignedBufferPool::get() {
+    if (!freeBuffers.empty()) {
+        char *buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        return buffer;
+    }
+
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, alignment, bufferSize) != 0) {
+        return nullptr;
+    }
+    return (char *) buffer;
+}
+
+// take a buffer back, it is kept for reuse unless the pool is full
+void AlignedBufferPool::put(char *buffer) {
+    if (freeBuffers.size() < maxFree) {
+        freeBuffers.push_back(buffer);
+    } else {
+        free(buffer);
+    }
+}
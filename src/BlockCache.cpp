@@ -0,0 +1,711 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "BlockCache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// BlockCache constructor, the cache is empty and disabled until setCapacity() is called
+BlockCache::BlockCache(BlockDevice *device, uint32_t blockSize) {
+    this->device = device;
+    this->blockSize = blockSize;
+}
+
+// BlockCache destructor, stops the flusher if it is still running
+BlockCache::~BlockCache() {
+    setWriteBack(false);
+    delete[] this->data;
+    delete[] this->entries;
+}
+
+// allocate room for blockCount blocks, dropping the current content
+void BlockCache::setCapacity(uint32_t blockCount) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    // queued prefetch reads and the flusher still refer to entries of the old allocation
+    completeLoads();
+    while (this->isFlushing) {
+        this->flushFinished.wait(guard);
+    }
+
+    delete[] this->data;
+    delete[] this->entries;
+    this->data = nullptr;
+    this->entries = nullptr;
+
+    this->capacity = blockCount;
+    // sizes recommended for 2Q: A1in holds a quarter of the blocks, A1out remembers half as many blocks as fit
+    this->inLimit = blockCount / 4;
+    this->ghostLimit = blockCount / 2;
+    this->dirtyLimit = blockCount / BC_DIRTY_RATIO;
+
+    if (blockCount > 0) {
+        this->data = new char[(size_t) blockCount * this->blockSize];
+        this->entries = new Entry[blockCount];
+        this->index.reserve(blockCount);
+    }
+    clearEntries();
+}
+
+// return the maximum number of cached blocks
+uint32_t BlockCache::getCapacity() {
+    return this->capacity;
+}
+
+// write back the dirty blocks and forget all cached blocks
+void BlockCache::clear() {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+    flushDirty(guard);
+    clearEntries();
+}
+
+// start or stop the flusher thread
+int BlockCache::setWriteBack(bool enable) {
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    if (enable) {
+        if (this->capacity == 0) {
+            return -EINVAL;
+        }
+        if (!this->writeBack) {
+            this->writeBack = true;
+            this->stopFlusher = false;
+            this->flusher = std::thread(&BlockCache::runFlusher, this);
+        }
+        return 0;
+    }
+
+    if (!this->writeBack) {
+        return 0;
+    }
+
+    // new writes go through from now on, the flusher finishes its current batch
+    this->writeBack = false;
+    this->stopFlusher = true;
+    this->flusherWakeup.notify_one();
+    guard.unlock();
+    this->flusher.join();
+    guard.lock();
+
+    completeLoads();
+    return flushDirty(guard);
+}
+
+// return true if written blocks are only marked as dirty
+bool BlockCache::isWriteBack() {
+    return this->writeBack;
+}
+
+// write back all dirty blocks
+int BlockCache::flush() {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+    return flushDirty(guard);
+}
+
+// write back all dirty blocks and make sure they reached the disk
+int BlockCache::sync() {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+    int ret = flushDirty(guard);
+
+    std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+    int syncRet = this->device->sync();
+    return ret != 0 ? ret : syncRet;
+}
+
+// read a single block
+int BlockCache::read(uint32_t blockNo, char *buffer) {
+    return readBlocks(&blockNo, 1, &buffer);
+}
+
+// write a single block, synchronously unless in write-back mode
+int BlockCache::write(uint32_t blockNo, char *buffer) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+
+    if (isBypassed()) {
+        return writeThrough(blockNo, buffer);
+    }
+
+    if (this->writeBack) {
+        int entry = insert(blockNo, buffer);
+        if (entry >= 0) {
+            markDirty(entry);
+            return 0;
+        }
+        // there is no room for another dirty block, fall back to writing it through
+        return writeThrough(blockNo, buffer);
+    }
+
+    int ret = writeThrough(blockNo, buffer);
+    if (ret == 0) {
+        insert(blockNo, buffer);
+    } else {
+        remove(blockNo);
+    }
+    return ret;
+}
+
+// serve the cached blocks from memory and read the others with a single batch
+int BlockCache::readBlocks(const uint32_t *blockNos, uint32_t count, char **buffers) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+
+    if (isBypassed()) {
+        std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+        return this->device->readBlocks(blockNos, count, buffers);
+    }
+
+    std::vector<uint32_t> missingNos;
+    std::vector<char *> missingBuffers;
+
+    for (uint32_t i = 0; i < count; i++) {
+        char *cached = lookup(blockNos[i]);
+        if (cached != nullptr) {
+            memcpy(buffers[i], cached, this->blockSize);
+            this->hits++;
+        } else {
+            missingNos.push_back(blockNos[i]);
+            missingBuffers.push_back(buffers[i]);
+            this->misses++;
+        }
+    }
+
+    if (missingNos.empty()) {
+        return 0;
+    }
+
+    int ret;
+    {
+        std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+        ret = this->device->readBlocks(missingNos.data(), (uint32_t) missingNos.size(), missingBuffers.data());
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (size_t i = 0; i < missingNos.size(); i++) {
+        insert(missingNos[i], missingBuffers[i]);
+    }
+    return 0;
+}
+
+// update the cached copies right away, the device may still be writing them afterwards
+int BlockCache::submitWriteBlocks(const uint32_t *blockNos, uint32_t count, char **buffers) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+
+    if (!isBypassed()) {
+        for (uint32_t i = 0; i < count; i++) {
+            int entry = insert(blockNos[i], buffers[i]);
+            if (!this->writeBack) {
+                continue;
+            }
+            if (entry >= 0) {
+                markDirty(entry);
+            } else {
+                int ret = writeThrough(blockNos[i], buffers[i]);
+                if (ret != 0) {
+                    return ret;
+                }
+            }
+        }
+        if (this->writeBack) {
+            return 0;
+        }
+    }
+
+    std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+    this->writesQueued = true;
+    return this->device->submitWriteBlocks(blockNos, count, buffers);
+}
+
+// same as above for a contiguous range of blocks
+int BlockCache::submitWriteBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+
+    if (!isBypassed()) {
+        for (uint32_t i = 0; i < count; i++) {
+            char *blockBuffer = buffer + (size_t) i * this->blockSize;
+            int entry = insert(firstBlockNo + i, blockBuffer);
+            if (!this->writeBack) {
+                continue;
+            }
+            if (entry >= 0) {
+                markDirty(entry);
+            } else {
+                int ret = writeThrough(firstBlockNo + i, blockBuffer);
+                if (ret != 0) {
+                    return ret;
+                }
+            }
+        }
+        if (this->writeBack) {
+            return 0;
+        }
+    }
+
+    std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+    this->writesQueued = true;
+    return this->device->submitWriteBlocks(firstBlockNo, count, buffer);
+}
+
+// read the blocks that are not cached yet into new entries, without waiting for the reads
+int BlockCache::prefetch(const uint32_t *blockNos, uint32_t count) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+
+    if (isBypassed()) {
+        return 0;
+    }
+
+    // a long readahead must not displace the whole cache
+    count = std::min(count, this->inLimit);
+
+    std::vector<uint32_t> loadNos;
+    std::vector<char *> loadBuffers;
+    for (uint32_t i = 0; i < count; i++) {
+        if (this->index.find(blockNos[i]) != this->index.end()) {
+            continue;
+        }
+        int entry = allocate(blockNos[i]);
+        if (entry < 0) {
+            break;
+        }
+        this->entries[entry].isLoading = true;
+        this->pendingLoads.push_back(entry);
+        loadNos.push_back(blockNos[i]);
+        loadBuffers.push_back(this->data + (size_t) entry * this->blockSize);
+    }
+
+    if (loadNos.empty()) {
+        return 0;
+    }
+
+    int ret;
+    {
+        std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+        ret = this->device->submitReadBlocks(loadNos.data(), (uint32_t) loadNos.size(), loadBuffers.data());
+        if (ret != 0) {
+            // some of the reads may be in flight already
+            this->device->waitForCompletion();
+        }
+    }
+
+    if (ret != 0) {
+        for (int entry : this->pendingLoads) {
+            this->entries[entry].isLoading = false;
+            remove(this->entries[entry].blockNo);
+        }
+        this->pendingLoads.clear();
+    }
+    return ret;
+}
+
+// wait for the queued writes
+int BlockCache::waitForCompletion() {
+    std::unique_lock<std::mutex> guard(this->lock);
+    completeLoads();
+
+    int ret;
+    {
+        std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+        ret = this->device->waitForCompletion();
+    }
+    if (ret == 0) {
+        ret = this->queuedError;
+    }
+    this->queuedError = 0;
+    this->writesQueued = false;
+
+    // dirty blocks are still the newest content, they must not get lost
+    if (ret != 0 && this->dirtyCount == 0 && !this->isFlushing) {
+        clearEntries();
+    }
+    return ret;
+}
+
+// mapped blocks are accessed in place, the cache is bypassed anyway
+char *BlockCache::getBlockPointer(uint32_t blockNo) {
+    return this->device->getBlockPointer(blockNo);
+}
+
+// return the number of blocks served from memory
+uint64_t BlockCache::getHits() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->hits;
+}
+
+// return the number of blocks read from the device
+uint64_t BlockCache::getMisses() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->misses;
+}
+
+// forget all cached blocks and ghosts, the lock has to be held
+void BlockCache::clearEntries() {
+    this->index.clear();
+    this->ghosts.clear();
+    this->ghostIndex.clear();
+    this->in = Queue();
+    this->main = Queue();
+    this->dirtyCount = 0;
+    this->pendingLoads.clear();
+
+    this->freeEntries.clear();
+    for (int i = (int) this->capacity - 1; i >= 0; i--) {
+        this->freeEntries.push_back(i);
+    }
+}
+
+// the cache is not used if it has no room or the container file is mapped
+bool BlockCache::isBypassed() {
+    return this->capacity == 0 || this->device->isMapped();
+}
+
+// return the cached content of a block or nullptr, a hit in Am makes the block the most recently used one.
+// Hits in A1in do not change its order, it stays a FIFO queue
+char *BlockCache::lookup(uint32_t blockNo) {
+    auto it = this->index.find(blockNo);
+    if (it == this->index.end()) {
+        return nullptr;
+    }
+
+    int entry = it->second;
+    if (this->entries[entry].isMain) {
+        unlink(this->main, entry);
+        pushFront(this->main, entry);
+    }
+    return this->data + (size_t) entry * this->blockSize;
+}
+
+// store a copy of a block
+// return the entry or -1 if no entry could be reclaimed
+int BlockCache::insert(uint32_t blockNo, const char *content) {
+    char *cached = lookup(blockNo);
+    if (cached != nullptr) {
+        memcpy(cached, content, this->blockSize);
+        return this->index[blockNo];
+    }
+
+    int entry = allocate(blockNo);
+    if (entry >= 0) {
+        memcpy(this->data + (size_t) entry * this->blockSize, content, this->blockSize);
+    }
+    return entry;
+}
+
+// assign an entry to a block that is not cached yet, replacing another block if the cache is full
+// return the entry or -1 if no entry could be reclaimed
+int BlockCache::allocate(uint32_t blockNo) {
+    int entry;
+    if (!this->freeEntries.empty()) {
+        entry = this->freeEntries.back();
+        this->freeEntries.pop_back();
+    } else {
+        entry = reclaim();
+        if (entry < 0) {
+            return -1;
+        }
+    }
+
+    Entry &e = this->entries[entry];
+    e.blockNo = blockNo;
+    e.isDirty = false;
+    e.isWriting = false;
+    e.isLoading = false;
+
+    // a block that has been evicted from A1in recently is referenced again, it is worth keeping in Am
+    auto ghost = this->ghostIndex.find(blockNo);
+    if (ghost != this->ghostIndex.end()) {
+        this->ghosts.erase(ghost->second);
+        this->ghostIndex.erase(ghost);
+        e.isMain = true;
+        pushFront(this->main, entry);
+    } else {
+        e.isMain = false;
+        pushFront(this->in, entry);
+    }
+
+    this->index[blockNo] = entry;
+    return entry;
+}
+
+// wait for the queued prefetch reads, entries that could not be read are dropped
+void BlockCache::completeLoads() {
+    if (this->pendingLoads.empty()) {
+        return;
+    }
+
+    int ret;
+    {
+        std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+        ret = this->device->waitForCompletion();
+    }
+    // the error may belong to a queued write as well, keep it for waitForCompletion()
+    if (ret != 0 && this->writesQueued && this->queuedError == 0) {
+        this->queuedError = ret;
+    }
+
+    for (int entry : this->pendingLoads) {
+        this->entries[entry].isLoading = false;
+        if (ret != 0) {
+            remove(this->entries[entry].blockNo);
+        }
+    }
+    this->pendingLoads.clear();
+}
+
+// drop a clean block from the cache
+void BlockCache::remove(uint32_t blockNo) {
+    auto it = this->index.find(blockNo);
+    if (it == this->index.end()) {
+        return;
+    }
+
+    int entry = it->second;
+    if (this->entries[entry].isDirty || this->entries[entry].isWriting || this->entries[entry].isLoading) {
+        return;
+    }
+    unlink(this->entries[entry].isMain ? this->main : this->in, entry);
+    this->index.erase(it);
+    this->freeEntries.push_back(entry);
+}
+
+// evict a block and return its entry, A1in is reclaimed first once it exceeds its share.
+// A dirty victim is written back synchronously before it is reused.
+// return -1 if every entry is being written back or loaded, or the write back failed
+int BlockCache::reclaim() {
+    int entry;
+    if (this->in.size > this->inLimit || this->main.size == 0) {
+        entry = findVictim(this->in);
+        if (entry < 0) {
+            entry = findVictim(this->main);
+        }
+    } else {
+        entry = findVictim(this->main);
+        if (entry < 0) {
+            entry = findVictim(this->in);
+        }
+    }
+    if (entry < 0) {
+        return -1;
+    }
+
+    Entry &e = this->entries[entry];
+    if (e.isDirty) {
+        int ret = writeThrough(e.blockNo, this->data + (size_t) entry * this->blockSize);
+        if (ret != 0) {
+            if (this->flushError == 0) {
+                this->flushError = ret;
+            }
+            return -1;
+        }
+        e.isDirty = false;
+        this->dirtyCount--;
+    }
+
+    if (e.isMain) {
+        unlink(this->main, entry);
+    } else {
+        unlink(this->in, entry);
+        rememberGhost(e.blockNo);
+    }
+
+    this->index.erase(e.blockNo);
+    return entry;
+}
+
+// return the least recently used entry of a queue that is not being written back or loaded, -1 if there is none
+int BlockCache::findVictim(Queue &queue) {
+    for (int entry = queue.tail; entry >= 0; entry = this->entries[entry].prev) {
+        if (!this->entries[entry].isWriting && !this->entries[entry].isLoading) {
+            return entry;
+        }
+    }
+    return -1;
+}
+
+// write a block to the device right away
+int BlockCache::writeThrough(uint32_t blockNo, const char *content) {
+    std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+    return this->device->write(blockNo, const_cast<char *>(content));
+}
+
+// mark an entry as modified, the age of a dirty block counts from its first modification
+void BlockCache::markDirty(int entry) {
+    Entry &e = this->entries[entry];
+    if (e.isDirty) {
+        return;
+    }
+
+    e.isDirty = true;
+    e.dirtySince = std::chrono::steady_clock::now();
+    this->dirtyCount++;
+    if (this->dirtyCount > this->dirtyLimit) {
+        this->flusherWakeup.notify_one();
+    }
+}
+
+// write back all dirty blocks in ascending block order, so that adjacent blocks are merged into single requests.
+// The lock is held all the time, except while waiting for a concurrent batch of the flusher.
+// return 0 on success, -ERRNO of the first write back that failed since the last call otherwise
+int BlockCache::flushDirty(std::unique_lock<std::mutex> &guard) {
+    while (this->isFlushing) {
+        this->flushFinished.wait(guard);
+    }
+
+    std::vector<int> dirty;
+    for (auto &it : this->index) {
+        if (this->entries[it.second].isDirty) {
+            dirty.push_back(it.second);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end(), [this](int a, int b) {
+        return this->entries[a].blockNo < this->entries[b].blockNo;
+    });
+
+    int ret = 0;
+    if (!dirty.empty()) {
+        std::vector<uint32_t> blockNos;
+        std::vector<char *> buffers;
+        for (int entry : dirty) {
+            blockNos.push_back(this->entries[entry].blockNo);
+            buffers.push_back(this->data + (size_t) entry * this->blockSize);
+        }
+
+        {
+            std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+            ret = this->device->writeBlocks(blockNos.data(), (uint32_t) blockNos.size(), buffers.data());
+        }
+
+        if (ret == 0) {
+            for (int entry : dirty) {
+                this->entries[entry].isDirty = false;
+            }
+            this->dirtyCount -= dirty.size();
+        }
+    }
+
+    if (ret == 0) {
+        ret = this->flushError;
+    }
+    this->flushError = 0;
+    return ret;
+}
+
+// main loop of the flusher thread. Expired dirty blocks are written back periodically, all dirty blocks once there
+// are too many of them. The batch is copied, so the file system can go on using the cache during the write back
+void BlockCache::runFlusher() {
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    while (!this->stopFlusher) {
+        this->flusherWakeup.wait_for(guard, std::chrono::milliseconds(BC_FLUSH_INTERVAL_MS), [this] {
+            return this->stopFlusher || this->dirtyCount > this->dirtyLimit;
+        });
+        if (this->stopFlusher) {
+            break;
+        }
+
+        bool flushAll = this->dirtyCount > this->dirtyLimit;
+        auto expired = std::chrono::steady_clock::now() - std::chrono::milliseconds(BC_DIRTY_AGE_MS);
+
+        std::vector<int> batch;
+        for (auto &it : this->index) {
+            Entry &e = this->entries[it.second];
+            if (e.isDirty && (flushAll || e.dirtySince <= expired)) {
+                batch.push_back(it.second);
+            }
+        }
+        if (batch.empty()) {
+            continue;
+        }
+        std::sort(batch.begin(), batch.end(), [this](int a, int b) {
+            return this->entries[a].blockNo < this->entries[b].blockNo;
+        });
+
+        // the entries stay pinned until the copies have been written, a new modification marks them dirty again
+        std::vector<char> staging(batch.size() * this->blockSize);
+        std::vector<uint32_t> blockNos;
+        std::vector<char *> buffers;
+        for (size_t i = 0; i < batch.size(); i++) {
+            Entry &e = this->entries[batch[i]];
+            char *copy = staging.data() + i * this->blockSize;
+            memcpy(copy, this->data + (size_t) batch[i] * this->blockSize, this->blockSize);
+            blockNos.push_back(e.blockNo);
+            buffers.push_back(copy);
+            e.isDirty = false;
+            e.isWriting = true;
+        }
+        this->dirtyCount -= batch.size();
+        this->isFlushing = true;
+
+        guard.unlock();
+        int ret;
+        {
+            std::lock_guard<std::mutex> deviceGuard(this->deviceLock);
+            ret = this->device->writeBlocks(blockNos.data(), (uint32_t) blockNos.size(), buffers.data());
+        }
+        guard.lock();
+
+        for (int entry : batch) {
+            this->entries[entry].isWriting = false;
+            if (ret != 0) {
+                markDirty(entry);
+            }
+        }
+        if (ret != 0 && this->flushError == 0) {
+            this->flushError = ret;
+        }
+
+        this->isFlushing = false;
+        this->flushFinished.notify_all();
+    }
+}
+
+// add a block evicted from A1in to A1out, forgetting the oldest ghost if A1out is full
+void BlockCache::rememberGhost(uint32_t blockNo) {
+    if (this->ghostLimit == 0) {
+        return;
+    }
+    if (this->ghosts.size() >= this->ghostLimit) {
+        this->ghostIndex.erase(this->ghosts.back());
+        this->ghosts.pop_back();
+    }
+    this->ghosts.push_front(blockNo);
+    this->ghostIndex[blockNo] = this->ghosts.begin();
+}
+
+// insert an entry at the head of a queue
+void BlockCache::pushFront(Queue &queue, int entry) {
+    this->entries[entry].prev = -1;
+    this->entries[entry].next = queue.head;
+    if (queue.head >= 0) {
+        this->entries[queue.head].prev = entry;
+    } else {
+        queue.tail = entry;
+    }
+    queue.head = entry;
+    queue.size++;
+}
+
+// take an entry out of a queue
+void BlockCache::unlink(Queue &queue, int entry) {
+    Entry &e = this->entries[entry];
+    if (e.prev >= 0) {
+        this->entries[e.prev].next = e.next;
+    } else {
+        queue.head = e.next;
+    }
+    if (e.next >= 0) {
+        this->entries[e.next].prev = e.prev;
+    } else {
+        queue.tail = e.prev;
+    }
+    queue.size--;
+}
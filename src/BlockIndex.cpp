@@ -0,0 +1,173 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "BlockIndex.h"
+
+#include <algorithm>
+#include <cerrno>
+
+// BlockIndex constructor, the chain is followed on demand
+BlockIndex::BlockIndex(FAT *fat, DMap *dMap, rootFile *file) {
+    this->fat = fat;
+    this->dMap = dMap;
+    this->file = file;
+}
+
+// nothing has to be read in advance
+int BlockIndex::load() {
+    this->blocks.clear();
+    this->tail.clear();
+    this->isComplete = this->file->firstBlock == -1;
+    return 0;
+}
+
+// follow the chain until the index holds the given number of blocks or the chain ends
+void BlockIndex::extend(uint32_t count) {
+    while (!this->isComplete && this->blocks.size() < count) {
+        // the rest of the chain is known already, the walk may have passed the start of the tail
+        if (!this->tail.empty() && this->blocks.size() >= this->tailStart) {
+            size_t known = std::min(this->blocks.size() - this->tailStart, this->tail.size());
+            this->blocks.insert(this->blocks.end(), this->tail.begin() + known, this->tail.end());
+            this->tail.clear();
+            this->isComplete = true;
+            break;
+        }
+
+        int next = this->blocks.empty() ? this->file->firstBlock : this->fat->getNextBlock(this->blocks.back());
+        if (next == FAT_EOF) {
+            this->tail.clear();
+            this->tailStart = (uint32_t) this->blocks.size();
+            this->isComplete = true;
+        } else {
+            this->blocks.push_back(next);
+        }
+    }
+}
+
+// copy the data blocks of a range out of the index
+int BlockIndex::getBlocks(uint32_t first, uint32_t count, int *blocks) {
+    uint64_t end = (uint64_t) first + count;
+    if (!this->tail.empty() && first >= this->tailStart && end <= this->tailStart + this->tail.size()) {
+        memcpy(blocks, this->tail.data() + (first - this->tailStart), count * sizeof(int32_t));
+        return 0;
+    }
+    if (end > this->blocks.size()) {
+        extend((uint32_t) end);
+        if (end > this->blocks.size()) {
+            return -EINVAL;
+        }
+    }
+    memcpy(blocks, this->blocks.data() + first, count * sizeof(int32_t));
+    return 0;
+}
+
+// link the new blocks behind the last block of the chain
+void BlockIndex::append(const int *blocks, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    // without the last block in the metadata the end of the chain has to be searched
+    if (this->file->tailBlock == 0) {
+        extend(UINT32_MAX);
+    }
+
+    if (this->isComplete) {
+        if (this->blocks.empty()) {
+            this->file->firstBlock = blocks[0];
+        } else {
+            this->fat->setNextBlock(this->blocks.back(), blocks[0]);
+        }
+        this->blocks.insert(this->blocks.end(), blocks, blocks + count);
+    } else {
+        // the file has blockCount blocks, the last one is known from the metadata
+        if (this->tail.empty()) {
+            this->tail.push_back((int32_t) this->file->tailBlock - 1);
+            this->tailStart = this->file->blockCount - 1;
+        }
+        this->fat->setNextBlock(this->tail.back(), blocks[0]);
+        this->tail.insert(this->tail.end(), blocks, blocks + count);
+    }
+
+    for (uint32_t i = 1; i < count; i++) {
+        this->fat->setNextBlock(blocks[i - 1], blocks[i]);
+    }
+    this->file->tailBlock = (uint32_t) blocks[count - 1] + 1;
+}
+
+// the chain has no holes, new blocks can only be linked to its end
+void BlockIndex::map(uint32_t first, const int *blocks, uint32_t count) {
+    append(blocks, count);
+}
+
+// every block of the chain has a data block
+int BlockIndex::unmap(uint32_t first, uint32_t count) {
+    return -EOPNOTSUPP;
+}
+
+// the blocks up to the end of the chain are data, everything behind it is a hole
+uint32_t BlockIndex::findBlock(uint32_t from, bool isMapped) {
+    uint32_t count = getBlockCount();
+    if (isMapped) {
+        return from < count ? from : UINT32_MAX;
+    }
+    return std::max(from, count);
+}
+
+// a FAT chain maps every block of the file
+bool BlockIndex::supportsHoles() {
+    return false;
+}
+
+// cut the chain behind the new last block and free the blocks behind it
+void BlockIndex::truncate(uint32_t count) {
+    extend(UINT32_MAX);
+    if (count >= this->blocks.size()) {
+        return;
+    }
+
+    for (size_t i = count; i < this->blocks.size(); i++) {
+        this->dMap->setBlockState(this->blocks[i], false);
+        this->fat->freeBlock(this->blocks[i]);
+    }
+    if (count == 0) {
+        this->file->firstBlock = -1;
+        this->file->tailBlock = 0;
+    } else {
+        this->fat->freeBlock(this->blocks[count - 1]);  // becomes the end of the chain
+        this->file->tailBlock = (uint32_t) this->blocks[count - 1] + 1;
+    }
+    this->blocks.resize(count);
+    this->tail.clear();
+    this->tailStart = count;
+}
+
+// the chain is stored in the FAT, which the caller persists
+int BlockIndex::persist() {
+    return 0;
+}
+
+// return the length of the chain
+uint32_t BlockIndex::getBlockCount() {
+    extend(UINT32_MAX);
+    return (uint32_t) this->blocks.size();
+}
+
+// every block of the chain has a data block
+uint32_t BlockIndex::getMappedBlockCount() {
+    return getBlockCount();
+}
+
+// the chain lives in the FAT
+uint32_t BlockIndex::getNodeReserve(uint32_t count) {
+    return 0;
+}
+
+// continue behind the last block of the chain
+int BlockIndex::getGoal() {
+    if (this->isComplete) {
+        return this->blocks.empty() ? -1 : this->blocks.back() + 1;
+    }
+    return this->file->tailBlock > 0 ? (int) this->file->tailBlock : -1;
+}
@@ -1,140 +1,423 @@
 #include <DMap.h>
 
+#include <algorithm>
+
+#define WORD_BITS 64
+#define FULL_WORD (~(uint64_t) 0)
+#define GROUP_WORDS 64  // words per group of the free space summary, 4096 blocks
+
+// the mapped DMap region is used as word array, the container stores the words in host byte order
+static_assert(sizeof(uint64_t) * 8 == WORD_BITS, "DMap requires 64 bit words");
+
 
 // DMap Constructor
 // init blockdevice for current object
-DMap::DMap(BlockDevice *device) {
+DMap::DMap(BlockCache *device, SuperBlock *superBlock) {
     this->device = device;
-    for (int i = 0; i < DATA_BLOCKS; i++) {
-        this->blocks[i] = false;
+    this->blockSize = superBlock->getBlockSize();
+    this->dataBlocks = superBlock->getDataBlocks();
+    this->wordCount = (this->dataBlocks + WORD_BITS - 1) / WORD_BITS;
+    this->offset = superBlock->getDMapOffset();
+    this->size = superBlock->getDMapSize();
+    this->isByteFormat = superBlock->hasByteDMap();
+    this->groupCount = (this->wordCount + GROUP_WORDS - 1) / GROUP_WORDS;
+    this->words = new uint64_t[this->wordCount];
+    for (uint32_t i = 0; i < this->wordCount; i++) {
+        this->words[i] = 0;
     }
+    setPadding();
+    buildSummary();
+    buildRuns();
+    this->persistBuffer = new char[(size_t) this->size * this->blockSize];
+    memset(this->persistBuffer, 0, (size_t) this->size * this->blockSize);
+    this->isDirty.assign(this->size, false);
 }
 
 // DMap Destructor
 DMap::~DMap() {
-
+    delete[] this->persistBuffer;
+    if (!this->isMapped) {
+        delete[] this->words;
+    }
 }
 
 // return index of the next free data block available
 int DMap::getNextFreeBlock() {
-    for (int i = 0; i < DATA_BLOCKS; i++) {
-        if (!getBlockState(i)) {
-            setBlockState(i, true);  // set the new state
-            return i;
-        }
+    int *block = getXAmountOfFreeBlocks(1);
+    if (block == nullptr) {
+        return -1;
     }
-    return -1;
+    int index = block[0];
+    delete[] block;
+    return index;
 }
 
 // return an array containing indexes of a requested amount of data blocks
-int* DMap::getXAmountOfFreeBlocks(int amount) {
+// if the goal block is free, the blocks from there on are taken first, so that a file grows in place. Otherwise the
+// blocks are taken from the smallest run of free blocks that holds all of them. If there is none, the largest runs
+// are used until the rest fits into a single run, so the request is split into as few pieces as possible. The blocks
+// are only taken if there are enough of them.
+int* DMap::getXAmountOfFreeBlocks(int amount, int goal) {
+    if (amount <= 0 || (uint32_t) amount > getFreeBlockCount()) {
+        return nullptr;
+    }
 
     int* freeBlockArray = new int[amount];
-
-    for (int i = 0; i < amount; i++) {
-        int freeBlockIndex = getNextFreeBlock();
-        if (freeBlockIndex >= 0) {
-            freeBlockArray[i] = freeBlockIndex;
-        } else {
-            return nullptr;
+    uint32_t found = 0;
+    if (goal >= 0 && (uint32_t) goal < this->dataBlocks && !getBlockState(goal)) {
+        found = takeBlocks((uint32_t) goal, amount, freeBlockArray);
+    }
+    while (found < (uint32_t) amount) {
+        uint32_t missing = amount - found;
+        auto fit = this->runsBySize.lower_bound(std::make_pair(missing, (uint32_t) 0));
+        if (fit == this->runsBySize.end()) {
+            fit--;  // largest run
         }
+        found += takeBlocks(fit->second, missing, freeBlockArray + found);
     }
-
     return freeBlockArray;
 }
 
+// take up to amount blocks starting at a free block, as far as its run reaches. Return the number of blocks taken.
+uint32_t DMap::takeBlocks(uint32_t start, uint32_t amount, int *blocks) {
+    auto run = std::prev(this->freeRuns.upper_bound(start));
+    uint32_t runStart = run->first;
+    uint32_t runEnd = run->first + run->second;
+    uint32_t taken = std::min(amount, runEnd - start);
+
+    removeRun(run);
+    if (runStart < start) {
+        addRun(runStart, start - runStart);
+    }
+    if (start + taken < runEnd) {
+        addRun(start + taken, runEnd - start - taken);
+    }
+    setRange(start, taken, true);
+    for (uint32_t i = 0; i < taken; i++) {
+        blocks[i] = (int) (start + i);
+    }
+    return taken;
+}
+
 // set the usage status of a data block to true/false
+// a used block splits the free run it belonged to, a free block joins the runs next to it
 void DMap::setBlockState(int dataBlockNum, bool isUsed) {
-    this->blocks[dataBlockNum] = isUsed;
+    if (getBlockState(dataBlockNum) == isUsed) {
+        return;
+    }
+
+    uint32_t block = (uint32_t) dataBlockNum;
+    setRange(block, 1, isUsed);
     if (isUsed) {
-        decreaseFreeBlockCounterBy(1);
+        auto run = std::prev(this->freeRuns.upper_bound(block));
+        uint32_t start = run->first;
+        uint32_t end = run->first + run->second;
+        removeRun(run);
+        if (start < block) {
+            addRun(start, block - start);
+        }
+        if (block + 1 < end) {
+            addRun(block + 1, end - block - 1);
+        }
     } else {
-        increaseFreeBlockCounterBy(1);
+        uint32_t start = block;
+        uint32_t end = block + 1;
+        auto next = this->freeRuns.find(end);
+        if (next != this->freeRuns.end()) {
+            end += next->second;
+            removeRun(next);
+        }
+        auto previous = this->freeRuns.lower_bound(block);
+        if (previous != this->freeRuns.begin()) {
+            previous--;
+            if (previous->first + previous->second == block) {
+                start = previous->first;
+                removeRun(previous);
+            }
+        }
+        addRun(start, end - start);
     }
 }
 
 // return the usage status of a data block
 bool DMap::getBlockState(int dataBlockNum) {
-    return this->blocks[dataBlockNum];
+    return (this->words[dataBlockNum / WORD_BITS] >> (dataBlockNum % WORD_BITS)) & 1;
+}
+
+// return the number of free data blocks that are not reserved
+uint32_t DMap::getFreeBlockCount() {
+    return this->freeBlocks - this->reservedBlocks;
 }
 
-// increase the counter which keeps track of the total of free blocks by
-// the requested amount
-void DMap::increaseFreeBlockCounterBy(int amount) {
-    this->freeBlockCounter += amount;
+// keep free blocks for a later allocation, return false if there are not enough of them
+// the caller releases the reservation right before it allocates the blocks
+bool DMap::reserveBlocks(uint32_t amount) {
+    if (amount > getFreeBlockCount()) {
+        return false;
+    }
+    this->reservedBlocks += amount;
+    return true;
 }
 
-// decrease the counter which keeps track of the total of free blocks by
-// the requested amount
-void DMap::decreaseFreeBlockCounterBy(int amount) {
-    this->freeBlockCounter -= amount;
+// give reserved blocks back
+void DMap::releaseBlocks(uint32_t amount) {
+    this->reservedBlocks -= std::min(amount, this->reservedBlocks);
 }
 
 // write the changes to the disk
+// only the DMap blocks modified since the last persist are written, all of them in a single batch, so adjacent blocks
+// become one request. The writes are only queued, the caller has to wait for them with
+// BlockCache::waitForCompletion()
 bool DMap::persist() {
+    std::vector<uint32_t> blockNos;
+    std::vector<char *> buffers;
+    size_t bytes = (size_t) this->wordCount * sizeof(uint64_t);
 
-    char buff[BLOCK_SIZE];
-
-    // for blocks that need to be stored within DMap
-    for (int current_block_index = 0; current_block_index < DMAP_SIZE; current_block_index++) {
-
-        // store 1 bit for every written block
-        for (int blockdevice_byte_index = 0; blockdevice_byte_index < BLOCK_SIZE; blockdevice_byte_index++) {
+    for (uint32_t i = 0; i < this->size; i++) {
+        if (!this->isDirty[i]) {
+            continue;
+        }
+        this->isDirty[i] = false;
 
-            int block_track_array_index = (current_block_index * BLOCK_SIZE) + blockdevice_byte_index;
+        size_t start = (size_t) i * this->blockSize;
+        blockNos.push_back(this->offset + i);
 
-            // verify that the index from the array which tracks all available blocks
-            // is within bounds
-            if (block_track_array_index < DATA_BLOCKS) {
-                buff[blockdevice_byte_index] = blocks[block_track_array_index];
-            } else {  // fill up with zeroes after reaching end of blocks array
-                buff[blockdevice_byte_index] = 0;
-            }
+        // the mapped DMap already is the on-disk image, writing it only marks it as dirty
+        if (this->isMapped) {
+            buffers.push_back((char *) this->words + start);
+            continue;
+        }
 
+        // copy the words of this block, the part of the region behind the last word stays zero
+        if (start < bytes) {
+            size_t length = std::min(bytes - start, (size_t) this->blockSize);
+            memcpy(this->persistBuffer + start, (char *) this->words + start, length);
         }
-        this->device->write(DMAP_OFFSET + current_block_index, buff);
+        buffers.push_back(this->persistBuffer + start);
+    }
+
+    if (!blockNos.empty()) {
+        this->device->submitWriteBlocks(blockNos.data(), (uint32_t) blockNos.size(), buffers.data());
     }
     return true;
 }
 
+// move a DMap loaded from the byte format into the bitmap region of the upgraded superblock
+// the bitmap is only queued, the caller has to wait for it with BlockCache::waitForCompletion()
+void DMap::convert(SuperBlock *superBlock) {
+    this->offset = superBlock->getDMapOffset();
+    this->size = superBlock->getDMapSize();
+    this->isByteFormat = false;
+
+    delete[] this->persistBuffer;
+    this->persistBuffer = new char[(size_t) this->size * this->blockSize];
+    memset(this->persistBuffer, 0, (size_t) this->size * this->blockSize);
+
+    // the whole bitmap is new
+    this->isDirty.assign(this->size, true);
+    persist();
+    useMappedRegion();
+}
+
 // initialise the (existing) DMap and check the current available blocks
 void DMap::initDMap() {
 
-    char buff[BLOCK_SIZE];
+    if (this->isByteFormat) {
+        loadByteFormat();
+    } else if (!useMappedRegion()) {
+        // read the whole region, the words sit at its start
+        for (uint32_t i = 0; i < this->size; i++) {
+            this->device->read(this->offset + i, this->persistBuffer + (size_t) i * this->blockSize);
+        }
+        memcpy(this->words, this->persistBuffer, (size_t) this->wordCount * sizeof(uint64_t));
+    }
 
-    // iterate over every block assigned to the dmap
-    for (int i = 0; i < DMAP_SIZE; i++) {
+    // a mapped DMap can be used as it is, only summarise and index the free blocks
+    setPadding();
+    buildSummary();
+    buildRuns();
+}
 
-        // set the block index if a superblock has been defined
-        int current_block_index = i + DMAP_OFFSET;
+// initialise a DMap for an empty filesystem
+void DMap::initialInitDMap() {
+    this->isDirty.assign(this->size, true);
+    persist();
+    this->device->waitForCompletion();
+    useMappedRegion();
+}
+
+// work directly on the DMap region if the container file is mapped
+// return true if words points into the mapping
+bool DMap::useMappedRegion() {
+    if (this->isByteFormat) {
+        return false;
+    }
+    char *region = this->device->getBlockPointer(this->offset);
+    if (region == nullptr) {
+        return false;
+    }
+    if (!this->isMapped) {
+        delete[] this->words;
+    }
+    this->words = (uint64_t *) region;
+    this->isMapped = true;
+    return true;
+}
+
+// set or clear the bits of a range of blocks, a word at a time, and keep the summary of the groups up to date
+void DMap::setRange(uint32_t first, uint32_t count, bool isUsed) {
+    uint32_t end = first + count;
+    while (first < end) {
+        uint32_t word = first / WORD_BITS;
+        uint32_t bit = first % WORD_BITS;
+        uint32_t bits = std::min(end - first, WORD_BITS - bit);
+        uint64_t mask = (bits == WORD_BITS ? FULL_WORD : (((uint64_t) 1 << bits) - 1)) << bit;
+        int freed = __builtin_popcountll(this->words[word] & mask);
+        if (isUsed) {
+            this->words[word] |= mask;
+        } else {
+            this->words[word] &= ~mask;
+        }
+        updateGroup(word / GROUP_WORDS, isUsed ? freed - (int) bits : freed);
+        markDirty(word);
+        first += bits;
+    }
+}
+
+// return the first block at or behind from whose bit has the given state, the number of bits if there is none
+// whenever the search reaches the end of a group, the groups without such a bit are skipped using the summary
+uint32_t DMap::findBit(uint32_t from, bool isUsed) {
+    uint32_t word = from / WORD_BITS;
+    if (word >= this->wordCount) {
+        return this->wordCount * WORD_BITS;
+    }
+    uint64_t bits = (isUsed ? this->words[word] : ~this->words[word]) & (FULL_WORD << (from % WORD_BITS));
+    while (bits == 0) {
+        word++;
+        if (word % GROUP_WORDS == 0) {
+            word = findGroup(word / GROUP_WORDS, isUsed) * GROUP_WORDS;
+        }
+        if (word >= this->wordCount) {
+            return this->wordCount * WORD_BITS;
+        }
+        bits = isUsed ? this->words[word] : ~this->words[word];
+    }
+    return word * WORD_BITS + __builtin_ctzll(bits);
+}
+
+// return the first group at or behind from that holds a block of the given state, the number of groups if there is
+// none. Groups with free blocks are found in the non-empty mask, a word of it covers 64 groups.
+uint32_t DMap::findGroup(uint32_t from, bool isUsed) {
+    if (isUsed) {
+        while (from < this->groupCount && this->groupFree[from] == getGroupBits(from)) {
+            from++;
+        }
+        return from;
+    }
+
+    uint32_t maskWord = from / WORD_BITS;
+    if (maskWord >= this->groupMask.size()) {
+        return this->groupCount;
+    }
+    uint64_t bits = this->groupMask[maskWord] & (FULL_WORD << (from % WORD_BITS));
+    while (bits == 0) {
+        if (++maskWord == this->groupMask.size()) {
+            return this->groupCount;
+        }
+        bits = this->groupMask[maskWord];
+    }
+    return maskWord * WORD_BITS + __builtin_ctzll(bits);
+}
+
+// return the number of bits of a group, the last group may be shorter
+uint32_t DMap::getGroupBits(uint32_t group) {
+    return std::min((uint32_t) GROUP_WORDS, this->wordCount - group * GROUP_WORDS) * WORD_BITS;
+}
+
+// add the change of the free blocks of a group to its count, the non-empty mask and the total
+void DMap::updateGroup(uint32_t group, int delta) {
+    if (delta == 0) {
+        return;
+    }
+    this->groupFree[group] += delta;
+    this->freeBlocks += delta;
+    uint64_t bit = (uint64_t) 1 << (group % WORD_BITS);
+    if (this->groupFree[group] > 0) {
+        this->groupMask[group / WORD_BITS] |= bit;
+    } else {
+        this->groupMask[group / WORD_BITS] &= ~bit;
+    }
+}
+
+// derive the free blocks of every group and the total from the bitmap, the set padding bits count as used
+void DMap::buildSummary() {
+    this->groupFree.assign(this->groupCount, 0);
+    this->groupMask.assign((this->groupCount + WORD_BITS - 1) / WORD_BITS, 0);
+    this->freeBlocks = 0;
+    for (uint32_t i = 0; i < this->wordCount; i++) {
+        updateGroup(i / GROUP_WORDS, WORD_BITS - __builtin_popcountll(this->words[i]));
+    }
+}
+
+// index the runs of free blocks of the bitmap, the set padding bits end the last run at the last data block
+void DMap::buildRuns() {
+    this->freeRuns.clear();
+    this->runsBySize.clear();
+
+    uint32_t block = findBit(0, false);
+    while (block < this->dataBlocks) {
+        uint32_t end = std::min(findBit(block, true), this->dataBlocks);
+        addRun(block, end - block);
+        block = findBit(end, false);
+    }
+}
+
+// add a run of free blocks to both indexes
+void DMap::addRun(uint32_t start, uint32_t length) {
+    this->freeRuns[start] = length;
+    this->runsBySize.insert(std::make_pair(length, start));
+}
+
+// remove a run of free blocks from both indexes
+void DMap::removeRun(std::map<uint32_t, uint32_t>::iterator run) {
+    this->runsBySize.erase(std::make_pair(run->second, run->first));
+    this->freeRuns.erase(run);
+}
+
+// remember that the DMap block holding the given word has to be written
+void DMap::markDirty(uint32_t word) {
+    this->isDirty[(size_t) word * sizeof(uint64_t) / this->blockSize] = true;
+}
+
+// mark the bits behind the last data block as used, so that the search for free blocks never returns them
+void DMap::setPadding() {
+    uint32_t usedBits = this->dataBlocks % WORD_BITS;
+    if (usedBits != 0) {
+        this->words[this->wordCount - 1] |= FULL_WORD << usedBits;
+    }
+}
+
+// read a DMap that stores one byte per block, as written by older versions
+void DMap::loadByteFormat() {
+    char *buff = new char[this->blockSize];
+
+    // iterate over every block assigned to the dmap
+    for (uint32_t i = 0; i < this->size; i++) {
 
         // reset the buffer
-        memset(buff, 0, BLOCK_SIZE);
+        memset(buff, 0, this->blockSize);
         // grab the block data
-        this->device->read(current_block_index, buff);
+        this->device->read(this->offset + i, buff);
 
-        // assign each value from buffer to blocks array
-        for (int j = 0; j < BLOCK_SIZE; j++) {
-            int blocks_index = (BLOCK_SIZE * i) + j;
+        // assign each value from buffer to the bitmap
+        for (uint32_t j = 0; j < this->blockSize; j++) {
+            uint32_t blocks_index = (this->blockSize * i) + j;
 
             // make sure the blocks index is in range
-            if (blocks_index < DATA_BLOCKS) {
-                // initialise the blocks array
-                this->blocks[blocks_index] = buff[j];
-                // decrease the counter if an occupied block has been found
-                if (buff[j] == 1) {
-                    decreaseFreeBlockCounterBy(1);
-                }
+            if (blocks_index < this->dataBlocks && buff[j] == 1) {
+                this->words[blocks_index / WORD_BITS] |= (uint64_t) 1 << (blocks_index % WORD_BITS);
             }
         }
     }
-}
-
-// initialise a DMap for an empty filesystem
-void DMap::initialInitDMap() {
-    char buffer[BLOCK_SIZE];
-    for (int i = 0; i < DMAP_SIZE; i++) {
-        memset(buffer, 0, BLOCK_SIZE);
-        device->write(DMAP_OFFSET + i, buffer);
-    }
+    delete[] buff;
 }
@@ -0,0 +1,64 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "DentryCache.h"
+
+#include <iterator>
+
+// FNV-1a hash of the directory and the name
+size_t DentryCache::keyHash::operator()(const dentryKey &key) const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ ((key.parent >> (8 * i)) & 0xff)) * 1099511628211ULL;
+    }
+    for (char c : key.name) {
+        hash = (hash ^ (uint8_t) c) * 1099511628211ULL;
+    }
+    return (size_t) hash;
+}
+
+bool DentryCache::keyEqual::operator()(const dentryKey &a, const dentryKey &b) const {
+    return a.parent == b.parent && a.name == b.name;
+}
+
+// DentryCache constructor
+DentryCache::DentryCache(uint32_t capacity) {
+    this->capacity = capacity;
+    this->entries.reserve(capacity);
+}
+
+// look up a name of the given length in a directory, return false if there is no entry for it
+bool DentryCache::find(uint32_t parent, const char *name, size_t length, int *block) {
+    this->probe.parent = parent;
+    this->probe.name.assign(name, length);
+    auto entry = this->entries.find(this->probe);
+    if (entry == this->entries.end()) {
+        return false;
+    }
+    *block = entry->second;
+    return true;
+}
+
+// add or replace the entry of a name, DENTRY_NEGATIVE records that it does not exist
+void DentryCache::insert(uint32_t parent, const std::string &name, int block) {
+    if (this->entries.size() >= this->capacity) {
+        for (auto entry = this->entries.begin();
+             entry != this->entries.end() && this->entries.size() > this->capacity / 2;) {
+            entry = this->entries.erase(entry);
+        }
+    }
+    this->entries[{parent, name}] = block;
+}
+
+// drop the entries of a removed directory, its inode may become a directory again
+void DentryCache::removeChildren(uint32_t parent) {
+    for (auto entry = this->entries.begin(); entry != this->entries.end();) {
+        entry = entry->first.parent == parent ? this->entries.erase(entry) : std::next(entry);
+    }
+}
+
+// remove all entries
+void DentryCache::clear() {
+    this->entries.clear();
+}
@@ -0,0 +1,401 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "DirTree.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#define DIR_MAX_DEPTH 16  // deeper trees are only found in damaged containers
+#define DIR_LEAF_ENTRY 13  // key, inode and name length of a leaf entry, the name follows
+#define DIR_INDEX_ENTRY 12  // key and child block of an index entry
+#define DIR_COUNTER_MASK 0xffffffffULL  // lower part of a key, tells apart names with the same hash
+
+// DirTree constructor, the root is set with create() or open()
+DirTree::DirTree(BlockCache *device, DMap *dMap, SuperBlock *superBlock) {
+    this->device = device;
+    this->dMap = dMap;
+    this->blockSize = superBlock->getBlockSize();
+    this->dataOffset = superBlock->getDataOffset();
+}
+
+// FNV-1a hash of a name folded to 30 bits, the key of the name starts with it
+uint64_t DirTree::hashName(const char *name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t) *c) * 1099511628211ULL;
+    }
+    return (hash ^ (hash >> 30) ^ (hash >> 60)) & 0x3fffffff;
+}
+
+// allocate and write an empty leaf as root
+int DirTree::create() {
+    int block = this->dMap->getNextFreeBlock();
+    if (block < 0) {
+        return -ENOSPC;
+    }
+    this->root = (uint32_t) block;
+    return writeNode(this->root, {0, {}, {}, {}});
+}
+
+// continue with the tree of an existing container
+void DirTree::open(uint32_t root) {
+    this->root = root;
+}
+
+uint32_t DirTree::getRoot() {
+    return this->root;
+}
+
+// bytes an entry takes in its node
+size_t DirTree::entrySize(const dirNode &node, size_t i) {
+    return node.depth == 0 ? DIR_LEAF_ENTRY + node.names[i].size() : DIR_INDEX_ENTRY;
+}
+
+// bytes a node with the given entries takes
+size_t DirTree::nodeSize(const dirNode &node, size_t from, size_t to) {
+    size_t size = sizeof(dirNodeHeader);
+    for (size_t i = from; i < to; i++) {
+        size += entrySize(node, i);
+    }
+    return size;
+}
+
+// cut a node that does not fit into its block into pieces that do, a single piece is returned if it fits. Two pieces
+// of about the same size are preferred, a leaf with long names may need three.
+std::vector<DirTree::dirNode> DirTree::split(const dirNode &node) {
+    size_t count = node.keys.size();
+    if (nodeSize(node, 0, count) <= this->blockSize) {
+        return {node};
+    }
+
+    std::vector<size_t> cuts;  // first entry of every piece behind the first one
+    size_t total = nodeSize(node, 0, count) - sizeof(dirNodeHeader);
+    size_t left = 0;
+    size_t cut = 0;
+    while (cut < count && 2 * (left + entrySize(node, cut)) <= total) {
+        left += entrySize(node, cut++);
+    }
+    cut = std::max(cut, (size_t) 1);
+    if (nodeSize(node, 0, cut) <= this->blockSize && nodeSize(node, cut, count) <= this->blockSize) {
+        cuts.push_back(cut);
+    } else {
+        size_t size = sizeof(dirNodeHeader);
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0 && size + entrySize(node, i) > this->blockSize) {
+                cuts.push_back(i);
+                size = sizeof(dirNodeHeader);
+            }
+            size += entrySize(node, i);
+        }
+    }
+    cuts.push_back(count);
+
+    std::vector<dirNode> pieces;
+    size_t from = 0;
+    for (size_t to : cuts) {
+        dirNode piece = {node.depth, {}, {}, {}};
+        piece.keys.assign(node.keys.begin() + from, node.keys.begin() + to);
+        piece.blocks.assign(node.blocks.begin() + from, node.blocks.begin() + to);
+        if (node.depth == 0) {
+            piece.names.assign(node.names.begin() + from, node.names.begin() + to);
+        }
+        pieces.push_back(piece);
+        from = to;
+    }
+    return pieces;
+}
+
+// read a node from its data block, the entries are checked against the size of the block
+int DirTree::readNode(uint32_t block, dirNode *node) {
+    char *buffer = new char[this->blockSize];
+    int ret = this->device->read(this->dataOffset + block, buffer) == 0 ? 0 : -EIO;
+
+    dirNodeHeader header;
+    memcpy(&header, buffer, sizeof(header));
+    if (ret == 0 && (header.magic != DIR_NODE_MAGIC || header.depth > DIR_MAX_DEPTH)) {
+        ret = -EIO;
+    }
+
+    node->depth = header.depth;
+    node->keys.clear();
+    node->blocks.clear();
+    node->names.clear();
+    size_t pos = sizeof(header);
+    for (uint32_t i = 0; i < header.count && ret == 0; i++) {
+        size_t size = header.depth == 0 ? DIR_LEAF_ENTRY : DIR_INDEX_ENTRY;
+        if (pos + size > this->blockSize) {
+            ret = -EIO;
+            break;
+        }
+        uint64_t key;
+        uint32_t value;
+        memcpy(&key, buffer + pos, sizeof(key));
+        memcpy(&value, buffer + pos + sizeof(key), sizeof(value));
+        node->keys.push_back(key);
+        node->blocks.push_back(value);
+        if (header.depth == 0) {
+            uint8_t length = (uint8_t) buffer[pos + 12];
+            if (pos + size + length > this->blockSize) {
+                ret = -EIO;
+                break;
+            }
+            node->names.emplace_back(buffer + pos + size, length);
+            size += length;
+        }
+        pos += size;
+    }
+
+    delete[] buffer;
+    return ret;
+}
+
+// write a node into its data block
+int DirTree::writeNode(uint32_t block, const dirNode &node) {
+    char *buffer = new char[this->blockSize];
+    memset(buffer, 0, this->blockSize);
+
+    dirNodeHeader header = {DIR_NODE_MAGIC, node.depth, (uint32_t) node.keys.size()};
+    memcpy(buffer, &header, sizeof(header));
+    size_t pos = sizeof(header);
+    for (size_t i = 0; i < node.keys.size(); i++) {
+        memcpy(buffer + pos, &node.keys[i], sizeof(uint64_t));
+        memcpy(buffer + pos + sizeof(uint64_t), &node.blocks[i], sizeof(uint32_t));
+        if (node.depth == 0) {
+            buffer[pos + 12] = (char) node.names[i].size();
+            memcpy(buffer + pos + DIR_LEAF_ENTRY, node.names[i].data(), node.names[i].size());
+        }
+        pos += entrySize(node, i);
+    }
+
+    int ret = this->device->write(this->dataOffset + block, buffer);
+    delete[] buffer;
+    return ret == 0 ? 0 : -EIO;
+}
+
+// read the nodes from the root down to the leaf that holds the key. An index node is left through the last entry with
+// a key not above the searched one, the first entry also covers all keys below it.
+int DirTree::descend(uint64_t key, std::vector<pathStep> *path) {
+    path->clear();
+    uint32_t block = this->root;
+    while (true) {
+        path->push_back({block, {0, {}, {}, {}}, 0});
+        pathStep &step = path->back();
+        int ret = readNode(block, &step.node);
+        if (ret < 0) {
+            return ret;
+        }
+        if (path->size() > 1 && step.node.depth + 1 != (*path)[path->size() - 2].node.depth) {
+            return -EIO;
+        }
+        if (step.node.depth == 0) {
+            return 0;
+        }
+        if (step.node.keys.empty()) {
+            return -EIO;  // only a root leaf can be empty
+        }
+
+        auto upper = std::upper_bound(step.node.keys.begin(), step.node.keys.end(), key);
+        step.slot = upper == step.node.keys.begin() ? 0 : (size_t) (upper - step.node.keys.begin()) - 1;
+        block = step.node.blocks[step.slot];
+    }
+}
+
+// find the entry of a name among the keys of its hash. Return its inode or -ENOENT, in that case key is set
+// to the free key behind the last name with the same hash.
+int DirTree::lookup(const char *name, uint64_t *key, uint32_t *block) {
+    uint64_t base = hashName(name) << 32;
+    uint64_t from = base;
+    *key = base;
+
+    std::string entryName;
+    uint64_t entryKey;
+    uint32_t entryBlock;
+    while (true) {
+        int ret = next(from, &entryKey, &entryBlock, &entryName);
+        if (ret == -ENOENT || (ret == 0 && (entryKey & ~DIR_COUNTER_MASK) != base)) {
+            return -ENOENT;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        if (entryName == name) {
+            *key = entryKey;
+            *block = entryBlock;
+            return (int) entryBlock;
+        }
+        *key = entryKey + 1;
+        from = entryKey + 1;
+        if ((entryKey & DIR_COUNTER_MASK) == DIR_COUNTER_MASK) {
+            return -ENOSPC;  // every key of this hash is taken
+        }
+    }
+}
+
+// return the inode of a name
+int DirTree::find(const char *name) {
+    uint64_t key;
+    uint32_t block;
+    return lookup(name, &key, &block);
+}
+
+// add an entry to its leaf and split the nodes that overflow
+int DirTree::insert(const char *name, uint32_t block) {
+    uint64_t key;
+    uint32_t existing;
+    int ret = lookup(name, &key, &existing);
+    if (ret >= 0) {
+        return -EEXIST;
+    }
+    if (ret != -ENOENT) {
+        return ret;
+    }
+
+    std::vector<pathStep> path;
+    ret = descend(key, &path);
+    if (ret < 0) {
+        return ret;
+    }
+    dirNode &leaf = path.back().node;
+    size_t pos = std::upper_bound(leaf.keys.begin(), leaf.keys.end(), key) - leaf.keys.begin();
+    leaf.keys.insert(leaf.keys.begin() + pos, key);
+    leaf.blocks.insert(leaf.blocks.begin() + pos, block);
+    leaf.names.insert(leaf.names.begin() + pos, name);
+    return update(path);
+}
+
+// write the changed leaf at the end of the path. If it overflows, its pieces go to new nodes that are added to its
+// parent, up to the root, whose pieces move below it.
+int DirTree::update(std::vector<pathStep> &path) {
+    if (split(path.back().node).size() == 1) {
+        return writeNode(path.back().block, path.back().node);
+    }
+
+    // a leaf is cut into at most three pieces and every index node into at most two, the root keeps its block. All
+    // blocks that may be needed are taken at once, so that nothing changes if there is no space left.
+    int reserved = (int) path.size() + 2;
+    int *newBlocks = this->dMap->getXAmountOfFreeBlocks(reserved);
+    if (newBlocks == nullptr) {
+        return -ENOSPC;
+    }
+
+    int used = 0;
+    int ret = 0;
+    for (size_t level = path.size() - 1; ret == 0; level--) {
+        std::vector<dirNode> pieces = split(path[level].node);
+        if (pieces.size() == 1) {
+            ret = writeNode(path[level].block, pieces[0]);
+            break;
+        }
+
+        if (level == 0) {
+            dirNode newRoot = {(uint16_t) (pieces[0].depth + 1), {}, {}, {}};
+            for (const dirNode &piece : pieces) {
+                uint32_t block = (uint32_t) newBlocks[used++];
+                ret = ret == 0 ? writeNode(block, piece) : ret;
+                newRoot.keys.push_back(piece.keys[0]);
+                newRoot.blocks.push_back(block);
+            }
+            ret = ret == 0 ? writeNode(this->root, newRoot) : ret;
+            break;
+        }
+
+        ret = writeNode(path[level].block, pieces[0]);
+        pathStep &parent = path[level - 1];
+        for (size_t i = 1; i < pieces.size() && ret == 0; i++) {
+            uint32_t block = (uint32_t) newBlocks[used++];
+            ret = writeNode(block, pieces[i]);
+            parent.node.keys.insert(parent.node.keys.begin() + parent.slot + i, pieces[i].keys[0]);
+            parent.node.blocks.insert(parent.node.blocks.begin() + parent.slot + i, block);
+        }
+    }
+
+    for (int i = used; i < reserved; i++) {
+        this->dMap->setBlockState(newBlocks[i], false);
+    }
+    delete[] newBlocks;
+    return ret;
+}
+
+// remove an entry from its leaf. Empty nodes are freed and removed from their parents, a root with a single child
+// takes over the content of the child.
+int DirTree::remove(const char *name) {
+    uint64_t key;
+    uint32_t block;
+    int ret = lookup(name, &key, &block);
+    if (ret < 0) {
+        return ret;
+    }
+
+    std::vector<pathStep> path;
+    ret = descend(key, &path);
+    if (ret < 0) {
+        return ret;
+    }
+    dirNode &leaf = path.back().node;
+    auto entry = std::lower_bound(leaf.keys.begin(), leaf.keys.end(), key);
+    if (entry == leaf.keys.end() || *entry != key) {
+        return -EIO;
+    }
+    size_t pos = entry - leaf.keys.begin();
+    leaf.keys.erase(leaf.keys.begin() + pos);
+    leaf.blocks.erase(leaf.blocks.begin() + pos);
+    leaf.names.erase(leaf.names.begin() + pos);
+
+    size_t level = path.size() - 1;
+    while (level > 0 && path[level].node.keys.empty()) {
+        this->dMap->setBlockState((int) path[level].block, false);
+        pathStep &parent = path[--level];
+        parent.node.keys.erase(parent.node.keys.begin() + parent.slot);
+        parent.node.blocks.erase(parent.node.blocks.begin() + parent.slot);
+    }
+    if (level > 0) {
+        return writeNode(path[level].block, path[level].node);
+    }
+
+    dirNode &rootNode = path[0].node;
+    if (rootNode.keys.empty()) {
+        rootNode.depth = 0;
+    }
+    while (rootNode.depth > 0 && rootNode.keys.size() == 1) {
+        uint32_t child = rootNode.blocks[0];
+        ret = readNode(child, &rootNode);
+        if (ret < 0) {
+            return ret;
+        }
+        this->dMap->setBlockState((int) child, false);
+    }
+    return writeNode(this->root, rootNode);
+}
+
+// find the first entry with a key not below the given one. If the leaf it belongs to has no such entry, the search
+// continues at the lowest key of the next subtree to the right.
+int DirTree::next(uint64_t from, uint64_t *key, uint32_t *block, std::string *name) {
+    std::vector<pathStep> path;
+    while (true) {
+        int ret = descend(from, &path);
+        if (ret < 0) {
+            return ret;
+        }
+
+        dirNode &leaf = path.back().node;
+        auto entry = std::lower_bound(leaf.keys.begin(), leaf.keys.end(), from);
+        if (entry != leaf.keys.end()) {
+            size_t i = entry - leaf.keys.begin();
+            *key = leaf.keys[i];
+            *block = leaf.blocks[i];
+            *name = leaf.names[i];
+            return 0;
+        }
+
+        size_t level = path.size() - 1;
+        while (level > 0 && path[level - 1].slot + 1 >= path[level - 1].node.keys.size()) {
+            level--;
+        }
+        if (level == 0) {
+            return -ENOENT;
+        }
+        from = path[level - 1].node.keys[path[level - 1].slot + 1];
+    }
+}
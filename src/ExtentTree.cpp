@@ -0,0 +1,369 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "ExtentTree.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#define EXTENT_MAX_DEPTH 8  // deeper trees are only found in damaged containers
+
+// ExtentTree constructor, the extents are read with load()
+ExtentTree::ExtentTree(BlockCache *device, DMap *dMap, SuperBlock *superBlock, rootFile *file) {
+    this->device = device;
+    this->dMap = dMap;
+    this->blockSize = superBlock->getBlockSize();
+    this->dataOffset = superBlock->getDataOffset();
+    this->nodeEntries = (this->blockSize - sizeof(extentHeader)) / sizeof(fileExtent);
+    this->file = file;
+}
+
+// read the extents from the root and the tree nodes below it
+int ExtentTree::load() {
+    extentHeader &root = this->file->extentRoot;
+    if (root.count > EXTENT_ROOT_ENTRIES || root.depth > EXTENT_MAX_DEPTH) {
+        return -EIO;
+    }
+
+    this->extents.clear();
+    this->nodes.assign(root.depth, std::vector<uint32_t>());
+    for (uint32_t i = 0; i < root.count; i++) {
+        if (root.depth == 0) {
+            this->extents.push_back(this->file->extents[i]);
+            continue;
+        }
+        int ret = loadNode(this->file->extents[i].physical, root.depth - 1);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    this->dirtyFrom = this->extents.size();
+    this->blockCount = this->extents.empty() ? 0 : this->extents.back().logical + this->extents.back().length;
+
+    // files written before the count was kept in the metadata get it now
+    if (this->file->mappedBlocks == 0) {
+        uint32_t count = 0;
+        for (const fileExtent &extent : this->extents) {
+            count += extent.length;
+        }
+        this->file->mappedBlocks = count + 1;
+    }
+    return 0;
+}
+
+// read a node and the subtree below it, the nodes of every level are visited from left to right
+int ExtentTree::loadNode(uint32_t block, uint16_t depth) {
+    char *buffer = new char[this->blockSize];
+    int ret = this->device->read(this->dataOffset + block, buffer) == 0 ? 0 : -EIO;
+
+    extentHeader header;
+    memcpy(&header, buffer, sizeof(header));
+    if (ret == 0 && (header.magic != EXTENT_NODE_MAGIC || header.depth != depth || header.count == 0 ||
+                     header.count > this->nodeEntries)) {
+        ret = -EIO;
+    }
+
+    if (ret == 0) {
+        this->nodes[depth].push_back(block);
+        fileExtent *entries = (fileExtent *) (buffer + sizeof(extentHeader));
+        for (uint32_t i = 0; i < header.count && ret == 0; i++) {
+            if (depth == 0) {
+                this->extents.push_back(entries[i]);
+            } else {
+                ret = loadNode(entries[i].physical, depth - 1);
+            }
+        }
+    }
+
+    delete[] buffer;
+    return ret;
+}
+
+// return the first extent that ends behind the given block, found with a binary search
+std::vector<fileExtent>::iterator ExtentTree::findExtent(uint32_t block) {
+    return std::lower_bound(this->extents.begin(), this->extents.end(), block,
+                            [](const fileExtent &e, uint32_t b) { return e.logical + e.length <= b; });
+}
+
+// find the data blocks of a range, starting at the extent holding its first block
+int ExtentTree::getBlocks(uint32_t first, uint32_t count, int *blocks) {
+    auto extent = findExtent(first);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = first + i;
+        while (extent != this->extents.end() && extent->logical + extent->length <= block) {
+            extent++;
+        }
+        if (extent != this->extents.end() && extent->logical <= block) {
+            blocks[i] = (int) (extent->physical + (block - extent->logical));
+        } else {
+            blocks[i] = -1;
+        }
+    }
+    return 0;
+}
+
+// map the new blocks behind the last mapped block
+void ExtentTree::append(const int *blocks, uint32_t count) {
+    map(this->blockCount, blocks, count);
+}
+
+// insert the runs of the new blocks as extents and merge them with the extents they continue
+void ExtentTree::map(uint32_t first, const int *blocks, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<fileExtent> added;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!added.empty() && added.back().physical + added.back().length == (uint32_t) blocks[i]) {
+            added.back().length++;
+        } else {
+            added.push_back({first + i, (uint32_t) blocks[i], 1});
+        }
+    }
+
+    size_t pos = findExtent(first) - this->extents.begin();
+    this->extents.insert(this->extents.begin() + pos, added.begin(), added.end());
+
+    // the new extents and their neighbours are merged where they continue each other
+    size_t from = pos > 0 ? pos - 1 : 0;
+    size_t to = std::min(pos + added.size() + 1, this->extents.size());
+    size_t last = from;
+    for (size_t i = from + 1; i < to; i++) {
+        fileExtent &merged = this->extents[last];
+        if (merged.logical + merged.length == this->extents[i].logical &&
+            merged.physical + merged.length == this->extents[i].physical) {
+            merged.length += this->extents[i].length;
+        } else {
+            this->extents[++last] = this->extents[i];
+        }
+    }
+    this->extents.erase(this->extents.begin() + last + 1, this->extents.begin() + to);
+
+    this->dirtyFrom = std::min(this->dirtyFrom, from);
+    this->blockCount = std::max(this->blockCount, first + count);
+    this->file->mappedBlocks += count;
+}
+
+// free the blocks of a range, the extents reaching into it are shortened or split
+int ExtentTree::unmap(uint32_t first, uint32_t count) {
+    uint32_t end = first + count;
+    size_t pos = findExtent(first) - this->extents.begin();
+    size_t last = pos;
+    std::vector<fileExtent> kept;  // parts of the extents outside of the range
+    while (last < this->extents.size() && this->extents[last].logical < end) {
+        fileExtent extent = this->extents[last++];
+        uint32_t extentEnd = extent.logical + extent.length;
+        uint32_t cutStart = std::max(first, extent.logical);
+        uint32_t cutEnd = std::min(end, extentEnd);
+        freeBlocks(extent.physical + (cutStart - extent.logical), cutEnd - cutStart);
+        this->file->mappedBlocks -= cutEnd - cutStart;
+        if (extent.logical < cutStart) {
+            kept.push_back({extent.logical, extent.physical, cutStart - extent.logical});
+        }
+        if (cutEnd < extentEnd) {
+            kept.push_back({cutEnd, extent.physical + (cutEnd - extent.logical), extentEnd - cutEnd});
+        }
+    }
+    if (last == pos) {
+        return 0;
+    }
+
+    this->extents.erase(this->extents.begin() + pos, this->extents.begin() + last);
+    this->extents.insert(this->extents.begin() + pos, kept.begin(), kept.end());
+    // the entry in front is rewritten as well, in case the removed extents were the last ones of its node
+    this->dirtyFrom = std::min(this->dirtyFrom, pos > 0 ? pos - 1 : 0);
+    this->blockCount = this->extents.empty() ? 0 : this->extents.back().logical + this->extents.back().length;
+    return 0;
+}
+
+// the extents that continue each other form one run of data, the hole starts behind it
+uint32_t ExtentTree::findBlock(uint32_t from, bool isMapped) {
+    auto extent = findExtent(from);
+    if (isMapped) {
+        return extent == this->extents.end() ? UINT32_MAX : std::max(from, extent->logical);
+    }
+
+    uint32_t block = from;
+    while (extent != this->extents.end() && extent->logical <= block) {
+        block = extent->logical + extent->length;
+        extent++;
+    }
+    return block;
+}
+
+// the gaps between the extents are holes
+bool ExtentTree::supportsHoles() {
+    return true;
+}
+
+// drop the extents behind the new end of the file and shorten the one it falls into
+void ExtentTree::truncate(uint32_t count) {
+    if (count >= this->blockCount) {
+        return;
+    }
+
+    while (!this->extents.empty()) {
+        fileExtent &last = this->extents.back();
+        if (last.logical >= count) {
+            freeBlocks(last.physical, last.length);
+            this->file->mappedBlocks -= last.length;
+            this->extents.pop_back();
+            continue;
+        }
+        if (last.logical + last.length > count) {
+            uint32_t keep = count - last.logical;
+            freeBlocks(last.physical + keep, last.length - keep);
+            this->file->mappedBlocks -= last.length - keep;
+            last.length = keep;
+        }
+        break;
+    }
+
+    this->blockCount = this->extents.empty() ? 0 : this->extents.back().logical + this->extents.back().length;
+    this->dirtyFrom = std::min(this->dirtyFrom, this->extents.empty() ? 0 : this->extents.size() - 1);
+}
+
+// pack the extents into as many levels of nodes as needed until the top level fits into the root
+int ExtentTree::persist() {
+    std::vector<size_t> counts;  // nodes per level
+    size_t entries = this->extents.size();
+    while (entries > EXTENT_ROOT_ENTRIES) {
+        entries = (entries + this->nodeEntries - 1) / this->nodeEntries;
+        counts.push_back(entries);
+    }
+
+    // allocate all new nodes at once, so that nothing changes if there is no space left
+    size_t missing = 0;
+    for (size_t level = 0; level < counts.size(); level++) {
+        size_t existing = level < this->nodes.size() ? this->nodes[level].size() : 0;
+        if (counts[level] > existing) {
+            missing += counts[level] - existing;
+        }
+    }
+    int *newBlocks = nullptr;
+    if (missing > 0) {
+        newBlocks = this->dMap->getXAmountOfFreeBlocks((int) missing);
+        if (newBlocks == nullptr) {
+            return -ENOSPC;
+        }
+    }
+
+    // free the nodes that are not needed anymore, always the last ones of a level
+    for (size_t level = 0; level < this->nodes.size(); level++) {
+        size_t keep = level < counts.size() ? counts[level] : 0;
+        while (this->nodes[level].size() > keep) {
+            this->dMap->setBlockState((int) this->nodes[level].back(), false);
+            this->nodes[level].pop_back();
+        }
+    }
+    this->nodes.resize(counts.size());
+
+    // write the levels bottom up, a node is written if it is new or holds a changed entry. The nodes of a level
+    // before the first changed entry keep their content, so the same holds for the index entries pointing to them.
+    std::vector<fileExtent> index;  // entries of the level above
+    const fileExtent *levelEntries = this->extents.data();
+    size_t levelCount = this->extents.size();
+    size_t dirty = this->dirtyFrom;
+    size_t used = 0;
+    int ret = 0;
+    for (size_t level = 0; level < counts.size(); level++) {
+        std::vector<uint32_t> &levelNodes = this->nodes[level];
+        size_t existing = levelNodes.size();
+        while (levelNodes.size() < counts[level]) {
+            levelNodes.push_back((uint32_t) newBlocks[used++]);
+        }
+        size_t firstDirty = dirty < levelCount ? std::min(dirty / this->nodeEntries, existing) : existing;
+
+        std::vector<fileExtent> upper(counts[level]);
+        for (size_t node = 0; node < counts[level]; node++) {
+            size_t start = node * this->nodeEntries;
+            size_t count = std::min((size_t) this->nodeEntries, levelCount - start);
+            upper[node] = {levelEntries[start].logical, levelNodes[node], 0};
+            if (node >= firstDirty && ret == 0) {
+                ret = writeNode(levelNodes[node], (uint16_t) level, levelEntries + start, count);
+            }
+        }
+
+        index.swap(upper);
+        levelEntries = index.data();
+        levelCount = index.size();
+        dirty = firstDirty;
+    }
+    delete[] newBlocks;
+
+    // the top level becomes the root
+    this->file->extentRoot.magic = EXTENT_NODE_MAGIC;
+    this->file->extentRoot.depth = (uint16_t) counts.size();
+    this->file->extentRoot.count = (uint32_t) levelCount;
+    memset(this->file->extents, 0, sizeof(this->file->extents));
+    if (levelCount > 0) {
+        memcpy(this->file->extents, levelEntries, levelCount * sizeof(fileExtent));
+    }
+
+    this->dirtyFrom = this->extents.size();
+    return ret;
+}
+
+// write a tree node into its data block
+int ExtentTree::writeNode(uint32_t block, uint16_t depth, const fileExtent *entries, size_t count) {
+    char *buffer = new char[this->blockSize];
+    memset(buffer, 0, this->blockSize);
+
+    extentHeader header = {EXTENT_NODE_MAGIC, depth, (uint32_t) count};
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), entries, count * sizeof(fileExtent));
+
+    int ret = this->device->write(this->dataOffset + block, buffer);
+    delete[] buffer;
+    return ret == 0 ? 0 : -EIO;
+}
+
+// mark a run of data blocks as free
+void ExtentTree::freeBlocks(uint32_t physical, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        this->dMap->setBlockState((int) (physical + i), false);
+    }
+}
+
+// return the number of blocks of the file
+uint32_t ExtentTree::getBlockCount() {
+    return this->blockCount;
+}
+
+// the count is kept up to date in the metadata of the file by every change of the extents
+uint32_t ExtentTree::getMappedBlockCount() {
+    return this->file->mappedBlocks - 1;
+}
+
+// every existing level gains at most one node per nodeEntries new entries of the level below, rounded up. The root
+// may overflow into new levels on top, these take all entries of the level below them, the root is assumed to be full.
+uint32_t ExtentTree::getNodeReserve(uint32_t count) {
+    uint32_t total = 0;
+    uint32_t added = count;  // new entries of the level
+    for (size_t level = 0; level < this->nodes.size() && added > 0; level++) {
+        added = (added + this->nodeEntries - 1) / this->nodeEntries;
+        total += added;
+    }
+    uint32_t entries = added > 0 ? EXTENT_ROOT_ENTRIES + added : 0;
+    while (entries > EXTENT_ROOT_ENTRIES) {
+        entries = (entries + this->nodeEntries - 1) / this->nodeEntries;
+        total += entries;
+    }
+    return total;
+}
+
+// continue the last extent
+int ExtentTree::getGoal() {
+    if (this->extents.empty()) {
+        return -1;
+    }
+    return (int) (this->extents.back().physical + this->extents.back().length);
+}
+
+// return the number of extents of the file
+size_t ExtentTree::getExtentCount() {
+    return this->extents.size();
+}
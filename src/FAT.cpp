@@ -4,45 +4,45 @@
 
 #include <FAT.h>
 
+#include <algorithm>
+
 // Constructor for the FAT
-FAT::FAT(BlockDevice *device) {
+FAT::FAT(BlockCache *device, SuperBlock *superBlock) {
     this->device = device;
-    for (int i = 0; i < DATA_BLOCKS; i++) {
+    this->blockSize = superBlock->getBlockSize();
+    this->dataBlocks = superBlock->getDataBlocks();
+    this->offset = superBlock->getFATOffset();
+    this->size = superBlock->getFATSize();
+
+    // the last FAT block may hold entries behind the last data block, they stay FAT_EOF
+    size_t entries = (size_t) this->size * this->blockSize / sizeof(int32_t);
+    this->fatArray = new int32_t[entries];
+    for (size_t i = 0; i < entries; i++) {
         fatArray[i] = FAT_EOF;
     }
+    this->isDirty.assign(this->size, false);
 }
 
 // Destructor for the FAT
 FAT::~FAT() {
-
-}
-
-void FAT::insertModifiedBlock(int index) {
-
-    // 1. verify that index is not present already
-    bool indexIsPresent = false;
-    for (int i = 0; i < modifiedBlocksCounter; i++) {
-        if (modifiedBlocks[i] == index) {
-            indexIsPresent = true;
-        }
-    }
-
-    // then track the change
-    if (!indexIsPresent) {
-        modifiedBlocks[modifiedBlocksCounter] = index;
-        modifiedBlocksCounter++;
+    if (!isMapped) {
+        delete[] fatArray;
     }
 }
 
-void FAT::clearModifiedBlocks() {
-    for (int i = 0; i < modifiedBlocksCounter; i++) {
-        modifiedBlocks[i] = 0;
+// remember that the FAT block holding the entry of the given data block has to be written
+void FAT::markDirty(int index) {
+    uint32_t block = (uint32_t) ((size_t) index * sizeof(int32_t) / blockSize);
+    isDirty[block] = true;
+    if (dirtyFirst == dirtyEnd) {
+        dirtyFirst = block;
+        dirtyEnd = block + 1;
+    } else {
+        dirtyFirst = std::min(dirtyFirst, block);
+        dirtyEnd = std::max(dirtyEnd, block + 1);
     }
-    modifiedBlocksCounter = 0;
 }
 
-
-
 // map the next block for the current file
 int FAT::setNextBlock(int currentBlock, int nextBlock) {
 
@@ -51,8 +51,8 @@ int FAT::setNextBlock(int currentBlock, int nextBlock) {
     }
 
     this->fatArray[currentBlock] = nextBlock;
-    insertModifiedBlock(currentBlock);
-    insertModifiedBlock(nextBlock);
+    markDirty(currentBlock);
+    markDirty(nextBlock);
     return 0;
 }
 
@@ -64,72 +64,73 @@ int FAT::getNextBlock(int currentBlock) {
 // clean the content of a block by its index
 void FAT::freeBlock(int index) {
     this->fatArray[index] = FAT_EOF;
-    insertModifiedBlock(index);
+    markDirty(index);
 }
 
 // write the changes to the disk
+// every dirty FAT block is written once straight from fatArray. The blocks are handed to the cache in ascending
+// order as a single batch, so adjacent blocks become one request.
+// The writes are only queued, the caller has to wait for them with BlockCache::waitForCompletion()
 void FAT::persist() {
-    char buffer[BLOCK_SIZE];
-
-    // go over each modified block
-    // start at the second entry since the first entry always point to the second modified...
-    // ...value and does not point anywhere if only one blockdevice is used
-    for (int j = 1; j < modifiedBlocksCounter; j++) {
-
-        // check which position we are at inside the blockdevices allocated for the FAT
-        int blockdevice_offset = (modifiedBlocks[j-1]) / (BLOCK_SIZE / 4);
-
-        // read the current targeted blockdata
-        device->read(FAT_OFFSET + blockdevice_offset, buffer);
-
-        int current_block_index = modifiedBlocks[j];
-
-
-        // track iterations from 0 to 512 inside the current blockdevice
-        int this_iteration = 0;
-
-
-        // write the updated FAT, keep track over the blockdevice offset
-        for (int k = 0 + ((BLOCK_SIZE / 4) * blockdevice_offset);
-        k < BLOCK_SIZE + (BLOCK_SIZE * current_block_index); k++) {
-
-            // if the iteration matches the modified block
-            if (k == modifiedBlocks[j-1]) {
-                // write each byte to the buffer, start from the left
-                for (int l = 3; l >= 0; l--) {
-                    // write the next block pointer
-                    int this_byte = (current_block_index >> (8*l)) & 0xff;
-                    int buffer_offset = (this_iteration*4) + l;
-                    buffer[buffer_offset] = this_byte;
-
-                }
-                break;
-            }
-
-            this_iteration++;
+    uint32_t entriesPerBlock = this->blockSize / sizeof(int32_t);
+    std::vector<uint32_t> blockNos;
+    std::vector<char *> buffers;
+
+    for (uint32_t i = dirtyFirst; i < dirtyEnd; i++) {
+        if (isDirty[i]) {
+            isDirty[i] = false;
+            blockNos.push_back(this->offset + i);
+            buffers.push_back((char *) (fatArray + (size_t) i * entriesPerBlock));
         }
-        device->write(FAT_OFFSET + blockdevice_offset, buffer);
     }
+    dirtyFirst = 0;
+    dirtyEnd = 0;
 
-    clearModifiedBlocks();
+    if (!blockNos.empty()) {
+        device->submitWriteBlocks(blockNos.data(), (uint32_t) blockNos.size(), buffers.data());
+    }
 }
 
 // initialise the (existing) FAT
 void FAT::initFAT() {
-    char buffer[BLOCK_SIZE];
-    for (int i = 0; i < FAT_SIZE; i++) {
-            int i_offset = i + FAT_OFFSET;
+    // a mapped FAT can be used as it is
+    if (useMappedRegion()) {
+        return;
+    }
+
+    char *buffer = new char[this->blockSize];
+    for (uint32_t i = 0; i < this->size; i++) {
+            uint32_t i_offset = i + this->offset;
             device->read(i_offset, buffer);
-            memcpy(fatArray+(i * BLOCK_SIZE / 4), buffer, BLOCK_SIZE);
+            memcpy(fatArray + ((size_t) i * this->blockSize / 4), buffer, this->blockSize);
     }
+    delete[] buffer;
 }
 
 // initialise a FAT for an empty filesystem
+// all FAT blocks are written as a single batch
 void FAT::initialInitFAT() {
-    char buffer[BLOCK_SIZE];
-    for (int i = 0; i < FAT_SIZE; i++) {
-        memcpy(buffer, fatArray, BLOCK_SIZE);
-        device->write(FAT_OFFSET + i, buffer);
+    isDirty.assign(this->size, true);
+    dirtyFirst = 0;
+    dirtyEnd = this->size;
+    persist();
+    device->waitForCompletion();
+    useMappedRegion();
+}
+
+// work directly on the FAT region if the container file is mapped, the on-disk format is the in-memory format.
+// Persisting then only marks the modified FAT blocks as dirty.
+// return true if fatArray points into the mapping
+bool FAT::useMappedRegion() {
+    char *region = device->getBlockPointer(this->offset);
+    if (region == nullptr) {
+        return false;
+    }
+    if (!isMapped) {
+        delete[] fatArray;
     }
+    fatArray = (int32_t *) region;
+    isMapped = true;
+    return true;
 }
 
@@ -0,0 +1,147 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "IOStats.h"
+
+#include <ctime>
+
+// IOStats constructor
+IOStats::IOStats() {
+    reset();
+}
+
+// replace the regions, the counters are kept
+void IOStats::setRegions(const char **names, const uint32_t *firstBlocks, int count) {
+    if (count > IOS_MAX_REGIONS) {
+        count = IOS_MAX_REGIONS;
+    }
+    for (int i = 0; i < count; i++) {
+        this->regionNames[i] = names[i];
+        this->regionStarts[i] = firstBlocks[i];
+    }
+    this->regionCount = count;
+}
+
+// count a request in every region it touches
+void IOStats::recordTransfer(IOStatsOp op, uint32_t firstBlockNo, uint32_t blockCount, uint32_t blockSize,
+                             uint64_t latency) {
+    uint32_t endBlockNo = firstBlockNo + blockCount;
+    for (int region = findRegion(firstBlockNo); region < this->regionCount; region++) {
+        uint32_t start = this->regionStarts[region];
+        if (start >= endBlockNo && region > 0) {
+            break;
+        }
+        uint32_t end = region + 1 < this->regionCount ? this->regionStarts[region + 1] : UINT32_MAX;
+        uint32_t first = firstBlockNo > start ? firstBlockNo : start;
+        uint32_t last = endBlockNo < end ? endBlockNo : end;
+        if (first >= last) {
+            continue;
+        }
+
+        this->requests[op][region].fetch_add(1, std::memory_order_relaxed);
+        this->bytes[op][region].fetch_add((uint64_t) (last - first) * blockSize, std::memory_order_relaxed);
+    }
+    recordLatency(op, latency);
+}
+
+// sort a latency into its log2 bucket
+void IOStats::recordLatency(IOStatsOp op, uint64_t latency) {
+    uint64_t micros = latency / 1000;
+    int bucket = 0;
+    if (micros > 0) {
+        bucket = 64 - __builtin_clzll(micros);
+        if (bucket >= IOS_LATENCY_BUCKETS) {
+            bucket = IOS_LATENCY_BUCKETS - 1;
+        }
+    }
+    this->latencies[op][bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// reset all counters
+void IOStats::reset() {
+    for (int op = 0; op < 2; op++) {
+        for (int region = 0; region < IOS_MAX_REGIONS; region++) {
+            this->requests[op][region].store(0, std::memory_order_relaxed);
+            this->bytes[op][region].store(0, std::memory_order_relaxed);
+        }
+    }
+    for (int op = 0; op < IOS_OPS; op++) {
+        for (int bucket = 0; bucket < IOS_LATENCY_BUCKETS; bucket++) {
+            this->latencies[op][bucket].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// return the number of regions
+int IOStats::getRegionCount() {
+    return this->regionCount;
+}
+
+// return the name of a region
+const char *IOStats::getRegionName(int region) {
+    return this->regionNames[region];
+}
+
+// return the number of read or write requests that touched a region
+uint64_t IOStats::getRequests(IOStatsOp op, int region) {
+    return this->requests[op][region].load(std::memory_order_relaxed);
+}
+
+// return the number of bytes read from or written to a region
+uint64_t IOStats::getBytes(IOStatsOp op, int region) {
+    return this->bytes[op][region].load(std::memory_order_relaxed);
+}
+
+// return the number of requests in a latency bucket
+uint64_t IOStats::getLatencyCount(IOStatsOp op, int bucket) {
+    return this->latencies[op][bucket].load(std::memory_order_relaxed);
+}
+
+// print one line per region and one line per non-empty latency bucket
+void IOStats::dump(FILE *file) {
+    fprintf(file, "%-10s %12s %14s %12s %14s\n", "region", "reads", "read bytes", "writes", "written bytes");
+    for (int region = 0; region < this->regionCount; region++) {
+        fprintf(file, "%-10s %12llu %14llu %12llu %14llu\n", this->regionNames[region],
+                (unsigned long long) getRequests(IOS_READ, region), (unsigned long long) getBytes(IOS_READ, region),
+                (unsigned long long) getRequests(IOS_WRITE, region), (unsigned long long) getBytes(IOS_WRITE, region));
+    }
+
+    fprintf(file, "%-18s %12s %12s %12s\n", "latency [us]", "reads", "writes", "syncs");
+    for (int bucket = 0; bucket < IOS_LATENCY_BUCKETS; bucket++) {
+        uint64_t reads = getLatencyCount(IOS_READ, bucket);
+        uint64_t writes = getLatencyCount(IOS_WRITE, bucket);
+        uint64_t syncs = getLatencyCount(IOS_SYNC, bucket);
+        if (reads == 0 && writes == 0 && syncs == 0) {
+            continue;
+        }
+
+        char range[32];
+        if (bucket == 0) {
+            snprintf(range, sizeof(range), "< 1");
+        } else if (bucket == 1) {
+            snprintf(range, sizeof(range), "1");
+        } else if (bucket == IOS_LATENCY_BUCKETS - 1) {
+            snprintf(range, sizeof(range), ">= %llu", 1ULL << (bucket - 1));
+        } else {
+            snprintf(range, sizeof(range), "%llu - %llu", 1ULL << (bucket - 1), (1ULL << bucket) - 1);
+        }
+        fprintf(file, "%-18s %12llu %12llu %12llu\n", range, (unsigned long long) reads,
+                (unsigned long long) writes, (unsigned long long) syncs);
+    }
+}
+
+// read the monotonic clock
+uint64_t IOStats::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int IOStats::findRegion(uint32_t blockNo) {
+    int region = 0;
+    while (region + 1 < this->regionCount && this->regionStarts[region + 1] <= blockNo) {
+        region++;
+    }
+    return region;
+}
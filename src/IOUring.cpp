@@ -0,0 +1,215 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "IOUring.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// IOUring constructor
+IOUring::IOUring() {
+
+}
+
+// IOUring destructor
+IOUring::~IOUring() {
+    exit();
+}
+
+#ifdef HAVE_IO_URING
+
+// set up the rings shared with the kernel, return 0 on success or -errno
+int IOUring::init(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return -errno;
+    }
+    this->ringFd = fd;
+    this->entries = params.sq_entries;
+
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // newer kernels map both rings with a single mmap
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        if (this->cqRingSize > this->sqRingSize) {
+            this->sqRingSize = this->cqRingSize;
+        }
+        this->cqRingSize = this->sqRingSize;
+    }
+
+    this->sqRing = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    if (this->sqRing == MAP_FAILED) {
+        this->sqRing = nullptr;
+        int ret = -errno;
+        exit();
+        return ret;
+    }
+
+    if (singleMap) {
+        this->cqRing = this->sqRing;
+    } else {
+        this->cqRing = mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            fd, IORING_OFF_CQ_RING);
+        if (this->cqRing == MAP_FAILED) {
+            this->cqRing = nullptr;
+            int ret = -errno;
+            exit();
+            return ret;
+        }
+    }
+
+    this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqesMap = mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQES);
+    if (sqesMap == MAP_FAILED) {
+        int ret = -errno;
+        exit();
+        return ret;
+    }
+    this->sqes = (struct io_uring_sqe *) sqesMap;
+
+    char *sq = (char *) this->sqRing;
+    this->sqHead = (unsigned *) (sq + params.sq_off.head);
+    this->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    this->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    this->sqArray = (unsigned *) (sq + params.sq_off.array);
+
+    char *cq = (char *) this->cqRing;
+    this->cqHead = (unsigned *) (cq + params.cq_off.head);
+    this->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    this->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    this->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+// unmap the rings and close the ring file descriptor
+void IOUring::exit() {
+    if (this->sqes != nullptr) {
+        munmap(this->sqes, this->sqesSize);
+        this->sqes = nullptr;
+    }
+    if (this->cqRing != nullptr && this->cqRing != this->sqRing) {
+        munmap(this->cqRing, this->cqRingSize);
+    }
+    this->cqRing = nullptr;
+    if (this->sqRing != nullptr) {
+        munmap(this->sqRing, this->sqRingSize);
+        this->sqRing = nullptr;
+    }
+    if (this->ringFd >= 0) {
+        close(this->ringFd);
+        this->ringFd = -1;
+    }
+    this->entries = 0;
+    this->toSubmit = 0;
+}
+
+// queue a readv/writev request, it is handed to the kernel with the next submit().
+// The iovecs must stay valid until the completion has been popped.
+// return 0 on success or -EBUSY if the submission queue is full
+int IOUring::prepare(bool isWrite, int fd, const struct iovec *iov, int iovCount, off_t pos, uint64_t userData) {
+    unsigned tail = *this->sqTail;
+    unsigned head = __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE);
+    if (tail - head >= this->entries) {
+        return -EBUSY;
+    }
+
+    unsigned index = tail & *this->sqMask;
+    struct io_uring_sqe *sqe = &this->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) iov;
+    sqe->len = (uint32_t) iovCount;
+    sqe->off = (uint64_t) pos;
+    sqe->user_data = userData;
+
+    this->sqArray[index] = index;
+    __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+    this->toSubmit++;
+
+    return 0;
+}
+
+// hand all prepared requests to the kernel and block until at least waitCount completions are available
+// return 0 on success or -errno
+int IOUring::submit(unsigned waitCount) {
+    unsigned flags = waitCount > 0 ? IORING_ENTER_GETEVENTS : 0;
+    do {
+        // completions that are already in the queue count towards waitCount, so retrying is safe
+        int ret = (int) syscall(__NR_io_uring_enter, this->ringFd, this->toSubmit, waitCount, flags, nullptr, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        this->toSubmit -= ret;
+    } while (this->toSubmit > 0);
+    return 0;
+}
+
+// fetch the next completion, return false if there is none
+bool IOUring::popCompletion(uint64_t *userData, int *result) {
+    unsigned head = *this->cqHead;
+    unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return false;
+    }
+
+    struct io_uring_cqe *cqe = &this->cqes[head & *this->cqMask];
+    *userData = cqe->user_data;
+    *result = cqe->res;
+
+    __atomic_store_n(this->cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else
+
+// io_uring is not available at build time, callers have to use synchronous I/O
+int IOUring::init(unsigned entries) {
+    return -ENOSYS;
+}
+
+void IOUring::exit() {
+
+}
+
+int IOUring::prepare(bool isWrite, int fd, const struct iovec *iov, int iovCount, off_t pos, uint64_t userData) {
+    return -ENOSYS;
+}
+
+int IOUring::submit(unsigned waitCount) {
+    return -ENOSYS;
+}
+
+bool IOUring::popCompletion(uint64_t *userData, int *result) {
+    return false;
+}
+
+#endif
+
+// return true if the ring has been set up successfully
+bool IOUring::isAvailable() {
+    return this->ringFd >= 0;
+}
+
+// return the number of requests that can be queued at once
+unsigned IOUring::getEntries() {
+    return this->entries;
+}
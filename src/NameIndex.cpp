@@ -0,0 +1,113 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "NameIndex.h"
+
+#include <cstring>
+
+#define SLOT_EMPTY -1
+#define SLOT_DELETED -2
+#define MIN_SLOTS 16
+
+// NameIndex constructor, the table is sized for the given number of names
+NameIndex::NameIndex(uint32_t capacity) {
+    uint32_t size = MIN_SLOTS;
+    while (size < 2 * capacity) {
+        size *= 2;
+    }
+    this->slots.assign(size, {0, 0, nullptr, SLOT_EMPTY});
+    this->mask = size - 1;
+}
+
+// FNV-1a hash of a name, its length is counted on the way
+uint32_t NameIndex::hashName(const char *name, uint32_t *length) {
+    uint32_t hash = 2166136261u;
+    const char *c = name;
+    while (*c != '\0') {
+        hash = (hash ^ (uint8_t) *c) * 16777619u;
+        c++;
+    }
+    *length = (uint32_t) (c - name);
+    return hash;
+}
+
+// return the directory entry of a name, -1 if there is none
+int NameIndex::find(const char *name) {
+    uint32_t length;
+    uint32_t hash = hashName(name, &length);
+    for (uint32_t i = hash & this->mask;; i = (i + 1) & this->mask) {
+        const nameSlot &slot = this->slots[i];
+        if (slot.value == SLOT_EMPTY) {
+            return -1;
+        }
+        if (slot.value != SLOT_DELETED && slot.hash == hash && slot.length == length &&
+            memcmp(slot.name, name, length) == 0) {
+            return slot.value;
+        }
+    }
+}
+
+// add a name, the table grows once three quarters of its slots are taken
+void NameIndex::insert(const char *name, int value) {
+    if ((this->used + this->deleted + 1) * 4 > this->slots.size() * 3) {
+        rebuild();
+    }
+
+    uint32_t length;
+    uint32_t hash = hashName(name, &length);
+    uint32_t i = hash & this->mask;
+    while (this->slots[i].value >= 0) {
+        i = (i + 1) & this->mask;
+    }
+    if (this->slots[i].value == SLOT_DELETED) {
+        this->deleted--;
+    }
+    this->slots[i] = {hash, length, name, value};
+    this->used++;
+}
+
+// remove the name of a directory entry, its slot stays marked so that the names behind it are still found
+void NameIndex::remove(const char *name, int value) {
+    uint32_t length;
+    uint32_t hash = hashName(name, &length);
+    for (uint32_t i = hash & this->mask; this->slots[i].value != SLOT_EMPTY; i = (i + 1) & this->mask) {
+        if (this->slots[i].value == value) {
+            this->slots[i].value = SLOT_DELETED;
+            this->slots[i].name = nullptr;
+            this->used--;
+            this->deleted++;
+            return;
+        }
+    }
+}
+
+// remove all names
+void NameIndex::clear() {
+    this->slots.assign(this->slots.size(), {0, 0, nullptr, SLOT_EMPTY});
+    this->used = 0;
+    this->deleted = 0;
+}
+
+// insert the names again into a table with twice as many slots as names, this drops the removed names
+void NameIndex::rebuild() {
+    uint32_t size = MIN_SLOTS;
+    while (size < 2 * (this->used + 1)) {
+        size *= 2;
+    }
+    size = size < this->slots.size() ? (uint32_t) this->slots.size() : size;
+
+    std::vector<nameSlot> old(size, {0, 0, nullptr, SLOT_EMPTY});
+    old.swap(this->slots);
+    this->mask = size - 1;
+    this->deleted = 0;
+    for (const nameSlot &slot : old) {
+        if (slot.value >= 0) {
+            uint32_t i = slot.hash & this->mask;
+            while (this->slots[i].value != SLOT_EMPTY) {
+                i = (i + 1) & this->mask;
+            }
+            this->slots[i] = slot;
+        }
+    }
+}
@@ -4,121 +4,652 @@
 
 #include "RootDir.h"
 
+#include <cerrno>
+
 // RootDir constructor
-RootDir::RootDir(BlockDevice *device) {
+RootDir::RootDir(BlockCache *device, SuperBlock *superBlock, DMap *dMap) {
     this->device = device;
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        files[i] = nullptr;
-    }
+    this->superBlock = superBlock;
+    this->dMap = dMap;
+    this->tree = new DirTree(device, dMap, superBlock);
+    this->blockSize = superBlock->getBlockSize();
+    this->inodesPerBlock = superBlock->getInodesPerBlock();
+    this->inodeSize = superBlock->hasInodeTable() ? INODE_SIZE : this->blockSize;
+    this->offset = superBlock->getRootDirOffset();
+    this->rootDirSize = superBlock->getRootDirSize();
+    this->dataOffset = superBlock->getDataOffset();
+    this->dentries = new DentryCache(DENTRY_CACHE_ENTRIES);
 }
 
 // RootDir destructor
 RootDir::~RootDir() {
+    for (auto &entry : files) {
+        delete entry.second;
+    }
+    delete dentries;
+    delete tree;
+}
+
+// take an inode for a new file, a data block becomes a new inode block if no known inode is free
+int RootDir::allocateInode() {
+    if (freeInodes.empty()) {
+        int block = dMap->getNextFreeBlock();
+        if (block < 0) {
+            return -ENOSPC;
+        }
+        uint32_t inodeBlock = this->dataOffset + block;
+        if (this->inodesPerBlock > 1) {
+            // the other inodes of the block have to be found free when it is read again
+            char *buff = new char[this->blockSize];
+            memset(buff, 0, this->blockSize);
+            this->device->write(inodeBlock, buff);
+            delete[] buff;
+        }
+        inodeBlocks[inodeBlock] = 0;
+        for (uint32_t i = 0; i < this->inodesPerBlock; i++) {
+            freeInodes.insert(inodeBlock * this->inodesPerBlock + i);
+        }
+    }
 
+    uint32_t inode = *freeInodes.begin();
+    freeInodes.erase(freeInodes.begin());
+    inodeBlocks[inode / this->inodesPerBlock]++;
+    return (int) inode;
 }
 
-// create a file from given path
-rootFile* RootDir::createFile(const char *path) {
-    path++;  // remove path slash
+// give back an inode, it is cleared on the next flush so that it is found free. An inode block among the data blocks
+// is freed with its last inode.
+void RootDir::freeInode(uint32_t inode) {
+    uint32_t block = inode / this->inodesPerBlock;
+    uint32_t &used = inodeBlocks[block];
+    used = used > 0 ? used - 1 : 0;
+    if (used == 0 && block >= this->dataOffset) {
+        for (uint32_t i = 0; i < this->inodesPerBlock; i++) {
+            freeInodes.erase(block * this->inodesPerBlock + i);
+            dirty.erase(block * this->inodesPerBlock + i);
+        }
+        inodeBlocks.erase(block);
+        dMap->setBlockState((int) (block - this->dataOffset), false);
+        return;
+    }
+    freeInodes.insert(inode);
+    dirty.insert(inode);
+}
 
-    int index = 0;
-    while (files[index] != nullptr) {
-        index++;
+// read a block holding inodes, its free inodes become known the first time it is read
+// return 0 on success, -EIO on failure
+int RootDir::readInodeBlock(uint32_t block, char *buffer) {
+    memset(buffer, 0, this->blockSize);
+    if (this->device->read(block, buffer) != 0) {
+        return -EIO;
+    }
+    if (inodeBlocks.count(block) == 0) {
+        uint32_t used = 0;
+        for (uint32_t i = 0; i < this->inodesPerBlock; i++) {
+            if (isUsed(buffer + i * this->inodeSize)) {
+                used++;
+            } else {
+                freeInodes.insert(block * this->inodesPerBlock + i);
+            }
+        }
+        inodeBlocks[block] = used;
     }
+    return 0;
+}
 
-    // create new file with default values
-    rootFile *file = new rootFile();
+// return true if the inode holds a file
+bool RootDir::isUsed(const char *record) {
+    if (this->inodesPerBlock == 1) {
+        return !FShelper::checkBlockContent((char *) record);
+    }
+    inodeData inode;
+    memcpy(&inode, record, sizeof(inode));
+    return inode.mode != 0;
+}
 
-    strcpy(file->name, path);
-    file->stat.st_mode = S_IFREG | 0644;
-    file->stat.st_blksize = BLOCK_SIZE;
-    file->stat.st_size = 0;
-    file->stat.st_blocks = 0;
-    file->stat.st_nlink = 1;
-    file->stat.st_atime = time(nullptr);
-    file->stat.st_mtime = time(nullptr);
-    file->stat.st_ctime = time(nullptr);
-    file->stat.st_uid = getuid();
-    file->stat.st_gid = getgid();
-    file->firstBlock = -1;
-
-    file->rootDirBlock = index;
-    files[index] = file;
-    existingFilesCounter++;
+// store the metadata of a file in its on-disk form, the name is only kept without inode table
+void RootDir::encode(rootFile *file, char *record) {
+    memset(record, 0, this->inodeSize);
+    if (this->inodesPerBlock == 1) {
+        // the block count keeps its place in the stored stat
+        rootFile stored = *file;
+        stored.stat.st_blocks = file->blockCount;
+        std::memcpy(record, &stored, sizeof(rootFile));
+        return;
+    }
 
+    inodeData inode = {};
+    inode.size = file->stat.st_size;
+    inode.atime = file->stat.st_atime;
+    inode.mtime = file->stat.st_mtime;
+    inode.ctime = file->stat.st_ctime;
+    inode.mode = file->stat.st_mode;
+    inode.nlink = (uint32_t) file->stat.st_nlink;
+    inode.uid = file->stat.st_uid;
+    inode.gid = file->stat.st_gid;
+    inode.blocks = file->blockCount;
+    inode.firstBlock = file->firstBlock;
+    inode.tailBlock = this->superBlock->hasExtents() ? file->mappedBlocks : file->tailBlock;
+    inode.unwrittenBlock = file->unwrittenBlock;
+    inode.parentBlock = file->parentBlock;
+    inode.dirRoot = file->dirRoot;
+    inode.extentRoot = file->extentRoot;
+    std::memcpy(inode.extents, file->extents, sizeof(inode.extents));
+    std::memcpy(record, &inode, sizeof(inode));
+}
+
+// create the metadata of a file from its on-disk form, a packed inode has no name until the file is found by path
+rootFile* RootDir::decode(const char *record, uint32_t inode) {
+    rootFile *file = new rootFile();
+    if (this->inodesPerBlock == 1) {
+        std::memcpy(file, record, sizeof(rootFile));
+        file->name[NAME_LENGTH - 1] = '\0';
+        file->blockCount = (uint32_t) file->stat.st_blocks;
+    } else {
+        inodeData data;
+        std::memcpy(&data, record, sizeof(data));
+        file->name[0] = '\0';
+        file->stat.st_mode = data.mode;
+        file->stat.st_nlink = data.nlink;
+        file->stat.st_uid = data.uid;
+        file->stat.st_gid = data.gid;
+        file->stat.st_size = data.size;
+        file->blockCount = data.blocks;
+        file->stat.st_blksize = this->blockSize;
+        file->stat.st_atime = data.atime;
+        file->stat.st_mtime = data.mtime;
+        file->stat.st_ctime = data.ctime;
+        file->firstBlock = data.firstBlock;
+        if (this->superBlock->hasExtents()) {
+            file->mappedBlocks = data.tailBlock;
+        } else {
+            file->tailBlock = data.tailBlock;
+        }
+        file->unwrittenBlock = data.unwrittenBlock;
+        file->parentBlock = data.parentBlock;
+        file->dirRoot = data.dirRoot;
+        file->extentRoot = data.extentRoot;
+        std::memcpy(file->extents, data.extents, sizeof(file->extents));
+    }
+    file->rootDirBlock = (int) inode;
     return file;
 }
 
-// delete a file from given rootFile
-void RootDir::deleteFile(rootFile *file) {
-    int index = 0;
-    while (files[index] != file) {
-        index++;
+// add a file to the cache and return it
+rootFile* RootDir::cache(rootFile *file) {
+    files[file->rootDirBlock] = file;
+    lastFile = file;
+    if (files.size() > FILE_CACHE_ENTRIES) {
+        evict();
+    }
+    return file;
+}
+
+// drop the files that are not pinned until the cache is half full, the file returned last and changed files stay
+void RootDir::evict() {
+    for (auto entry = files.begin(); entry != files.end() && files.size() > FILE_CACHE_ENTRIES / 2;) {
+        rootFile *file = entry->second;
+        if (file == lastFile || pins.count(entry->first) > 0 || dirty.count(entry->first) > 0) {
+            entry++;
+            continue;
+        }
+        delete file;
+        entry = files.erase(entry);
+    }
+}
+
+// point the tree at the given directory
+// return 0 on success, -ENOTDIR if the block does not hold a directory, -EIO if its metadata cannot be read
+int RootDir::openDir(uint32_t dir) {
+    if (dir == ROOT_DIR_BLOCK) {
+        tree->open(superBlock->getDirRoot());
+        return 0;
+    }
+    rootFile *file = getFileByBlock(dir);
+    if (file == nullptr) {
+        return -EIO;
+    }
+    if (!S_ISDIR(file->stat.st_mode)) {
+        return -ENOTDIR;
+    }
+    tree->open(file->dirRoot);
+    return 0;
+}
+
+// find the inode of a name in a directory, the tree of the directory is only searched if the dentry cache
+// does not know the name
+int RootDir::lookup(uint32_t dir, const char *name, size_t length) {
+    int block;
+    if (dentries->find(dir, name, length, &block)) {
+        return block == DENTRY_NEGATIVE ? -ENOENT : block;
+    }
+
+    int ret = openDir(dir);
+    if (ret < 0) {
+        return ret;
+    }
+    std::string key(name, length);
+    block = tree->find(key.c_str());
+    if (block >= 0 || block == -ENOENT) {
+        dentries->insert(dir, key, block >= 0 ? block : DENTRY_NEGATIVE);
+    }
+    return block;
+}
+
+// resolve the directories of a path, return the directory holding the last component and its name. The name is
+// empty for the root directory.
+// return 0 on success, -ENOENT if a directory does not exist, -ENOTDIR if a component is not a directory,
+// -ENAMETOOLONG if a name does not fit into the metadata
+int RootDir::walk(const char *path, uint32_t *parent, std::string *name) {
+    uint32_t dir = ROOT_DIR_BLOCK;
+    const char *component = path;
+    while (true) {
+        while (*component == '/') {
+            component++;
+        }
+        const char *end = strchr(component, '/');
+        size_t length = end == nullptr ? strlen(component) : end - component;
+        if (length >= NAME_LENGTH) {
+            return -ENAMETOOLONG;
+        }
+        if (end == nullptr) {
+            *parent = dir;
+            name->assign(component, length);
+            return 0;
+        }
+
+        int block = lookup(dir, component, length);
+        if (block < 0) {
+            return block;
+        }
+        dir = (uint32_t) block;
+        component = end;
+    }
+}
+
+// change the link count of a directory by the subdirectories added or removed, the root directory has no metadata
+void RootDir::addLink(uint32_t dir, int count) {
+    rootFile *file = dir == ROOT_DIR_BLOCK ? nullptr : getFileByBlock(dir);
+    if (file != nullptr) {
+        file->stat.st_nlink += count;
+        file->stat.st_ctime = time(nullptr);
+        markDirty(file);
+    }
+}
+
+// create a file or a directory from given path
+// return 0 on success, -EEXIST if the name is taken, -ENOSPC if there is no block left for the metadata, -ENOENT or
+// -ENOTDIR if the directory does not exist. The caller persists the file, which writes the parent along.
+int RootDir::createFile(const char *path, mode_t mode, rootFile **file) {
+    uint32_t parent;
+    std::string name;
+    int ret = walk(path, &parent, &name);
+    if (ret == 0 && name.empty()) {
+        ret = -EEXIST;  // the root directory
+    }
+    if (ret == 0) {
+        ret = openDir(parent);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    int block = allocateInode();
+    if (block < 0) {
+        return block;  // no free entry left
+    }
+
+    // a directory gets a tree of its own, the tree of the parent is opened again for the new name
+    uint32_t dirRoot = 0;
+    bool hasTree = false;
+    if (S_ISDIR(mode)) {
+        DirTree dirTree(this->device, this->dMap, this->superBlock);
+        ret = dirTree.create();
+        hasTree = ret == 0;
+        dirRoot = dirTree.getRoot();
+    }
+    if (ret == 0) {
+        ret = tree->insert(name.c_str(), (uint32_t) block);
+    }
+    if (ret < 0) {
+        if (hasTree) {
+            dMap->setBlockState((int) dirRoot, false);
+        }
+        freeInode((uint32_t) block);
+        flush();
+        return ret;
+    }
+
+    // create new file with default values
+    rootFile *newFile = new rootFile();
+
+    strcpy(newFile->name, name.c_str());
+    newFile->stat.st_mode = mode;
+    newFile->stat.st_blksize = this->blockSize;
+    newFile->stat.st_size = 0;
+    newFile->blockCount = 0;
+    newFile->mappedBlocks = 1;
+    newFile->stat.st_nlink = S_ISDIR(mode) ? 2 : 1;
+    newFile->stat.st_atime = time(nullptr);
+    newFile->stat.st_mtime = time(nullptr);
+    newFile->stat.st_ctime = time(nullptr);
+    newFile->stat.st_uid = getuid();
+    newFile->stat.st_gid = getgid();
+    newFile->firstBlock = -1;
+    newFile->rootDirBlock = block;
+    newFile->parentBlock = parent;
+    newFile->dirRoot = dirRoot;
+
+    if (S_ISDIR(mode)) {
+        addLink(parent, 1);
+    }
+    dentries->insert(parent, name, block);
+    *file = cache(newFile);
+    markDirty(newFile);
+    return 0;
+}
+
+// delete a file or an empty directory from given rootFile, its inode is freed. A file that is pinned only loses its name,
+// its metadata stays valid and the inode is freed when it is unpinned for the last time.
+// return 0 on success, -ENOTEMPTY if the directory still holds files, -EIO on failure
+int RootDir::deleteFile(rootFile *file) {
+    uint32_t block = (uint32_t) file->rootDirBlock;
+    uint32_t parent = file->parentBlock;
+    bool isDir = S_ISDIR(file->stat.st_mode);
+
+    // the metadata of the file must stay in memory while the parent is loaded
+    pinFile(file);
+    int ret = 0;
+    if (isDir) {
+        uint64_t key;
+        std::string name;
+        ret = getNextEntry(block, 0, &key, &name);
+        ret = ret == 0 ? -ENOTEMPTY : (ret == -ENOENT ? 0 : ret);
+    }
+    if (ret == 0) {
+        ret = openDir(parent);
+    }
+    if (ret == 0) {
+        ret = tree->remove(file->name);
+    }
+    if (ret < 0) {
+        unpinFile(file);
+        return ret;
+    }
+
+    if (isDir) {
+        dMap->setBlockState((int) file->dirRoot, false);
+        dentries->removeChildren(block);
+        addLink(parent, -1);
+    }
+    dentries->insert(parent, file->name, DENTRY_NEGATIVE);
+    if (unpinFile(file) > 0) {
+        file->stat.st_nlink = 0;
+        orphans.insert(block);
+        markDirty(file);
+    } else {
+        dropFile(file);
+    }
+    return flush();
+}
+
+// remove a deleted file from the cache and free its inode, which is cleared on the next flush
+void RootDir::dropFile(rootFile *file) {
+    uint32_t block = (uint32_t) file->rootDirBlock;
+    files.erase(block);
+    if (lastFile == file) {
+        lastFile = nullptr;
     }
     delete file;
-    // set to nullptr in files array
-    files[index] = nullptr;
-    existingFilesCounter--;
+    freeInode(block);
+}
+
+// move a file to a new path, the entry with the new name is added before the old one is removed
+// return 0 on success, -EEXIST if the new name is taken, -EINVAL if a directory would be moved below itself. The caller
+// persists the file, which writes the changed directories along.
+int RootDir::renameFile(rootFile *file, const char *path) {
+    uint32_t block = (uint32_t) file->rootDirBlock;
+    uint32_t oldParent = file->parentBlock;
+    bool isDir = S_ISDIR(file->stat.st_mode);
+
+    pinFile(file);
+    uint32_t parent;
+    std::string name;
+    int ret = walk(path, &parent, &name);
+    if (ret == 0 && name.empty()) {
+        ret = -EINVAL;
+    }
+
+    // a directory must not become its own subdirectory
+    for (uint32_t dir = parent; ret == 0 && isDir && dir != ROOT_DIR_BLOCK;) {
+        rootFile *above = getFileByBlock(dir);
+        if (above == nullptr) {
+            ret = -EIO;
+        } else if (dir == block) {
+            ret = -EINVAL;
+        } else {
+            dir = above->parentBlock;
+        }
+    }
+
+    if (ret == 0) {
+        ret = openDir(parent);
+    }
+    if (ret == 0) {
+        ret = tree->insert(name.c_str(), block);
+    }
+    if (ret == 0) {
+        ret = openDir(oldParent);
+    }
+    if (ret == 0) {
+        ret = tree->remove(file->name);
+    }
+    unpinFile(file);
+    if (ret < 0) {
+        return ret;
+    }
+
+    dentries->insert(oldParent, file->name, DENTRY_NEGATIVE);
+    dentries->insert(parent, name, (int) block);
+    if (isDir && parent != oldParent) {
+        addLink(oldParent, -1);
+        addLink(parent, 1);
+    }
+    strcpy(file->name, name.c_str());
+    file->parentBlock = parent;
+    markDirty(file);
+    return 0;
+}
+
+// find the file at given path, the metadata of a file that is not in the cache is found through the trees
+// return 0 on success, -ENOENT if the file does not exist, -ENOTDIR if a component of the path is not a directory
+int RootDir::findFile(const char *path, rootFile **file) {
+    uint32_t parent;
+    std::string name;
+    int ret = walk(path, &parent, &name);
+    if (ret < 0) {
+        return ret;
+    }
+    if (name.empty()) {
+        return -ENOENT;  // the root directory has no metadata
+    }
+
+    int block = lookup(parent, name.c_str(), name.size());
+    if (block < 0) {
+        return block;
+    }
+    auto cached = files.find((uint32_t) block);
+    *file = cached != files.end() ? cached->second : load((uint32_t) block);
+    if (*file == nullptr) {
+        return -EIO;
+    }
+    strcpy((*file)->name, name.c_str());  // packed inodes are loaded without name
+    lastFile = *file;
+    return 0;
 }
 
 // get a file at given path
 rootFile* RootDir::getFile(const char *path) {
-    path++;  // shove dir slash
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (files[i] != nullptr && strcmp(path, files[i]->name) == 0) {
-            return files[i];
-        }
+    rootFile *file = nullptr;
+    return findFile(path, &file) == 0 ? file : nullptr;  // nullptr if not found
+}
+
+// get the file with the given inode, it has no name if its inode is packed and it has not been found by path yet
+rootFile* RootDir::getFileByBlock(uint32_t inode) {
+    auto file = files.find(inode);
+    return file != files.end() ? file->second : load(inode);
+}
+
+// return the name of the entry of a directory with the lowest key from the given one on, see DirTree::next()
+int RootDir::getNextEntry(uint32_t dir, uint64_t from, uint64_t *key, std::string *name) {
+    int ret = openDir(dir);
+    if (ret < 0) {
+        return ret;
     }
-    return nullptr;  // return if not found
+    uint32_t block;
+    return tree->next(from, key, &block, name);
+}
+
+// keep the metadata of a file in memory until it is unpinned as often
+void RootDir::pinFile(rootFile *file) {
+    pins[file->rootDirBlock]++;
 }
 
+// return the number of pins left. The last pin of a deleted file frees it, the metadata must not be used afterwards.
+uint32_t RootDir::unpinFile(rootFile *file) {
+    auto pin = pins.find(file->rootDirBlock);
+    if (pin == pins.end()) {
+        return 0;
+    }
+    if (--pin->second > 0) {
+        return pin->second;
+    }
+
+    pins.erase(pin);
+    if (orphans.erase((uint32_t) file->rootDirBlock) > 0) {
+        dropFile(file);
+        flush();
+    }
+    return 0;
+}
 
-// get the array of all existing files
-rootFile** RootDir::getFiles() {
-    return files;
+uint32_t RootDir::getPinCount(rootFile *file) {
+    auto pin = pins.find(file->rootDirBlock);
+    return pin == pins.end() ? 0 : pin->second;
 }
 
-// load the file at given RootDir index
-rootFile* RootDir::load(int index) {
-    char buff[BLOCK_SIZE];
-    memset(buff, 0, BLOCK_SIZE);
-    this->device->read(ROOT_DIR_OFFSET + index, buff);
+// load the file from given inode into the cache
+// the size of a file may include data that was lost before it got data blocks, it is cut to the allocated blocks
+rootFile* RootDir::load(uint32_t inode) {
+    uint32_t block = inode / this->inodesPerBlock;
+    bool isRegion = block >= this->offset && block < this->offset + this->rootDirSize;
+    if (!isRegion && (block < this->dataOffset || block >= this->superBlock->getTotalBlocks())) {
+        return nullptr;  // damaged directory entry
+    }
 
-    if (!FShelper::checkBlockContent(buff)) {
-        rootFile *file = new rootFile();
-        std::memcpy(file, buff, sizeof(rootFile));
-        this->files[index] = file;
-        return file;
-    } else {
-        return nullptr;
+    char *buff = new char[this->blockSize];
+    rootFile *file = nullptr;
+    const char *record = buff + (inode % this->inodesPerBlock) * this->inodeSize;
+    if (readInodeBlock(block, buff) == 0 && isUsed(record)) {
+        file = decode(record, inode);
+        if (file->stat.st_size > (off_t) file->blockCount * this->blockSize) {
+            file->stat.st_size = (off_t) file->blockCount * this->blockSize;
+        }
+        cache(file);
     }
+    delete[] buff;
+    return file;
+}
+
+// remember that the metadata of a file has to be written on the next flush
+void RootDir::markDirty(rootFile *file) {
+    dirty.insert((uint32_t) file->rootDirBlock);
+}
+
+// write the changed inodes, the ones sharing a block with one access. A freed inode is cleared.
+// return 0 on success, -EIO on failure
+int RootDir::flush() {
+    char *buff = new char[this->blockSize];
+    int ret = 0;
+    for (auto inode = dirty.begin(); inode != dirty.end();) {
+        uint32_t block = *inode / this->inodesPerBlock;
+
+        // the other inodes of the block are kept as they are on disk
+        memset(buff, 0, this->blockSize);
+        bool isRead = this->inodesPerBlock == 1 || this->device->read(block, buff) == 0;
+        for (; inode != dirty.end() && *inode / this->inodesPerBlock == block; inode++) {
+            char *record = buff + (*inode % this->inodesPerBlock) * this->inodeSize;
+            auto file = files.find(*inode);
+            if (file == files.end()) {
+                memset(record, 0, this->inodeSize);
+            } else {
+                encode(file->second, record);
+            }
+        }
+        if (!isRead || this->device->write(block, buff) != 0) {
+            ret = -EIO;
+        }
+    }
+    dirty.clear();
+    delete[] buff;
+    return ret;
 }
 
 // write the changes to disk
 bool RootDir::persist(rootFile *file) {
-    char buff[BLOCK_SIZE];
-    memset(buff, 0, BLOCK_SIZE);
-    std::memcpy(buff, file, sizeof(rootFile));
-    this->device->write(ROOT_DIR_OFFSET + file->rootDirBlock, buff);
-    return true;
+    markDirty(file);
+    return flush() == 0;
 }
 
-// load the files after opening an existing file container
-void RootDir::initRootDir() {
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        rootFile *file = load(i);
-        files[i] = file;
-        if (file != nullptr) {
-            existingFilesCounter++;
+// find the free inodes of the RootDir region after opening an existing file container
+// a container without directory tree gets one holding the files of the region, the caller has to persist the DMap
+// and the superblock
+int RootDir::initRootDir() {
+    bool isUpgrade = !superBlock->hasDirTree();
+    int ret = 0;
+    if (isUpgrade) {
+        ret = tree->create();
+    } else {
+        tree->open(superBlock->getDirRoot());
+    }
+
+    // containers without directory tree have no inode table, a block of the region holds one file
+    char *buff = new char[this->blockSize];
+    rootFile *file = new rootFile();
+    for (uint32_t i = 0; i < this->rootDirSize && ret == 0; i++) {
+        ret = readInodeBlock(this->offset + i, buff);
+        if (ret == 0 && isUpgrade && isUsed(buff)) {
+            std::memcpy(file, buff, sizeof(rootFile));
+            file->name[NAME_LENGTH - 1] = '\0';
+            ret = tree->insert(file->name, this->offset + i);
+            ret = ret == -EEXIST ? 0 : ret;
         }
     }
+    delete file;
+    delete[] buff;
+
+    if (ret == 0 && isUpgrade) {
+        superBlock->setDirRoot(tree->getRoot());
+    }
+    return ret;
 }
 
-// initialise the RootDir content for an empty filesystem
-void RootDir::initialInitRootDir() {
-    char buffer[BLOCK_SIZE];
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        memset(buffer, 0, BLOCK_SIZE);
-        device->write(ROOT_DIR_OFFSET + i, buffer);
+// initialise the RootDir content for an empty filesystem, the caller has to persist the DMap and the superblock
+int RootDir::initialInitRootDir() {
+    char *buffer = new char[this->blockSize];
+    memset(buffer, 0, this->blockSize);
+    for (uint32_t i = 0; i < this->rootDirSize; i++) {
+        device->write(this->offset + i, buffer);
+        inodeBlocks[this->offset + i] = 0;
+        for (uint32_t j = 0; j < this->inodesPerBlock; j++) {
+            freeInodes.insert((this->offset + i) * this->inodesPerBlock + j);
+        }
+    }
+    delete[] buffer;
+
+    int ret = tree->create();
+    if (ret == 0) {
+        superBlock->setDirRoot(tree->getRoot());
     }
+    return ret;
 }
@@ -0,0 +1,248 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "SuperBlock.h"
+
+#include <cerrno>
+
+#define SB_KNOWN_FEATURES (SB_FEATURE_EXTENTS | SB_FEATURE_DIR_TREE | SB_FEATURE_INODE_TABLE)
+
+// a RootDir entry takes one block of the smallest supported size
+static_assert(sizeof(rootFile) <= SB_MIN_BLOCK_SIZE, "rootFile does not fit into a block");
+static_assert(sizeof(superBlockData) <= SB_MIN_BLOCK_SIZE, "superblock does not fit into a block");
+static_assert(sizeof(inodeData) == INODE_SIZE, "inodeData does not match INODE_SIZE");
+
+// number of blocks needed for the given amount of bytes
+static uint64_t blocksFor(uint64_t bytes, uint32_t blockSize) {
+    return (bytes + blockSize - 1) / blockSize;
+}
+
+// number of blocks of the RootDir region, which holds one block per file or the inodes of the inode table
+static uint64_t rootDirBlocks(uint32_t dirEntries, uint32_t blockSize, uint32_t features) {
+    return (features & SB_FEATURE_INODE_TABLE) ? blocksFor((uint64_t) dirEntries * INODE_SIZE, blockSize) : dirEntries;
+}
+
+// the inode numbers of all blocks of the container have to fit into an int, like the block numbers
+static bool hasInodeNumbers(uint64_t totalBlocks, uint32_t blockSize, uint32_t features) {
+    return !(features & SB_FEATURE_INODE_TABLE) || totalBlocks * (blockSize / INODE_SIZE) <= SB_MAX_BLOCKS;
+}
+
+// size of the DMap in bytes, one bit per data block rounded up to whole 64 bit words
+static uint64_t bitmapBytes(uint32_t dataBlocks) {
+    return ((uint64_t) dataBlocks + 63) / 64 * sizeof(uint64_t);
+}
+
+// compute the layout of a new container, the regions follow the superblock without gaps
+int SuperBlock::format(uint32_t blockSize, uint32_t dataBlocks, uint32_t dirEntries, uint32_t features) {
+    if (blockSize < SB_MIN_BLOCK_SIZE || blockSize > SB_MAX_BLOCK_SIZE || (blockSize & (blockSize - 1)) != 0 ||
+        dataBlocks == 0 || dirEntries == 0 || (features & ~SB_KNOWN_FEATURES) != 0 ||
+        ((features & SB_FEATURE_INODE_TABLE) && !(features & SB_FEATURE_DIR_TREE))) {
+        return -EINVAL;
+    }
+
+    uint64_t fatBytes = (features & SB_FEATURE_EXTENTS) ? 0 : (uint64_t) dataBlocks * sizeof(int32_t);
+    uint64_t totalBlocks = SUPERBLOCK_BLOCK + 1 + blocksFor(bitmapBytes(dataBlocks), blockSize) +
+                           blocksFor(fatBytes, blockSize) + rootDirBlocks(dirEntries, blockSize, features) + dataBlocks;
+    if (totalBlocks > SB_MAX_BLOCKS || !hasInodeNumbers(totalBlocks, blockSize, features)) {
+        return -EINVAL;
+    }
+
+    this->data.magic = SUPERBLOCK_MAGIC;
+    this->data.version = SUPERBLOCK_VERSION;
+    this->data.blockSize = blockSize;
+    this->data.dataBlocks = dataBlocks;
+    this->data.dirEntries = dirEntries;
+    this->data.features = features;
+    this->data.dirRoot = 0;
+    layout(SUPERBLOCK_BLOCK + 1, bitmapBytes(dataBlocks));
+    this->isLegacy = false;
+    return 0;
+}
+
+// place the regions behind each other starting with the DMap, the FAT stores one int32_t per data block and is left
+// empty if the files are mapped by extents
+void SuperBlock::layout(uint32_t dmapOffset, uint64_t dmapBytes) {
+    uint32_t blockSize = this->data.blockSize;
+    this->data.dmapOffset = dmapOffset;
+    this->data.dmapSize = (uint32_t) blocksFor(dmapBytes, blockSize);
+    this->data.fatOffset = this->data.dmapOffset + this->data.dmapSize;
+    this->data.fatSize = hasExtents() ? 0 : (uint32_t) blocksFor((uint64_t) this->data.dataBlocks * sizeof(int32_t),
+                                                                 blockSize);
+    this->data.rootDirOffset = this->data.fatOffset + this->data.fatSize;
+    this->data.rootDirSize = (uint32_t) rootDirBlocks(this->data.dirEntries, blockSize, this->data.features);
+    this->data.dataOffset = this->data.rootDirOffset + this->data.rootDirSize;
+    this->data.totalBlocks = this->data.dataOffset + this->data.dataBlocks;
+}
+
+// read the superblock, a container without one gets the layout it was created with
+int SuperBlock::load(const char *path) {
+    BlockDevice device(BD_BLOCK_SIZE);
+    int ret = device.open(path);
+    if (ret < 0) {
+        return ret;
+    }
+
+    char buffer[BD_BLOCK_SIZE];
+    ret = device.read(SUPERBLOCK_BLOCK, buffer);
+    device.close();
+    if (ret < 0) {
+        return ret;
+    }
+
+    superBlockData loaded;
+    memcpy(&loaded, buffer, sizeof(loaded));
+    if (loaded.magic != SUPERBLOCK_MAGIC) {
+        // the byte DMap used to start at block 0, directly followed by the other regions
+        this->data.magic = SUPERBLOCK_MAGIC;
+        this->data.version = 1;
+        this->data.blockSize = BLOCK_SIZE;
+        this->data.dataBlocks = DATA_BLOCKS;
+        this->data.dirEntries = NUM_DIR_ENTRIES;
+        this->data.features = 0;
+        layout(0, DATA_BLOCKS);
+        this->isLegacy = true;
+        return 0;
+    }
+
+    if (loaded.version == 0 || loaded.version > SUPERBLOCK_VERSION) {
+        return -EINVAL;
+    }
+    this->data = loaded;
+    if (loaded.version < 3) {
+        this->data.features = 0;
+    }
+    if (!hasDirTree()) {
+        this->data.dirRoot = 0;
+    }
+    this->isLegacy = false;
+    return isValid() ? 0 : -EINVAL;
+}
+
+// write the superblock into a block of its own
+int SuperBlock::persist(BlockCache *device) {
+    char *buffer = new char[this->data.blockSize];
+    memset(buffer, 0, this->data.blockSize);
+    memcpy(buffer, &this->data, sizeof(this->data));
+    int ret = device->write(SUPERBLOCK_BLOCK, buffer);
+    delete[] buffer;
+    return ret;
+}
+
+// check that the regions of a loaded superblock are large enough and do not overlap
+bool SuperBlock::isValid() {
+    superBlockData &sb = this->data;
+    if (sb.blockSize < SB_MIN_BLOCK_SIZE || sb.blockSize > SB_MAX_BLOCK_SIZE ||
+        (sb.blockSize & (sb.blockSize - 1)) != 0 || sb.dataBlocks == 0 || sb.dirEntries == 0 ||
+        (sb.features & ~SB_KNOWN_FEATURES) != 0 || (hasDirTree() && sb.dirRoot >= sb.dataBlocks) ||
+        (hasInodeTable() && !hasDirTree())) {
+        return false;
+    }
+
+    uint64_t dmapBytes = hasByteDMap() ? sb.dataBlocks : bitmapBytes(sb.dataBlocks);
+    uint64_t fatBytes = hasExtents() ? 0 : (uint64_t) sb.dataBlocks * sizeof(int32_t);
+    return sb.dmapOffset > SUPERBLOCK_BLOCK &&
+           sb.dmapSize >= blocksFor(dmapBytes, sb.blockSize) &&
+           sb.fatOffset >= (uint64_t) sb.dmapOffset + sb.dmapSize &&
+           sb.fatSize >= blocksFor(fatBytes, sb.blockSize) &&
+           sb.rootDirOffset >= (uint64_t) sb.fatOffset + sb.fatSize &&
+           sb.rootDirSize >= rootDirBlocks(sb.dirEntries, sb.blockSize, sb.features) &&
+           sb.dataOffset >= (uint64_t) sb.rootDirOffset + sb.rootDirSize &&
+           sb.totalBlocks == (uint64_t) sb.dataOffset + sb.dataBlocks &&
+           sb.totalBlocks <= SB_MAX_BLOCKS &&
+           hasInodeNumbers(sb.totalBlocks, sb.blockSize, sb.features);
+}
+
+// return true if the container has no superblock
+bool SuperBlock::isLegacyLayout() {
+    return this->isLegacy;
+}
+
+// return true if the DMap has not been converted to a bitmap yet
+bool SuperBlock::hasByteDMap() {
+    return this->data.version < 2;
+}
+
+// return true if the files are mapped by extent trees
+bool SuperBlock::hasExtents() {
+    return (this->data.features & SB_FEATURE_EXTENTS) != 0;
+}
+
+// return true if the files are found through a directory tree
+bool SuperBlock::hasDirTree() {
+    return (this->data.features & SB_FEATURE_DIR_TREE) != 0;
+}
+
+// return true if the files are described by packed inodes
+bool SuperBlock::hasInodeTable() {
+    return (this->data.features & SB_FEATURE_INODE_TABLE) != 0;
+}
+
+// return the number of inodes in a block, a container without inode table stores the metadata of a file in a block
+uint32_t SuperBlock::getInodesPerBlock() {
+    return hasInodeTable() ? this->data.blockSize / INODE_SIZE : 1;
+}
+
+// set the root of the directory tree, which makes the feature flag part of the superblock
+void SuperBlock::setDirRoot(uint32_t root) {
+    this->data.features |= SB_FEATURE_DIR_TREE;
+    this->data.dirRoot = root;
+}
+
+// shrink the DMap region to the bitmap, a legacy container gets its superblock in the first DMap block
+void SuperBlock::upgrade() {
+    if (this->isLegacy) {
+        this->data.dmapOffset = SUPERBLOCK_BLOCK + 1;
+    }
+    this->data.dmapSize = (uint32_t) blocksFor(bitmapBytes(this->data.dataBlocks), this->data.blockSize);
+    this->data.version = SUPERBLOCK_VERSION;
+    this->isLegacy = false;
+}
+
+uint32_t SuperBlock::getBlockSize() {
+    return this->data.blockSize;
+}
+
+uint32_t SuperBlock::getDataBlocks() {
+    return this->data.dataBlocks;
+}
+
+uint32_t SuperBlock::getDirEntries() {
+    return this->data.dirEntries;
+}
+
+uint32_t SuperBlock::getDMapOffset() {
+    return this->data.dmapOffset;
+}
+
+uint32_t SuperBlock::getDMapSize() {
+    return this->data.dmapSize;
+}
+
+uint32_t SuperBlock::getFATOffset() {
+    return this->data.fatOffset;
+}
+
+uint32_t SuperBlock::getFATSize() {
+    return this->data.fatSize;
+}
+
+uint32_t SuperBlock::getRootDirOffset() {
+    return this->data.rootDirOffset;
+}
+
+uint32_t SuperBlock::getRootDirSize() {
+    return this->data.rootDirSize;
+}
+
+uint32_t SuperBlock::getDataOffset() {
+    return this->data.dataOffset;
+}
+
+uint32_t SuperBlock::getTotalBlocks() {
+    return this->data.totalBlocks;
+}
+
+uint32_t SuperBlock::getDirRoot() {
+    return this->data.dirRoot;
+}
@@ -10,9 +10,12 @@
 
 #include <cstdlib>
 #include <cassert>
+#include <cstring>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "macros.h"
@@ -46,6 +49,9 @@ int BlockDevice::create(const char *path) {
     }
     
 //    this->size= 0;
+
+    if (ret == 0)
+        setUpRing();
     
     return ret;
 }
@@ -64,6 +70,8 @@ int BlockDevice::open(const char *path) {
 
         ret= -errno;
 
+    } else {
+        setUpRing();
     }
 
     return ret;
@@ -74,26 +82,37 @@ int BlockDevice::close() {
 
     int ret= 0;
 
+    // queued requests still reference the container file
+    completeAll();
+    this->ring.exit();
+    this->inFlight.clear();
+
+    if (this->mapping != nullptr) {
+        ret= sync();
+        munmap(this->mapping, this->mappingSize);
+        this->mapping = nullptr;
+        this->mappingSize = 0;
+    }
+
     if(::close(this->contFile) < 0)
         ret= -errno;
     
     return ret;
 }
 
+// use io_uring for batches if the kernel supports it, synchronous preadv()/pwritev() otherwise
+void BlockDevice::setUpRing() {
+    if (this->ring.init(BD_RING_ENTRIES) == 0) {
+        this->inFlight.assign(this->ring.getEntries(), nullptr);
+    }
+}
+
 // this method returns 0 if successful, -errno otherwise
 int BlockDevice::read(uint32_t blockNo, char *buffer) {
 #ifdef DEBUG
     fprintf(stderr, "BlockDevice: Reading block %d\n", blockNo);
 #endif
-    off_t pos = (blockNo) * this->blockSize;
-    if (lseek (this->contFile, pos, SEEK_SET) != pos)
-        return -errno;
-    
-    int size = (this->blockSize);
-    if (::read (this->contFile, buffer, size) != size)
-        return -errno;
-
-    return 0;
+    return readBlocks(blockNo, 1, buffer);
 }
 
 // this method returns 0 if successful, -errno otherwise
@@ -101,14 +120,562 @@ int BlockDevice::write(uint32_t blockNo, char *buffer) {
 #ifdef DEBUG
     fprintf(stderr, "BlockDevice: Writing block %d\n", blockNo);
 #endif
-    off_t pos = (blockNo) * this->blockSize;
-    if (lseek (this->contFile, pos, SEEK_SET) != pos)
+    return writeBlocks(blockNo, 1, buffer);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readBlocks(const uint32_t *blockNos, uint32_t count, char **buffers) {
+    std::vector<BlockRun *> runs;
+    splitRuns(false, blockNos, count, buffers, runs);
+    return runBatch(runs, true);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    std::vector<BlockRun *> runs(1, makeRun(false, firstBlockNo, count, buffer));
+    return runBatch(runs, true);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writeBlocks(const uint32_t *blockNos, uint32_t count, char **buffers) {
+    std::vector<BlockRun *> runs;
+    splitRuns(true, blockNos, count, buffers, runs);
+    return runBatch(runs, true);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    std::vector<BlockRun *> runs(1, makeRun(true, firstBlockNo, count, buffer));
+    return runBatch(runs, true);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::submitReadBlocks(const uint32_t *blockNos, uint32_t count, char **buffers) {
+    std::vector<BlockRun *> runs;
+    splitRuns(false, blockNos, count, buffers, runs);
+    return runBatch(runs, false);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::submitReadBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    std::vector<BlockRun *> runs(1, makeRun(false, firstBlockNo, count, buffer));
+    return runBatch(runs, false);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::submitWriteBlocks(const uint32_t *blockNos, uint32_t count, char **buffers) {
+    std::vector<BlockRun *> runs;
+    splitRuns(true, blockNos, count, buffers, runs);
+    return runBatch(runs, false);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::submitWriteBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    std::vector<BlockRun *> runs(1, makeRun(true, firstBlockNo, count, buffer));
+    return runBatch(runs, false);
+}
+
+// this method returns 0 if all queued requests succeeded, the first -errno otherwise
+int BlockDevice::waitForCompletion() {
+    completeAll();
+    int ret = this->pendingError;
+    this->pendingError = 0;
+    return ret;
+}
+
+// split the block list into runs of adjacent block numbers, each run is transferred with one request.
+// Buffers that directly follow each other in memory share one iovec.
+void BlockDevice::splitRuns(bool isWrite, const uint32_t *blockNos, uint32_t count, char **buffers,
+                            std::vector<BlockRun *> &runs) {
+    uint32_t i = 0;
+    while (i < count) {
+        BlockRun *run = new BlockRun();
+        run->isWrite = isWrite;
+        run->pos = (off_t) blockNos[i] * this->blockSize;
+
+        do {
+            if (!run->iov.empty() && (char *) run->iov.back().iov_base + run->iov.back().iov_len == buffers[i]) {
+                run->iov.back().iov_len += this->blockSize;
+            } else if (run->iov.size() < IOV_MAX) {
+                struct iovec iov = { buffers[i], this->blockSize };
+                run->iov.push_back(iov);
+            } else {
+                break;  // out of iovecs, continue the run with the next request
+            }
+            i++;
+        } while (i < count && blockNos[i] == blockNos[i - 1] + 1);
+
+        runs.push_back(run);
+    }
+}
+
+// create a single run for a contiguous range of blocks stored in one buffer
+BlockDevice::BlockRun *BlockDevice::makeRun(bool isWrite, uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    BlockRun *run = new BlockRun();
+    run->isWrite = isWrite;
+    run->pos = (off_t) firstBlockNo * this->blockSize;
+    struct iovec iov = { buffer, (size_t) count * this->blockSize };
+    run->iov.push_back(iov);
+    return run;
+}
+
+// O_DIRECT requires aligned memory, replace runs with unaligned buffers by runs on aligned bounce buffers.
+// Bounced runs are limited to the size of one bounce buffer.
+void BlockDevice::bounceRuns(std::vector<BlockRun *> &runs) {
+    if (!this->directIO || this->mapping != nullptr)
+        return;
+
+    std::vector<BlockRun *> result;
+    for (size_t r = 0; r < runs.size(); r++) {
+        BlockRun *run = runs[r];
+        if (isAligned(run)) {
+            result.push_back(run);
+            continue;
+        }
+
+        size_t total = 0;
+        for (size_t i = 0; i < run->iov.size(); i++)
+            total += run->iov[i].iov_len;
+
+        off_t pos = run->pos;
+        size_t index = 0;  // current user iovec
+        size_t inner = 0;  // bytes of the current user iovec that have been assigned already
+        while (total > 0) {
+            char *bounce = this->bouncePool.get();
+            if (bounce == nullptr)
+                break;  // the rest cannot be transferred, its buffers are not aligned
+
+            BlockRun *piece = new BlockRun();
+            piece->isWrite = run->isWrite;
+            piece->pos = pos;
+            piece->bounce = bounce;
+
+            size_t pieceSize = total < this->bouncePool.getBufferSize() ? total : this->bouncePool.getBufferSize();
+            size_t needed = pieceSize;
+            char *data = bounce;
+            while (needed > 0) {
+                struct iovec part;
+                part.iov_base = (char *) run->iov[index].iov_base + inner;
+                part.iov_len = run->iov[index].iov_len - inner;
+                if (part.iov_len > needed)
+                    part.iov_len = needed;
+
+                if (piece->isWrite)
+                    memcpy(data, part.iov_base, part.iov_len);
+                piece->userIov.push_back(part);
+
+                data += part.iov_len;
+                needed -= part.iov_len;
+                inner += part.iov_len;
+                if (inner == run->iov[index].iov_len) {
+                    index++;
+                    inner = 0;
+                }
+            }
+
+            struct iovec iov = { bounce, pieceSize };
+            piece->iov.push_back(iov);
+            result.push_back(piece);
+
+            pos += pieceSize;
+            total -= pieceSize;
+        }
+
+        if (total > 0) {
+            // out of memory, the remaining part fails instead of going to the disk from the unaligned buffers
+            BlockRun *rest = new BlockRun();
+            rest->isWrite = run->isWrite;
+            rest->pos = pos;
+            rest->error = -ENOMEM;
+            if (inner > 0) {
+                struct iovec part = { (char *) run->iov[index].iov_base + inner, run->iov[index].iov_len - inner };
+                rest->iov.push_back(part);
+                index++;
+            }
+            rest->iov.insert(rest->iov.end(), run->iov.begin() + index, run->iov.end());
+            result.push_back(rest);
+        }
+
+        delete run;
+    }
+    runs.swap(result);
+}
+
+// return true if all buffers of the run can be used for O_DIRECT
+bool BlockDevice::isAligned(BlockRun *run) {
+    for (size_t i = 0; i < run->iov.size(); i++) {
+        if ((uintptr_t) run->iov[i].iov_base % this->blockSize != 0 || run->iov[i].iov_len % this->blockSize != 0)
+            return false;
+    }
+    return true;
+}
+
+// hand all runs to the kernel at once. If wait is set, this behaves like a synchronous call: requests queued
+// before are completed first, the method blocks until the runs are done and only their errors are reported.
+int BlockDevice::runBatch(std::vector<BlockRun *> &runs, bool wait) {
+    bounceRuns(runs);
+
+    // one clock read for the whole batch, the runs are submitted together
+    uint64_t startTime = IOStats::now();
+    for (size_t i = 0; i < runs.size(); i++) {
+        for (size_t j = 0; j < runs[i]->iov.size(); j++) {
+            runs[i]->size += runs[i]->iov[j].iov_len;
+        }
+        runs[i]->startTime = startTime;
+    }
+
+    int savedError = 0;
+    if (wait) {
+        completeAll();
+        savedError = this->pendingError;
+        this->pendingError = 0;
+    }
+
+    for (size_t i = 0; i < runs.size(); i++) {
+        // a single synchronous run is cheaper as a plain preadv()/pwritev()
+        if (wait && runs.size() == 1) {
+            finishRun(runs[i], 0);
+        } else {
+            queueRun(runs[i]);
+        }
+    }
+
+    if (!wait) {
+        // start the requests, completions are collected by waitForCompletion()
+        if (this->inFlightCount > 0 && this->ring.submit(0) < 0 && this->pendingError == 0) {
+            this->pendingError = -EIO;
+        }
+        return 0;
+    }
+
+    completeAll();
+    int ret = this->pendingError;
+    this->pendingError = savedError;
+    return ret;
+}
+
+// queue a run on the ring, or transfer it right away if io_uring is not available or the container is mapped
+void BlockDevice::queueRun(BlockRun *run) {
+    if (!this->ring.isAvailable() || this->mapping != nullptr || run->error < 0) {
+        finishRun(run, 0);
+        return;
+    }
+
+    // make room if all slots are taken
+    while (this->inFlightCount == this->inFlight.size()) {
+        if (reapCompletions() < 0) {
+            finishRun(run, 0);
+            return;
+        }
+    }
+
+    uint32_t slot = 0;
+    while (this->inFlight[slot] != nullptr) {
+        slot++;
+    }
+
+    if (this->ring.prepare(run->isWrite, this->contFile, run->iov.data(), (int) run->iov.size(), run->pos, slot) < 0) {
+        finishRun(run, 0);
+        return;
+    }
+
+    this->inFlight[slot] = run;
+    this->inFlightCount++;
+}
+
+// complete a run after result bytes have been transferred by the ring. Anything that is left over (short transfer,
+// end of the container file, retryable errors) is transferred synchronously.
+void BlockDevice::finishRun(BlockRun *run, int result) {
+    int ret = 0;
+
+    if (run->error < 0) {
+        result = run->error;
+    }
+
+    if (result < 0 && result != -EAGAIN && result != -EINTR) {
+        ret = result;
+    } else {
+        size_t done = result > 0 ? (size_t) result : 0;
+        size_t first = 0;
+        while (first < run->iov.size() && done >= run->iov[first].iov_len) {
+            done -= run->iov[first].iov_len;
+            first++;
+        }
+        if (first < run->iov.size()) {
+            run->iov[first].iov_base = (char *) run->iov[first].iov_base + done;
+            run->iov[first].iov_len -= done;
+            off_t pos = run->pos + (result > 0 ? result : 0);
+            ret = transfer(run->isWrite, pos, &run->iov[first], (int) (run->iov.size() - first));
+        }
+    }
+
+    if (run->bounce != nullptr) {
+        // hand the data of a bounced read to the caller
+        if (!run->isWrite && ret == 0) {
+            char *data = run->bounce;
+            for (size_t i = 0; i < run->userIov.size(); i++) {
+                memcpy(run->userIov[i].iov_base, data, run->userIov[i].iov_len);
+                data += run->userIov[i].iov_len;
+            }
+        }
+        this->bouncePool.put(run->bounce);
+    }
+
+    if (ret < 0 && this->pendingError == 0) {
+        this->pendingError = ret;
+    }
+    if (ret == 0) {
+        this->stats.recordTransfer(run->isWrite ? IOS_WRITE : IOS_READ, (uint32_t) (run->pos / this->blockSize),
+                                   (uint32_t) ((run->size + this->blockSize - 1) / this->blockSize), this->blockSize,
+                                   IOStats::now() - run->startTime);
+    }
+    delete run;
+}
+
+// submit everything that has been prepared, wait for at least one completion and process all available ones
+// return 0 on success, -errno if the ring failed
+int BlockDevice::reapCompletions() {
+    int ret = this->ring.submit(1);
+    if (ret < 0) {
+        if (this->pendingError == 0) {
+            this->pendingError = ret;
+        }
+        return ret;
+    }
+
+    uint64_t slot;
+    int result;
+    while (this->ring.popCompletion(&slot, &result)) {
+        BlockRun *run = this->inFlight[slot];
+        this->inFlight[slot] = nullptr;
+        this->inFlightCount--;
+        finishRun(run, result);
+    }
+    return 0;
+}
+
+// serve a transfer from the mapped container file
+int BlockDevice::copyMapped(bool isWrite, off_t pos, struct iovec *iov, int iovCount) {
+    off_t start = pos;
+    for (int i = 0; i < iovCount; i++) {
+        if ((size_t) pos + iov[i].iov_len > this->mappingSize)
+            return -EINVAL;
+
+        char *mapped = this->mapping + pos;
+        // callers may hand in pointers that came from getBlockPointer()
+        if (mapped != iov[i].iov_base) {
+            if (isWrite)
+                memcpy(mapped, iov[i].iov_base, iov[i].iov_len);
+            else
+                memcpy(iov[i].iov_base, mapped, iov[i].iov_len);
+        }
+        pos += iov[i].iov_len;
+    }
+
+    if (isWrite && pos > start)
+        markDirty(start / this->blockSize, (pos - start + this->blockSize - 1) / this->blockSize);
+
+    return 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::map(uint32_t blockCount) {
+    completeAll();
+
+    size_t size = (size_t) blockCount * this->blockSize;
+
+    // everything inside the mapping must be backed by the file
+    struct stat st;
+    if (fstat(this->contFile, &st) < 0)
+        return -errno;
+    if ((size_t) st.st_size < size && ftruncate(this->contFile, size) < 0)
         return -errno;
 
-    int __size = (this->blockSize);
-    if (::write (this->contFile, buffer, __size) != __size)
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->contFile, 0);
+    if (addr == MAP_FAILED)
         return -errno;
 
+    this->mapping = (char *) addr;
+    this->mappingSize = size;
+    this->dirtyFirst = 0;
+    this->dirtyEnd = 0;
+
     return 0;
 }
 
+// return true if the container file is mapped
+bool BlockDevice::isMapped() {
+    return this->mapping != nullptr;
+}
+
+// return the address of a block inside the mapping, nullptr if not mapped
+char *BlockDevice::getBlockPointer(uint32_t blockNo) {
+    if (this->mapping == nullptr || (size_t) (blockNo + 1) * this->blockSize > this->mappingSize)
+        return nullptr;
+    return this->mapping + (size_t) blockNo * this->blockSize;
+}
+
+// extend the dirty range by the given blocks
+void BlockDevice::markDirty(uint32_t firstBlockNo, uint32_t count) {
+    if (this->dirtyEnd == this->dirtyFirst) {
+        this->dirtyFirst = firstBlockNo;
+        this->dirtyEnd = firstBlockNo + count;
+        return;
+    }
+    if (firstBlockNo < this->dirtyFirst)
+        this->dirtyFirst = firstBlockNo;
+    if (firstBlockNo + count > this->dirtyEnd)
+        this->dirtyEnd = firstBlockNo + count;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::sync() {
+    if (this->mapping == nullptr) {
+        completeAll();
+        uint64_t startTime = IOStats::now();
+        if (fsync(this->contFile) < 0)
+            return -errno;
+        this->stats.recordLatency(IOS_SYNC, IOStats::now() - startTime);
+        return 0;
+    }
+
+    if (this->dirtyEnd == this->dirtyFirst)
+        return 0;
+
+    // msync() needs a page aligned start address
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = (size_t) this->dirtyFirst * this->blockSize / pageSize * pageSize;
+    size_t end = (size_t) this->dirtyEnd * this->blockSize;
+    if (end > this->mappingSize)
+        end = this->mappingSize;
+
+    uint64_t startTime = IOStats::now();
+    if (msync(this->mapping + start, end - start, MS_SYNC) < 0)
+        return -errno;
+    this->stats.recordLatency(IOS_SYNC, IOStats::now() - startTime);
+
+    this->dirtyFirst = 0;
+    this->dirtyEnd = 0;
+    return 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::setDirectIO(bool enable) {
+    completeAll();
+
+    int ret = switchDirectIO(enable);
+    if (ret < 0)
+        return ret;
+
+    if (enable) {
+        // bounce buffers must be aligned to the block size and hold whole blocks
+        size_t alignment = this->blockSize > 4096 ? this->blockSize : 4096;
+        size_t bounceSize = BD_BOUNCE_SIZE > this->blockSize ? BD_BOUNCE_SIZE : this->blockSize;
+        bounceSize -= bounceSize % this->blockSize;
+        this->bouncePool.init(bounceSize, alignment, BD_RING_ENTRIES);
+
+        // the disk may need larger blocks than the container uses, that is only known after a direct transfer
+        ret = probeDirectIO();
+        if (ret < 0) {
+            switchDirectIO(false);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+// transfer the first block of the container file with O_DIRECT, return 0 if the host accepts it, -errno otherwise
+int BlockDevice::probeDirectIO() {
+    char *buffer = this->bouncePool.get();
+    if (buffer == nullptr)
+        return -ENOMEM;
+
+    struct stat st;
+    int ret = 0;
+    if (fstat(this->contFile, &st) < 0) {
+        ret = -errno;
+    } else if (st.st_size == 0) {
+        // reading an empty file checks nothing, a zeroed block reads the same as no block at all
+        memset(buffer, 0, this->blockSize);
+        if (::pwrite(this->contFile, buffer, this->blockSize, 0) < 0)
+            ret = -errno;
+    } else if (::pread(this->contFile, buffer, this->blockSize, 0) < 0) {
+        ret = -errno;
+    }
+
+    this->bouncePool.put(buffer);
+    return ret;
+}
+
+// toggle O_DIRECT on the open container file, requests in flight are not affected
+int BlockDevice::switchDirectIO(bool enable) {
+    int flags = fcntl(this->contFile, F_GETFL);
+    if (flags < 0)
+        return -errno;
+
+    flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    if (fcntl(this->contFile, F_SETFL, flags) < 0)
+        return -errno;
+
+    this->directIO = enable;
+    return 0;
+}
+
+// return true if the container file is accessed with O_DIRECT
+bool BlockDevice::isDirectIO() {
+    return this->directIO;
+}
+
+// return the statistics of this block device
+IOStats *BlockDevice::getStats() {
+    return &this->stats;
+}
+
+// wait until no request is in flight anymore
+void BlockDevice::completeAll() {
+    while (this->inFlightCount > 0) {
+        if (reapCompletions() < 0) {
+            break;
+        }
+    }
+}
+
+// move all iovecs from/to the container file starting at pos, resuming after partial transfers.
+// The container file is never pre-sized, so reading past its end yields zeros.
+int BlockDevice::transfer(bool isWrite, off_t pos, struct iovec *iov, int iovCount) {
+    if (this->mapping != nullptr)
+        return copyMapped(isWrite, pos, iov, iovCount);
+
+    while (iovCount > 0) {
+        ssize_t ret = isWrite ? ::pwritev(this->contFile, iov, iovCount, pos)
+                              : ::preadv(this->contFile, iov, iovCount, pos);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        if (ret == 0) {
+            if (isWrite)
+                return -EIO;
+            for (int i = 0; i < iovCount; i++)
+                memset(iov[i].iov_base, 0, iov[i].iov_len);
+            return 0;
+        }
+
+        pos += ret;
+        // skip everything that has been transferred already
+        while (iovCount > 0 && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovCount--;
+        }
+        if (iovCount > 0) {
+            iov->iov_base = (char *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
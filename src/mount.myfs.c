@@ -15,6 +15,7 @@
 #include <stddef.h>
 
 #include "myfs-info.h"
+#include "myfs-options.h"
 
 #define PACKAGE_VERSION "v0.2"
 
@@ -23,6 +24,7 @@ struct fuse_operations myfs_oper;
 struct myfs_config {
     char *containerFileName;
     char *logFileName;
+    struct MyFsOptions options;
 };
 enum {
     KEY_HELP,
@@ -36,6 +38,16 @@ static struct fuse_opt myfs_opts[] = {
         MYFS_OPT("containerfile=%s",  containerFileName, 0),
         MYFS_OPT("-l %s",             logFileName, 0),
         MYFS_OPT("logfile=%s",        logFileName, 0),
+        MYFS_OPT("mmap",              options.useMmap, 1),
+        MYFS_OPT("odirect",           options.useDirectIO, 1),
+        MYFS_OPT("cachesize=%d",      options.cacheSize, 0),
+        MYFS_OPT("writeback",         options.useWriteBack, 1),
+        MYFS_OPT("blocksize=%d",      options.blockSize, 0),
+        MYFS_OPT("fssize=%d",         options.fsSize, 0),
+        MYFS_OPT("direntries=%d",     options.dirEntries, 0),
+        MYFS_OPT("extents",           options.useExtents, 1),
+        MYFS_OPT("noatime",           options.noAtime, 1),
+        MYFS_OPT("relatime",          options.relAtime, 1),
 
         FUSE_OPT_KEY("-V",             KEY_VERSION),
         FUSE_OPT_KEY("--version",      KEY_VERSION),
@@ -56,7 +68,17 @@ static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
                     "    -o containerfile=FILE\n"
                     "    -c FILE            same as '-o containerfile=FILE'\n"
                     "    -o logfile=FILE\n"
-                    "    -l FILE            same as '-o logfile=FILE'\n");
+                    "    -l FILE            same as '-o logfile=FILE'\n"
+                    "    -o mmap            map the whole container file into memory\n"
+                    "    -o odirect         access the container file with O_DIRECT\n"
+                    "    -o cachesize=MIB   size of the block cache in MiB (default 16, 0 disables it)\n"
+                    "    -o writeback       write modified blocks back in the background\n"
+                    "    -o blocksize=BYTES block size of a new container (default 512)\n"
+                    "    -o fssize=MIB      size of the data region of a new container in MiB (default 128)\n"
+                    "    -o direntries=N    inodes in the RootDir region of a new container (default 64)\n"
+                    "    -o extents         map the files of a new container by extents instead of a FAT\n"
+                    "    -o noatime         do not update the access time when a file is read\n"
+                    "    -o relatime        update the access time only if it is older than the last change or a day\n");
             exit(1);
 
         case KEY_VERSION:
@@ -101,7 +123,11 @@ int main(int argc, char *argv[]) {
     myfs_oper.releasedir = wrap_releasedir;
     myfs_oper.fsyncdir = wrap_fsyncdir;
     myfs_oper.init = wrap_init;
+    myfs_oper.destroy = wrap_destroy;
     myfs_oper.ftruncate = wrap_ftruncate;
+#if FUSE_VERSION >= 29
+    myfs_oper.fallocate = wrap_fallocate;  // added to the operations in libfuse 2.9.1
+#endif
 
     char* containerFileName= NULL;
     char* logFileName= NULL;
@@ -111,6 +137,7 @@ int main(int argc, char *argv[]) {
     struct myfs_config conf;
 
     memset(&conf, 0, sizeof(conf));
+    conf.options.cacheSize = -1;
 
     fuse_opt_parse(&args, &conf, myfs_opts, myfs_opt_proc);
 
@@ -171,6 +198,9 @@ int main(int argc, char *argv[]) {
     FsInfo->contFile= containerFileName;
     FsInfo->logFile= logFileName;
 
+    // the mount options go directly to the file system instance
+    setOptions(&conf.options);
+
     // add additoinal "-s"
     fuse_opt_add_arg(&args, "-s");
 
@@ -38,6 +38,12 @@ MyFS::~MyFS()
 {
 }
 
+/// @brief Take the mount options, they are applied when the file system is initialized
+void MyFS::setOptions(const MyFsOptions *options)
+{
+    this->options = *options;
+}
+
 MyFS *MyFS::_instance = NULL;
 
 MyFS *MyFS::Instance()
@@ -223,6 +229,12 @@ int MyFS::fuseCreate(const char *path, mode_t mode, struct fuse_file_info *fileI
     RETURN(0);
 }
 
+int MyFS::fuseFallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo)
+{
+    LOGM();
+    RETURN(-EOPNOTSUPP);
+}
+
 void MyFS::fuseDestroy()
 {
     LOGM();
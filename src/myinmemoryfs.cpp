@@ -46,6 +46,7 @@ MyInMemoryFS::MyInMemoryFS() : MyFS()
 {
 
     files = new MyFSFileInfo[NUM_DIR_ENTRIES];
+    names = new NameIndex(NUM_DIR_ENTRIES);
     openFiles = new int32_t[NUM_OPEN_FILES];
 }
 
@@ -56,6 +57,7 @@ MyInMemoryFS::~MyInMemoryFS()
 {
 
     delete[] files;
+    delete names;
     delete[] openFiles;
 }
 
@@ -80,6 +82,11 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
     {
         return -ENAMETOOLONG;
     }
+    int index = getNextFreeIndex();
+    if (index == -1)
+    {
+        return -ENOSPC;
+    }
 
     MyFSFileInfo *file = new MyFSFileInfo();
     strcpy(file->name, path + 1); // +1 to shove the path slash `/`
@@ -88,7 +95,8 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
     time(&(file->atime));
     time(&(file->mtime));
     time(&(file->ctime));
-    files[getNextFreeIndex()] = *file;
+    files[index] = *file;
+    names->insert(files[index].name, index);
 
     RETURN(0);
 }
@@ -110,6 +118,7 @@ int MyInMemoryFS::fuseUnlink(const char *path)
     }
 
     free(files[index].data);     // free the memory
+    names->remove(files[index].name, index);
     files[index].name[0] = '\0'; // reset the name nullpointer hack
 
     RETURN(0);
@@ -143,7 +152,9 @@ int MyInMemoryFS::fuseRename(const char *path, const char *newpath)
     int index = getIndex(path);
     if (index != -1)
     {
+        names->remove(files[index].name, index);
         strcpy(files[index].name, newpath + 1);
+        names->insert(files[index].name, index);
         return 0;
     }
 
@@ -506,6 +517,7 @@ void *MyInMemoryFS::fuseInit(struct fuse_conn_info *conn)
         {
             files[i].name[0] = '\0';
         }
+        names->clear();
         for (int i = 0; i < NUM_OPEN_FILES; i++)
         {
             openFiles[i] = -ENOENT;
@@ -525,20 +537,11 @@ void MyInMemoryFS::fuseDestroy()
 
 // NOTE: [PART 1] You may add your own additional methods here!
 
-// return the index of a given file
+// return the index of a given file, looked up in the name index
 int MyInMemoryFS::getIndex(const char *path)
 {
     path++; // Ignore '/'
-            //    std::cout << "Trying to find: " << path << std::endl;
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++)
-    {
-        if (files[i].name[0] != '\0' && strcmp(path, files[i].name) == 0)
-        {
-            //            std::cout << "Found: " << files[i].name << std::endl;
-            return i;
-        }
-    }
-    return -1;
+    return names->find(path);
 }
 
 // return the index of the next free slot available to create an item
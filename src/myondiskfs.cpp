@@ -17,6 +17,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <algorithm>
 
 #include "macros.h"
 #include "myfs.h"
@@ -28,13 +30,14 @@
 /// You may add your own constructor code here.
 MyOnDiskFS::MyOnDiskFS() : MyFS()
 {
-    // create a block device object
-    this->blockDevice = new BlockDevice(BLOCK_SIZE);
-
-    buffer = new char[BLOCK_SIZE];      //For creating blocks
-    dMap = new DMap(blockDevice);       //checks if a block if free or used
-    fat = new FAT(blockDevice);         //Location of next block
-    rootDir = new RootDir(blockDevice); //Metadata for files
+    // the block device and everything sized by the container geometry is created in fuseInit(), once the
+    // superblock has been read
+    this->blockDevice = nullptr;
+    this->blockCache = nullptr;
+    buffer = nullptr;
+    dMap = nullptr;
+    fat = nullptr;
+    rootDir = nullptr;
 }
 
 /// @brief Destructor of the on-disk file system class.
@@ -43,11 +46,17 @@ MyOnDiskFS::MyOnDiskFS() : MyFS()
 MyOnDiskFS::~MyOnDiskFS()
 { //Delete everything from memory since everything is saved in the BlockDevice
     // free block device object
+    delete this->blockCache;
     delete this->blockDevice;
 
+    for (auto &map : fileMaps)
+    {
+        delete map.second;
+    }
     delete rootDir;
     delete fat;
     delete dMap;
+    delete[] buffer;
 }
 
 /// @brief Create a new file.
@@ -62,9 +71,21 @@ int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
 {
     LOGM();
 
-    rootFile *file = rootDir->createFile(path); //New pointer to new file
+    rootFile *file = nullptr;
+    int ret = rootDir->createFile(path, S_IFREG | 0644, &file); //New pointer to new file
+    if (ret != 0)
+    { // the name exists, the directory does not or there is no block left for the metadata
+        return ret;
+    }
     this->rootDir->persist(file);               //Persist the file -> write into the container file
 
+    // the inode block and the directory nodes may have been taken from the data blocks
+    dMap->persist();
+    if (blockCache->waitForCompletion() != 0)
+    {
+        return -EIO;
+    }
+
     RETURN(0);
 }
 
@@ -78,45 +99,48 @@ int MyOnDiskFS::fuseUnlink(const char *path)
 {
     LOGM();
 
-    rootFile *file = rootDir->getFile(path); //get the strucute of the file
+    rootFile *file = nullptr;
+    int ret = rootDir->findFile(path, &file); //get the strucute of the file
 
     // couldn't find file at that path
-    if (file == nullptr)
-    { //getFile returns nullptr if file does not exist
-        return -ENOENT;
+    if (ret != 0)
+    {
+        return ret;
+    }
+    if (S_ISDIR(file->stat.st_mode))
+    {
+        return -EISDIR;
     }
 
-    // go through fat and dmap and delete the chain
-    if (file->firstBlock != -1)
+    // the blocks of an open file are freed when its last handle is released, until then it only loses its name
+    if (!isFileOpen(file))
     {
-        int currentBlock = file->firstBlock;
-        int nextBlock = FAT_EOF; //For while loop, since outwise it would run forever
-        do
+        ret = freeFileBlocks(file);
+        if (ret != 0)
         {
-            // Gets the next block
-            nextBlock = fat->getNextBlock(currentBlock);
-
-            // Sets bit to 0 to represent emtpy space
-            dMap->setBlockState(currentBlock, false);
-
-            // Deletes block
-            fat->freeBlock(currentBlock);
-
-            // Continues as long as fat is not at the end
-            currentBlock = nextBlock;
-        } while (nextBlock != FAT_EOF);
+            return ret;
+        }
     }
 
+    // clear file from rootdir, this frees its inode unless the file is still open
+    ret = rootDir->deleteFile(file);
+
     dMap->persist(); //Write into the blockdevice
-    fat->persist();
+    if (fat != nullptr)
+    {
+        fat->persist();
+    }
 
-    // clear the metadata block of the file
-    char buff[BLOCK_SIZE];
-    memset(buff, 0, BLOCK_SIZE);
-    this->blockDevice->write(ROOT_DIR_OFFSET + file->rootDirBlock, buff); //Delte file in block device by overwriting everyting with 0's
+    // wait for the DMap and FAT writes
+    if (blockCache->waitForCompletion() != 0)
+    {
+        return -EIO;
+    }
+    if (ret != 0)
+    {
+        return ret;
+    }
 
-    // clear file from rootdir
-    rootDir->deleteFile(file);
     RETURN(0);
 }
 
@@ -133,27 +157,102 @@ int MyOnDiskFS::fuseRename(const char *path, const char *newpath)
 {
     LOGM();
 
-    // verify name length
-    if (strlen((newpath + 1)) > NAME_LENGTH)
+    rootFile *file = nullptr;
+    int ret = rootDir->findFile(path, &file);
+    // file does not exist
+    if (ret != 0)
     {
-        return -ENAMETOOLONG;
+        return ret;
     }
 
-    rootFile *file = rootDir->getFile(path);
-    // file does not exist
-    if (file == nullptr)
+    // check if file already exists, the metadata of the file stays in memory during the lookup
+    rootFile *existing = nullptr;
+    rootDir->pinFile(file);
+    ret = rootDir->findFile(newpath, &existing);
+    if (ret == 0)
     {
-        return -ENOENT;
+        ret = -EEXIST;
+    }
+    else if (ret == -ENOENT)
+    {
+        ret = rootDir->renameFile(file, newpath);
+    }
+    rootDir->unpinFile(file);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    rootDir->persist(file); // persist the new file (the name and the directory changed)
+
+    // the directory may have taken or freed nodes
+    dMap->persist();
+    if (blockCache->waitForCompletion() != 0)
+    {
+        return -EIO;
+    }
+    RETURN(0);
+}
+
+/// @brief Create a directory.
+///
+/// The directory gets a directory tree of its own, its metadata is stored like the metadata of a file.
+/// \param [in] path Name of the directory, starting with "/".
+/// \param [in] mode Permissions of the directory.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseMkdir(const char *path, mode_t mode)
+{
+    LOGM();
+
+    rootFile *dir = nullptr;
+    int ret = rootDir->createFile(path, S_IFDIR | (mode & 07777), &dir);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    rootDir->persist(dir);
+
+    // the inode block and the tree nodes may have been taken from the data blocks
+    dMap->persist();
+    if (blockCache->waitForCompletion() != 0)
+    {
+        return -EIO;
+    }
+
+    RETURN(0);
+}
+
+/// @brief Delete a directory.
+///
+/// Only an empty directory can be deleted.
+/// \param [in] path Name of the directory, starting with "/".
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseRmdir(const char *path)
+{
+    LOGM();
+
+    rootFile *dir = nullptr;
+    int ret = rootDir->findFile(path, &dir);
+    if (ret != 0)
+    {
+        return strcmp(path, "/") == 0 ? -EBUSY : ret;
+    }
+    if (!S_ISDIR(dir->stat.st_mode))
+    {
+        return -ENOTDIR;
+    }
+
+    ret = rootDir->deleteFile(dir);
+    if (ret != 0)
+    {
+        return ret;
     }
 
-    // check if file already exists
-    if (rootDir->getFile(newpath) != nullptr)
+    dMap->persist();
+    if (blockCache->waitForCompletion() != 0)
     {
-        return -EEXIST;
+        return -EIO;
     }
 
-    strcpy(file->name, newpath + 1);
-    rootDir->persist(file); // persist the new file (only the filename changed)
     RETURN(0);
 }
 
@@ -180,16 +279,41 @@ int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf)
     }
 
     // If path requested is not the root ('/') get the file via path
-    rootFile *file = rootDir->getFile(path); //get the meta data from the rootFile
+    rootFile *file = nullptr;
+    int ret = rootDir->findFile(path, &file); //get the meta data from the rootFile
 
-    if (file == nullptr)
+    if (ret != 0)
     {
-        return -ENOENT;
+        return ret;
     }
 
     // Copy new struct into buffer
     memcpy(statbuf, &file->stat, sizeof(*statbuf));
 
+    // st_blocks counts the data blocks in units of 512 bytes. Holes have none, the data waiting for allocation has its
+    // blocks reserved already. A FAT chain has no holes, the extent tree keeps its count in the metadata of the file.
+    // Only a file that was written before the count was kept has to load its tree once.
+    uint64_t blocks = file->blockCount;
+    if (fat == nullptr)
+    {
+        if (file->mappedBlocks == 0)
+        {
+            if (getFileMap(file) == nullptr)
+            {
+                return -EIO;
+            }
+            releaseFileMap(file);
+            rootDir->persist(file);
+        }
+        blocks = file->mappedBlocks - 1;
+    }
+    auto delayed = delayedData.find(file->rootDirBlock);
+    if (delayed != delayedData.end())
+    {
+        blocks += delayed->second.size() / blockSize;
+    }
+    statbuf->st_blocks = (blkcnt_t)(blocks * blockSize / 512);
+
     RETURN(0);
 }
 
@@ -210,7 +334,7 @@ int MyOnDiskFS::fuseChmod(const char *path, mode_t mode)
         return -ENOENT;
     }
 
-    file->stat.st_mode = mode;
+    file->stat.st_mode = (file->stat.st_mode & S_IFMT) | (mode & ~S_IFMT); // the type of the file stays
     rootDir->persist(file);
 
     RETURN(0);
@@ -259,19 +383,25 @@ int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo)
         return -EMFILE;
     }
 
-    rootFile *file = rootDir->getFile(path);
-    if (file == nullptr)
+    rootFile *file = nullptr;
+    int ret = rootDir->findFile(path, &file);
+    if (ret != 0)
     {
-        return -ENOENT;
+        return ret;
+    }
+    if (S_ISDIR(file->stat.st_mode))
+    {
+        return -EISDIR;
     }
 
     openFileCount++;
 
     int openFileIndex = getNextFreeIndexOpenFiles();
 
-    // Create a new openFile object from the file specified by the path
+    // Create a new openFile object from the file specified by the path, the metadata stays in memory while it is open
     openFile *openFile = new ::openFile();
     openFile->file = file;
+    rootDir->pinFile(file);
 
     // Add it to the array
     openFiles[openFileIndex] = openFile;
@@ -310,7 +440,8 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
     }
 
     // If so write it to the root file obj
-    rootFile *file = openFiles[fileInfo->fh]->file;
+    openFile *handle = openFiles[fileInfo->fh];
+    rootFile *file = handle->file;
 
     // Nothing to read because the user wants to read outside of the file content
     // Example: file has 2 lines, user wants to start to read at line 5
@@ -327,41 +458,67 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
         size = file->stat.st_size - offset;
     }
 
-    // number of blocks to read
-    int blockCount;
+    // If offset is bigger than blockSize we read some block in the chain,
+    // determine how many blocks we need to skip
+    int blockOffset = offset / blockSize;
 
-    // calculate the number of blocks to read
-    if (size % BLOCK_SIZE == 0)
-    { // filesize is exactly multiple of BLOCK_SIZE
-        blockCount = size / BLOCK_SIZE;
-    }
-    else
-    { //+1 to read the next block too
-        blockCount = size / BLOCK_SIZE + 1;
-    }
+    // number of blocks to read, the request may start and end in the middle of a block
+    int blockCount = (offset + size - 1) / blockSize - blockOffset + 1;
 
-    // If offset is bigger than BLOCK_SIZE we read some block in the chain,
-    // determine how many blocks we need to skip
-    int blockOffset = offset / BLOCK_SIZE;
+    // the part behind the allocated blocks is copied from the data waiting for allocation
+    int err = 0;
+    size_t allocatedSize = size;
+    off_t allocatedEnd = (off_t)file->blockCount * blockSize;
+    if ((off_t)(offset + size) > allocatedEnd)
+    {
+        auto delayed = delayedData.find(file->rootDirBlock);
+        off_t start = std::max(offset, allocatedEnd);
+        if (delayed == delayedData.end() || (size_t)(offset + size - allocatedEnd) > delayed->second.size())
+        {
+            err = -1;
+        }
+        else
+        {
+            memcpy(buf + (start - offset), delayed->second.data() + (start - allocatedEnd), offset + size - start);
+            allocatedSize = offset < allocatedEnd ? allocatedEnd - offset : 0;
+        }
+    }
 
-    // now skip the blocks
-    int currentBlock = file->firstBlock;
-    for (int i = 0; i < blockOffset; i++)
+    // preallocated blocks that have never been written read as zeros
+    if (file->unwrittenBlock != 0)
     {
-        currentBlock = fat->getNextBlock(currentBlock);
+        off_t unwrittenStart = (off_t)(file->unwrittenBlock - 1) * blockSize;
+        if ((off_t)(offset + allocatedSize) > unwrittenStart)
+        {
+            off_t start = std::max(offset, unwrittenStart);
+            memset(buf + (start - offset), 0, offset + allocatedSize - start);
+            allocatedSize = start - offset;
+        }
     }
 
-    // construct chain of blocks that need to be read
+    // the map of the file finds the blocks without walking through the file
+    int allocatedCount = allocatedSize == 0 ? 0 : (offset + allocatedSize - 1) / blockSize - blockOffset + 1;
     int *blocks = new int[blockCount];
-    blocks[0] = currentBlock;
-    for (int i = 1; i < blockCount; i++)
+    FileMap *map = getFileMap(file);
+    if (err == 0 && allocatedCount > 0)
+    {
+        err = map == nullptr ? -1 : map->getBlocks(blockOffset, allocatedCount, blocks);
+
+        // read the file
+        if (err == 0)
+        {
+            err = readFile(blocks, allocatedCount, offset % blockSize, allocatedSize, buf, handle);
+        }
+    }
+
+    // queue the following blocks if the file is read sequentially
+    if (err == 0)
     {
-        currentBlock = fat->getNextBlock(currentBlock); //get the next block from the FAR
-        blocks[i] = currentBlock;
+        readahead(handle, offset, size, blockOffset + blockCount - 1);
     }
 
-    // read the file
-    int err = readFile(blocks, blockCount, offset % BLOCK_SIZE, size, buf, openFiles[fileInfo->fh]);
+    // We dont want to store the temp blocks
+    delete[] blocks;
 
     // if an error occurred return error
     if (err != 0)
@@ -369,13 +526,8 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
         return -EIO;
     }
 
-    // update the file because of the new a_time
-    file->stat.st_atime = time(nullptr);
-
-    this->rootDir->persist(file); //Update the a_time in the rootDir
-
-    // We dont want to store the temp blocks
-    delete[] blocks;
+    // update the file because of the new a_time, unless the mount options leave it alone
+    updateAccessTime(file);
 
     // return the amount of bytes to read
     RETURN(size);
@@ -407,56 +559,108 @@ int MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t
     }
     rootFile *file = openFiles[fileInfo->fh]->file;
 
+    // nothing to write
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    // the map of the file has to be known to find the blocks it has already
+    FileMap *map = getFileMap(file);
+    if (map == nullptr)
+    {
+        return -EIO;
+    }
+
     // first, collect information about how many & which blocks
     // to use to store the data to be written
 
-    // Number of blocks to write
-    int blockCount;
-    if (size % BLOCK_SIZE == 0)
+    // offset block to start writing on existing files
+    int blockOffset = offset / blockSize;
+    // Number of blocks to write, the first and last one may only be touched partially
+    int blockCount = (offset + size - 1) / blockSize - blockOffset + 1;
+
+    // a write far behind the end of the file leaves a hole in front of it, the data waiting for allocation gets its
+    // blocks first so that the new data can wait for allocation behind the hole
+    auto waiting = delayedData.find(file->rootDirBlock);
+    int delayedBlocks = waiting == delayedData.end() ? 0 : (int)(waiting->second.size() / blockSize);
+    bool leavesHole = map->supportsHoles() && blockOffset > (int)file->blockCount + delayedBlocks;
+
+    // the blocks behind the allocated end of the file only get data blocks when the file is flushed. Their space is
+    // reserved in the DMap before the file is changed, so that a write failing with ENOSPC leaves it as it was.
+    int blockCountDelta = leavesHole ? blockCount : blockOffset + blockCount - (int)file->blockCount - delayedBlocks;
+    if (blockCountDelta > 0 && !dMap->reserveBlocks(blockCountDelta))
     {
-        blockCount = size / BLOCK_SIZE;
+        return -ENOSPC;
     }
-    else
+
+    int ret = 0;
+    if (leavesHole)
     {
-        blockCount = size / BLOCK_SIZE + 1;
+        ret = flushDelayedBlocks(file);
+        if (ret == 0)
+        {
+            file->blockCount = blockOffset;
+        }
     }
 
-    // offset block to start writing on existing files
-    int blockOffset = offset / BLOCK_SIZE;
-    // if the existing file gets bigger, append to existing block
-    int blockCountDelta = blockOffset + blockCount - file->stat.st_blocks;
+    // so are the map nodes the data may need once it gets its blocks, a full container must not fail the flush
+    if (ret == 0 && blockCountDelta > 0)
+    {
+        ret = reserveNodeBlocks(file, map, leavesHole ? blockCount : delayedBlocks + blockCountDelta);
+    }
 
-    if (blockCountDelta > 0)
-    { // if we need a new block
+    // the blocks of the write that lie in a hole inside the allocated part get their data blocks right away
+    uint32_t allocatedWriteEnd = std::min((uint32_t)(blockOffset + blockCount), file->blockCount);
+    if (ret == 0 && map->supportsHoles() && (uint32_t)blockOffset < allocatedWriteEnd)
+    {
+        ret = mapHoles(file, blockOffset, allocatedWriteEnd, offset, size);
+    }
 
-        // create array of free blocks, according to size of the data we're writing
-        // also mark the blocks as used already
-        int *newBlocks = dMap->getXAmountOfFreeBlocks(blockCount);
+    // the rest of the last block of the file must not show old data once the file grows past it
+    if (ret == 0 && offset > file->stat.st_size && file->stat.st_size % blockSize != 0)
+    {
+        off_t blockEnd = (file->stat.st_size / blockSize + 1) * blockSize;
+        ret = writeZeros(file->stat.st_size, std::min(offset, blockEnd) - file->stat.st_size, fileInfo);
+    }
 
-        if (file->firstBlock == -1)
-        { // file is new or empty
-            file->firstBlock = newBlocks[0];
-        }
-        else
-        { // we are editing an existing file
-            // connect the last block of the file to new blocks
-            int currentBlock = file->firstBlock;
-            // get end of chain
-            while (fat->getNextBlock(currentBlock) != FAT_EOF)
-            {
-                currentBlock = fat->getNextBlock(currentBlock);
-            }
-            fat->setNextBlock(currentBlock, newBlocks[0]);
-        }
+    // preallocated blocks in front of the data and the partially written ones have to be zeroed on disk before
+    if (ret == 0 && file->unwrittenBlock != 0 && (off_t)(offset + size) > (off_t)(file->unwrittenBlock - 1) * blockSize)
+    {
+        ret = fillUnwrittenBlocks(file, offset, size) == 0 ? 0 : -EIO;
+    }
 
-        // store the chain of blocks in fat
-        for (int i = 1; i < blockCount; i++)
+    if (ret != 0)
+    {
+        if (blockCountDelta > 0)
+        {
+            dMap->releaseBlocks(blockCountDelta);
+        }
+        auto delayed = delayedData.find(file->rootDirBlock);
+        if (delayed == delayedData.end() || delayed->second.empty())
         {
-            fat->setNextBlock(newBlocks[i - 1], newBlocks[i]);
+            releaseNodeBlocks(file);
         }
+        return ret;
+    }
+
+    // the content of the reserved blocks is kept in memory until they are allocated all at once
+    std::vector<char> &delayed = delayedData[file->rootDirBlock];
+    uint32_t allocatedBlocks = file->blockCount;
+    if (blockCountDelta > 0)
+    {
+        delayed.resize((size_t)(blockOffset + blockCount - allocatedBlocks) * blockSize, 0);
+        delayedBlockCount += blockCountDelta;
+    }
 
-        delete[] newBlocks;
-        file->stat.st_blocks = blockCount + blockOffset;
+    // copy the part of the data that lies behind the allocated blocks
+    size_t allocatedSize = size;
+    off_t allocatedEnd = (off_t)allocatedBlocks * blockSize;
+    if ((off_t)(offset + size) > allocatedEnd)
+    {
+        off_t start = std::max(offset, allocatedEnd);
+        memcpy(delayed.data() + (start - allocatedEnd), buf + (start - offset), offset + size - start);
+        allocatedSize = offset < allocatedEnd ? allocatedEnd - offset : 0;
     }
 
     // write new file size
@@ -465,41 +669,50 @@ int MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t
         file->stat.st_size = offset + size;
     }
 
-    int currentBlock = file->firstBlock;
-    // Move to offset - in case of writing to existing file
-    for (int i = 1; i <= blockOffset; i++)
+    // and set the new timestamps
+    file->stat.st_mtime = time(nullptr);
+    file->stat.st_ctime = time(nullptr);
+
+    // write the part of the data that lies inside the allocated blocks
+    if (allocatedSize > 0)
     {
-        int nextBlockIndex = fat->getNextBlock(currentBlock);
-        if (nextBlockIndex != FAT_EOF) {
-            currentBlock = nextBlockIndex;
+        // Collect blocks to write
+        int allocatedCount = (offset + allocatedSize - 1) / blockSize - blockOffset + 1;
+        int *blocks = new int[allocatedCount];
+        int err = map->getBlocks(blockOffset, allocatedCount, blocks);
+
+        // pass to function to write blocks
+        if (err == 0)
+        {
+            err = writeFile(blocks, allocatedCount, offset % blockSize, allocatedSize, buf, openFiles[fileInfo->fh]);
         }
-    }
+        delete[] blocks;
 
-    // Collect blocks to write
-    int *blocks = new int[blockCount];
-    blocks[0] = currentBlock;
-    for (int i = 1; i < blockCountDelta; i++)
-    {
-        currentBlock = fat->getNextBlock(currentBlock);
-        blocks[i] = currentBlock;
-    }
+        // verify
+        if (err != 0)
+        {
+            return -EIO;
+        }
 
-    // pass to function to write blocks
-    int err = writeFile(blocks, blockCount, offset % BLOCK_SIZE, size, buf, openFiles[fileInfo->fh]);
+        // persist the metadata, the write is in flight together with the data writes
+        rootDir->persist(file);
 
-    // verify
-    if (err != 0)
-    {
-        return -EIO;
+        // wait until data and metadata have reached the container
+        if (blockCache->waitForCompletion() != 0)
+        {
+            return -EIO;
+        }
     }
-    // and set the new timestamps
-    file->stat.st_mtime = time(nullptr);
-    file->stat.st_ctime = time(nullptr);
 
-    // persist the changes
-    dMap->persist();
-    fat->persist();
-    rootDir->persist(file);
+    // allocate the blocks of all files if too much data is waiting for them
+    if ((uint64_t)delayedBlockCount * blockSize > DELAYED_ALLOC_MAX_BYTES)
+    {
+        int ret = flushAllDelayedBlocks();
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
 
     // return the actual written number of bytes
     RETURN(size);
@@ -507,6 +720,8 @@ int MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t
 
 /// @brief Close a file.
 ///
+/// Allocates and writes the data of the file that is still waiting for data blocks. The last handle of a file that has
+/// been unlinked while it was open frees its blocks and its inode instead.
 /// \param [in] path Name of the file, starting with "/".
 /// \param [in] File handel for the file set by fuseOpen.
 /// \return 0 on success, -ERRNO on failure.
@@ -515,10 +730,104 @@ int MyOnDiskFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo)
     LOGM();
 
     int openFileIndex = fileInfo->fh;
-    delete openFiles[openFileIndex];
+    openFile *handle = openFiles[openFileIndex];
     openFiles[openFileIndex] = nullptr;
     openFileCount--;
 
+    int ret = 0;
+    if (handle != nullptr && handle->file->stat.st_nlink == 0 && !isFileOpen(handle->file))
+    {
+        ret = freeFileBlocks(handle->file);
+
+        // the metadata of the file is gone with its last pin
+        rootDir->unpinFile(handle->file);
+        dMap->persist();
+        if (fat != nullptr)
+        {
+            fat->persist();
+        }
+        if (blockCache->waitForCompletion() != 0 && ret == 0)
+        {
+            ret = -EIO;
+        }
+    }
+    else if (handle != nullptr)
+    {
+        rootFile *file = handle->file;
+        ret = flushDelayedBlocks(file);
+        rootDir->unpinFile(file);
+        releaseFileMap(file);
+    }
+    delete handle;
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    // write back the blocks modified through the mapping
+    if (blockDevice->isMapped() && blockDevice->sync() != 0)
+    {
+        return -EIO;
+    }
+
+    RETURN(0);
+}
+
+/// @brief Flush cached data.
+///
+/// Called on each close() of a file handle. Allocates and writes the data of the file that is still waiting for data
+/// blocks, then writes the dirty blocks held by the block cache to the container file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] fileInfo File handle set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFlush(const char *path, struct fuse_file_info *fileInfo)
+{
+    LOGM();
+
+    if (openFiles[fileInfo->fh] != nullptr)
+    {
+        int ret = flushDelayedBlocks(openFiles[fileInfo->fh]->file);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    if (blockCache->flush() != 0)
+    {
+        return -EIO;
+    }
+
+    RETURN(0);
+}
+
+/// @brief Synchronize the content of a file.
+///
+/// Allocate and write the data of the file that is still waiting for data blocks, write the dirty blocks held by the
+/// block cache and flush all modified blocks of the container file to the disk.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] datasync Can be ignored.
+/// \param [in] fileInfo File handle set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFsync(const char *path, int datasync, struct fuse_file_info *fileInfo)
+{
+    LOGM();
+
+    if (openFiles[fileInfo->fh] != nullptr)
+    {
+        int ret = flushDelayedBlocks(openFiles[fileInfo->fh]->file);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    if (blockCache->sync() != 0)
+    {
+        return -EIO;
+    }
+
     RETURN(0);
 }
 
@@ -592,51 +901,61 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_i
         return 0;
     }
 
-
-    // FIXME: free used blocks from blockdevice when shoving datablocks
-    uint32_t blockCount;
     // count the required amount of blocks to
-    if (newSize % BLOCK_SIZE == 0)
-    {
-        blockCount = newSize / BLOCK_SIZE;
-    }
-    else
+    uint32_t blockCount = (newSize + blockSize - 1) / blockSize;
+
+    // free the blocks behind the new end, the map of the file is shared with all other handles
+    FileMap *map = getFileMap(file);
+    if (map == nullptr)
     {
-        blockCount = newSize / BLOCK_SIZE + 1;
+        return -EIO;
     }
-
-    // count the difference in blocks (to be removed later on)
-    uint32_t blockDelta = file->stat.st_blocks - blockCount;
-
-    // should always be >= 1 unless we are wiping the file, (in which case we should not end up here in the first place)
-    if (blockDelta > 0)
+    if (newSize > file->stat.st_size)
     {
-        uint32_t offsetBlock = file->stat.st_blocks - blockDelta;
-        int32_t currentBlock = file->firstBlock;
-        // move to offset block
-        for (uint32_t i = 1; i < offsetBlock; i++)
+        // the data waiting for allocation gets its blocks first, the new blocks follow behind it
+        int ret = flushDelayedBlocks(file);
+        if (ret == 0 && map->supportsHoles())
         {
-            currentBlock = fat->getNextBlock(currentBlock);
+            // the new blocks become a hole, only the rest of the old last block is zeroed
+            if (file->stat.st_size % blockSize != 0)
+            {
+                off_t blockEnd = (file->stat.st_size / blockSize + 1) * blockSize;
+                ret = writeZeros(file->stat.st_size, std::min(newSize, blockEnd) - file->stat.st_size, fileInfo);
+            }
+            if (blockCount > file->blockCount)
+            {
+                file->blockCount = blockCount;
+            }
         }
-
-        int32_t nextBlock = fat->getNextBlock(currentBlock);
-
-        // go through dmap and fat chain and set them all to unused/free
-        while (nextBlock != FAT_EOF)
+        else if (ret == 0)
         {
-            fat->freeBlock(currentBlock);
-            dMap->setBlockState(nextBlock, false);
-            currentBlock = nextBlock;
-            nextBlock = fat->getNextBlock(currentBlock);
+            // a FAT chain has no holes, the new blocks are preallocated and read as zeros until they are written
+            ret = preallocate(file, file->stat.st_size, newSize, false, fileInfo);
         }
-
-        if (blockCount == 0)
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+    else
+    {
+        dropDelayedBlocks(file, blockCount > file->blockCount ? blockCount - file->blockCount : 0);
+        if (blockCount < map->getBlockCount())
+        {
+            map->truncate(blockCount);
+            if (map->persist() != 0)
+            {
+                return -EIO;
+            }
+        }
+        if (blockCount < file->blockCount)
         {
-            // If the file was truncated to zero the starting block wasn't freed yet
-            dMap->setBlockState(file->firstBlock, false);
-            file->firstBlock = -1;
+            file->blockCount = blockCount;
+            if (file->unwrittenBlock > blockCount)
+            {
+                file->unwrittenBlock = 0;
+            }
         }
-        file->stat.st_blocks = blockCount;
     }
 
     // determine metadata
@@ -644,44 +963,188 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_i
     file->stat.st_mtime = time(nullptr);
     file->stat.st_ctime = time(nullptr);
 
+    // the blocks prefetched by the handles of this file may have been freed
+    for (int i = 0; i < NUM_OPEN_FILES; i++)
+    {
+        if (openFiles[i] != nullptr && openFiles[i]->file == file)
+        {
+            openFiles[i]->readaheadEnd = 0;
+        }
+    }
+
     // persist changes
     this->dMap->persist();
-    fat->persist();
+    if (fat != nullptr)
+    {
+        fat->persist();
+    }
     this->rootDir->persist(file);
 
+    // wait for the DMap and FAT writes
+    if (blockCache->waitForCompletion() != 0)
+    {
+        return -EIO;
+    }
+
     RETURN(0);
 }
 
+/// @brief Allocate or deallocate space of a file.
+///
+/// Without flags, the blocks up to the end of the range are allocated as one run behind the last block of the file and
+/// the file grows to the end of the range. The new blocks are marked as unwritten, they read as zeros until data is
+/// written to them, and writing to them needs no allocation. Holes inside the range get zeroed data blocks.
+/// FALLOC_FL_KEEP_SIZE keeps the size of the file.
+/// FALLOC_FL_PUNCH_HOLE (together with FALLOC_FL_KEEP_SIZE) makes the range read as zeros. With extents, the blocks
+/// covered completely become a hole and only the partially covered ones are zeroed. With a FAT chain, the blocks of the
+/// range that reach up to the end of the file become unwritten again, the preallocated blocks behind the end are freed,
+/// and the rest of the range is overwritten with zeros.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] mode 0 or a combination of FALLOC_FL_KEEP_SIZE and FALLOC_FL_PUNCH_HOLE.
+/// \param [in] offset Start of the range in bytes.
+/// \param [in] length Length of the range in bytes.
+/// \param [in] fileInfo File handle set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo)
+{
+    LOGM();
+
+    if (openFiles[fileInfo->fh] == nullptr)
+    {
+        return -EBADF;
+    }
+    rootFile *file = openFiles[fileInfo->fh]->file;
+
+    if (offset < 0 || length <= 0)
+    {
+        return -EINVAL;
+    }
+    if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) != 0 || mode == FALLOC_FL_PUNCH_HOLE)
+    {
+        return -EOPNOTSUPP;
+    }
+
+    // the data waiting for allocation gets its blocks first, so that all blocks of the file are mapped
+    int ret = flushDelayedBlocks(file);
+    if (ret == 0)
+    {
+        if (mode & FALLOC_FL_PUNCH_HOLE)
+        {
+            ret = punchHole(file, offset, length, fileInfo);
+        }
+        else
+        {
+            ret = preallocate(file, offset, offset + length, (mode & FALLOC_FL_KEEP_SIZE) != 0, fileInfo);
+        }
+    }
+    if (ret == 0)
+    {
+        file->stat.st_ctime = time(nullptr);
+    }
+
+    // persist changes, a call failing with ENOSPC may have filled some of the holes already
+    this->dMap->persist();
+    if (fat != nullptr)
+    {
+        fat->persist();
+    }
+    this->rootDir->persist(file);
+
+    // wait for the DMap and FAT writes
+    if (blockCache->waitForCompletion() != 0)
+    {
+        return -EIO;
+    }
+
+    RETURN(ret);
+}
+
 /// @brief Read a directory.
 ///
-/// Read the content of the (only) directory.
+/// Read the content of a directory.
 /// You do not have to check file permissions, but can assume that it is always ok to access the directory.
-/// \param [in] path Path of the directory. Should be "/" in our case.
+/// \param [in] path Path of the directory, starting with "/".
 /// \param [out] buf A buffer for storing the directory entries.
 /// \param [in] filler A function for putting entries into the buffer.
-/// \param [in] offset Can be ignored.
+/// \param [in] offset Offset passed with the last entry of the previous call, 0 for the first call.
 /// \param [in] fileInfo Can be ignored.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo)
 {
     LOGM();
 
-    // Dir self reference
-    filler(buf, ".", NULL, 0);
-    // Reference to parent directory
-    filler(buf, "..", NULL, 0);
+    // the directory is found by its inode, the root directory has none
+    uint32_t dir = ROOT_DIR_BLOCK;
+    if (strcmp(path, "/") != 0)
+    {
+        rootFile *file = nullptr;
+        int ret = rootDir->findFile(path, &file);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        if (!S_ISDIR(file->stat.st_mode))
+        {
+            return -ENOTDIR;
+        }
+        dir = file->rootDirBlock;
+    }
+
+    // the entries are passed with the offset of the next one, so that a listing that does not fit into the buffer
+    // continues behind the last entry it got. The entries of the directory follow in the order of their keys.
+    if (offset < 1 && filler(buf, ".", NULL, 1) != 0) // Dir self reference
+    {
+        RETURN(0);
+    }
+    if (offset < 2 && filler(buf, "..", NULL, 2) != 0) // Reference to parent directory
+    {
+        RETURN(0);
+    }
 
-    // Since we only have one root directory we do not have to check for a directory
-    rootFile **files = rootDir->getFiles();
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++)
+    uint64_t key = offset < 3 ? 0 : (uint64_t)offset - 3;
+    std::string name;
+    int ret;
+    while ((ret = rootDir->getNextEntry(dir, key, &key, &name)) == 0)
     {
-        if (files[i] != nullptr)
+        key++;
+        if (filler(buf, name.c_str(), NULL, (off_t)(key + 3)) != 0)
         {
-            struct stat s = {};
-            fuseGetattr(files[i]->name, &s);
-            filler(buf, files[i]->name, &s, 0);
+            break;
         }
     }
+    if (ret != 0 && ret != -ENOENT)
+    {
+        return ret;
+    }
+    RETURN(0);
+}
+
+/// @brief Open a directory.
+///
+/// Only checks that the directory exists, the entries are read by fuseReaddir.
+/// \param [in] path Name of the directory, starting with "/".
+/// \param [in] fileInfo Can be ignored.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseOpendir(const char *path, struct fuse_file_info *fileInfo)
+{
+    LOGM();
+
+    if (strcmp(path, "/") == 0)
+    {
+        RETURN(0);
+    }
+
+    rootFile *dir = nullptr;
+    int ret = rootDir->findFile(path, &dir);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    if (!S_ISDIR(dir->stat.st_mode))
+    {
+        return -ENOTDIR;
+    }
+
     RETURN(0);
 }
 
@@ -709,40 +1172,14 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn)
 
         LOGF("Container file name: %s", ((MyFsInfo *)fuse_get_context()->private_data)->contFile);
 
-        int ret = this->blockDevice->open(((MyFsInfo *)fuse_get_context()->private_data)->contFile);
-
-        // Init the open files array
-        for (int i = 0; i < NUM_OPEN_FILES; i++)
-        {
-            openFiles[i] = nullptr;
-        }
-
-        if (ret >= 0)
-        {
-            LOG("Container file does exist, reading");
-
-            dMap->initDMap();
-            fat->initFAT();
-            rootDir->initRootDir();
-        }
-        else if (ret == -ENOENT)
-        {
-            LOG("Container file does not exist, creating a new one");
-
-            ret = this->blockDevice->create(((MyFsInfo *)fuse_get_context()->private_data)->contFile);
-
-            if (ret >= 0)
-            {
-
-                dMap->initialInitDMap();
-                fat->initialInitFAT();
-                rootDir->initialInitRootDir();
-            }
-        }
+        int ret = openContainer(((MyFsInfo *)fuse_get_context()->private_data)->contFile);
 
         if (ret < 0)
         {
             LOGF("ERROR: Access to container file failed with error %d", ret);
+
+            // without a geometry there is nothing that could be served
+            fuse_exit((struct fuse *)fuse_get_context()->fuse);
         }
     }
 
@@ -755,170 +1192,1160 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn)
 void MyOnDiskFS::fuseDestroy()
 {
     LOGM();
+
+    // the container file has never been opened
+    if (blockCache == nullptr)
+    {
+        return;
+    }
+
+    LOGF("Block cache: %llu hits, %llu misses", (unsigned long long)blockCache->getHits(),
+         (unsigned long long)blockCache->getMisses());
+
+    // give the data still waiting for data blocks its blocks
+    if (flushAllDelayedBlocks() != 0)
+    {
+        LOG("ERROR: Writing the data waiting for allocation failed");
+    }
+
+    // write back the dirty blocks and stop the flusher
+    if (blockCache->setWriteBack(false) != 0)
+    {
+        LOG("ERROR: Writing back the block cache failed");
+    }
+
+    // flush and unmap the container file
+    this->blockDevice->close();
+
+    if (this->logFile != NULL)
+    {
+        fprintf(this->logFile, "I/O statistics:\n");
+        this->blockDevice->getStats()->dump(this->logFile);
+    }
 }
 
 // You may add your own additional methods here!
 
 /// @param [*blocks] is an array of blocks with data
 /// @param [blockCount] how many blocks are in *blocks
+/// @param [offset] where to start writing inside the first block
 /// @param [size] how many bytes do we need to write
 /// @brief Helper method to write a file on disk
+///
+/// Blocks that are completely overwritten are taken straight from buf, only a partially covered first and last block
+/// are assembled in the bounce buffer. All blocks are handed to the block cache at once, which passes them on to the
+/// block device so that runs of adjacent blocks are written with a single syscall.
 /// @return 0 on success, -1 on failure
 int MyOnDiskFS::writeFile(int *blocks, int blockCount, int offset, size_t size, const char *buf, openFile *file)
 {
+    if (blockDevice->isMapped())
+    {
+        return copyMappedFile(blocks, blockCount, offset, size, const_cast<char *>(buf), true);
+    }
+
+    uint32_t *blockNos = new uint32_t[blockCount];
+    char **buffers = new char *[blockCount];
+
+    // partially covered blocks keep the rest of their content and have to be read first
+    uint32_t readBlockNos[2];
+    char *readBuffers[2];
+    int readCount = 0;
 
-    // write all blocks given by the counter
     for (int i = 0; i < blockCount; i++)
     {
-        memset(buffer, 0, BLOCK_SIZE);
+        blockNos[i] = dataOffset + blocks[i];
 
-        // grab the already present data inside the block into the buffer
-        if (i == 0 && file->writeCacheBlock == ((int32_t)blocks[i]))
-        {
-            memcpy(buffer, file->writeCache, BLOCK_SIZE);
-        }
-        else
+        // position of the block's first byte relative to buf
+        long bufOffset = (long)i * blockSize - offset;
+
+        if (bufOffset >= 0 && bufOffset + blockSize <= (long)size)
         {
-            blockDevice->read(DATA_OFFSET + blocks[i], buffer);
+            buffers[i] = const_cast<char *>(buf + bufOffset);
+            continue;
         }
 
-        size_t bufOffset = i * BLOCK_SIZE;
-        size_t tempSize;
+        // first and last block use their own half of the bounce buffer
+        buffers[i] = (i == 0) ? buffer : buffer + blockSize;
 
-        // First block
-        if (i == 0)
-        {
-            // if there's enough space in this block for the data
-            if ((size_t)(offset + size) < (size_t)(BLOCK_SIZE))
-            {
-                tempSize = size;
-            }
-            else
-            {
-                tempSize = BLOCK_SIZE - offset;
-            }
-            // remaining space in this block
-            memcpy(buffer + offset, buf, tempSize);
+        // grab the already present data inside the block into the buffer
+        readBlockNos[readCount] = blockNos[i];
+        readBuffers[readCount] = buffers[i];
+        readCount++;
+    }
 
-            // Other blocks
-        }
-        else
+    int ret = blockCache->readBlocks(readBlockNos, readCount, readBuffers);
+
+    if (ret == 0)
+    {
+        // copy the new data over the partially covered blocks
+        if (buffers[0] == buffer)
         {
-            // if remaining data is smaller than block_size
-            if (size < BLOCK_SIZE)
-            {
-                tempSize = size;
-            }
-            else
-            {
-                tempSize = BLOCK_SIZE;
-            }
-            memcpy(buffer, buf + bufOffset, tempSize);
+            size_t firstSize = std::min(size, (size_t)(blockSize - offset));
+            memcpy(buffer + offset, buf, firstSize);
         }
-
-        // Store new size
-        size -= tempSize;
-
-        // last block
-        if (i == blockCount - 1)
+        if (blockCount > 1 && buffers[blockCount - 1] == buffer + blockSize)
         {
-            // Caching last written block
-            file->writeCacheBlock = blocks[i];
-            memcpy(file->writeCache, buffer, BLOCK_SIZE);
+            size_t bufOffset = (size_t)(blockCount - 1) * blockSize - offset;
+            memcpy(buffer + blockSize, buf + bufOffset, size - bufOffset);
         }
 
-        blockDevice->write(blocks[i] + DATA_OFFSET, buffer);
+        // only queue the writes, they complete together with the metadata writes in fuseWrite
+        ret = blockCache->submitWriteBlocks(blockNos, blockCount, buffers);
     }
 
-    return 0;
+    delete[] blockNos;
+    delete[] buffers;
+
+    return ret == 0 ? 0 : -1;
 }
 
 /// @brief Helper method to read a file from disk
+///
+/// Blocks that are completely requested are read straight into buf, only a partially covered first and last block
+/// go through the bounce buffer. All blocks are handed to the block cache at once, the blocks it does not hold are read
+/// from the block device together so that runs of adjacent blocks are read with a single syscall.
 /// @return 0 on success, -1 on failure
 int MyOnDiskFS::readFile(int *blocks, int blockCount, int offset, size_t size, char *buf, openFile *openFile)
 {
+    if (blockDevice->isMapped())
+    {
+        return copyMappedFile(blocks, blockCount, offset, size, buf, false);
+    }
+
+    uint32_t *blockNos = new uint32_t[blockCount];
+    char **buffers = new char *[blockCount];
+    int readCount = 0;
+    char *firstTarget = nullptr;
+    char *lastTarget = nullptr;
 
-    // Read all blocks given by the block counter
     for (int i = 0; i < blockCount; i++)
     {
+        // position of the block's first byte relative to buf
+        long bufOffset = (long)i * blockSize - offset;
 
-        // make sure the buffer is not filled with old stuff
-        memset(buffer, 0, BLOCK_SIZE);
-
-        // is the data that needs to be read available in cache?
-        if (i == 0 && openFile->readCacheBlock == ((int)blocks[0]))
+        char *target;
+        if (bufOffset >= 0 && bufOffset + blockSize <= (long)size)
         {
-            memcpy(buffer, openFile->readCache, BLOCK_SIZE);
+            target = buf + bufOffset;
         }
         else
         {
-            blockDevice->read(DATA_OFFSET + blocks[i], buffer);
+            // first and last block use their own half of the bounce buffer
+            target = (i == 0) ? buffer : buffer + blockSize;
         }
+        firstTarget = (i == 0) ? target : firstTarget;
+        lastTarget = target;
 
-        size_t bufferOffset = i * BLOCK_SIZE;
-        size_t temporarySize;
-        // first block
-        if (i == 0)
+        // a block in a hole has no data block and reads as zeros
+        if (blocks[i] < 0)
         {
-            // does blocks[0] fit in current block?
-            if ((size_t)(offset + size) < (size_t)(BLOCK_SIZE - offset))
-            {
-                temporarySize = size;
-            }
-            else
-            {
-                temporarySize = BLOCK_SIZE - offset;
-            }
+            memset(target, 0, blockSize);
+            continue;
+        }
+
+        blockNos[readCount] = dataOffset + blocks[i];
+        buffers[readCount] = target;
+        readCount++;
+    }
+
+    int ret = readCount == 0 ? 0 : blockCache->readBlocks(blockNos, readCount, buffers);
+
+    delete[] blockNos;
+    delete[] buffers;
+
+    // if the file could not be read correctly return error
+    if (ret != 0)
+    {
+        return -1;
+    }
+
+    // copy the requested parts of the partially covered blocks
+    if (firstTarget == buffer)
+    {
+        size_t firstSize = std::min(size, (size_t)(blockSize - offset));
+        memcpy(buf, buffer + offset, firstSize);
+    }
+    if (blockCount > 1 && lastTarget == buffer + blockSize)
+    {
+        size_t bufOffset = (size_t)(blockCount - 1) * blockSize - offset;
+        memcpy(buf + bufOffset, buffer + blockSize, size - bufOffset);
+    }
+
+    return 0;
+}
+
+/// @brief Prefetch the blocks following a sequential read
+///
+/// A read that starts where the previous read of the handle ended continues a sequential stream. Once less than half
+/// a window of prefetched blocks is left ahead of the reader, the next window is queued in the block cache and the
+/// window doubles, up to READAHEAD_MAX_BLOCKS. Any other read resets the window.
+/// @param [lastIndex] index of the last block of the read inside the file
+void MyOnDiskFS::readahead(openFile *handle, off_t offset, size_t size, int lastIndex)
+{
+    bool isSequential = offset == handle->nextReadOffset;
+    handle->nextReadOffset = offset + size;
+
+    if (!isSequential)
+    {
+        handle->readaheadWindow = 0;
+        handle->readaheadEnd = 0;
+        return;
+    }
+
+    // a mapped container file is read straight from memory
+    if (blockDevice->isMapped())
+    {
+        return;
+    }
+
+    // enough blocks are queued ahead of the reader
+    if (handle->readaheadEnd - (lastIndex + 1) > handle->readaheadWindow / 2)
+    {
+        return;
+    }
+
+    // the window keeps at least two requests of the reader in flight
+    int requestBlocks = (int)((size + blockSize - 1) / blockSize);
+    int window = std::max(2 * handle->readaheadWindow, 2 * requestBlocks);
+    handle->readaheadWindow = std::min(std::max(window, READAHEAD_MIN_BLOCKS), READAHEAD_MAX_BLOCKS);
 
-            memcpy(buf, buffer + offset, size);
+    int start = std::max(handle->readaheadEnd, lastIndex + 1);
+    int end = std::min(start + handle->readaheadWindow, (int)handle->file->blockCount);
+    if (start >= end)
+    {
+        return;
+    }
 
-            // remaining blocks
+    // the map of the file has been loaded by the read
+    int count = end - start;
+    int *blocks = new int[count];
+    uint32_t *blockNos = new uint32_t[count];
+    int prefetchCount = 0;
+    if (getFileMap(handle->file)->getBlocks(start, count, blocks) != 0)
+    {
+        count = 0;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        // there is nothing to read for the blocks in a hole
+        if (blocks[i] >= 0)
+        {
+            blockNos[prefetchCount++] = dataOffset + blocks[i];
         }
-        else
+    }
+    delete[] blocks;
+
+    // the reads complete in the background, a failed readahead is not an error of this read
+    blockCache->prefetch(blockNos, prefetchCount);
+    delete[] blockNos;
+
+    handle->readaheadEnd = end;
+}
+
+/// @brief Set the access time of a file that has been read and write its metadata
+///
+/// With noatime nothing is written. With relatime the access time is only written if it is not newer than the last
+/// change of the file or older than RELATIME_INTERVAL, so that repeated reads of a file cost no metadata writes.
+void MyOnDiskFS::updateAccessTime(rootFile *file)
+{
+    time_t now = time(nullptr);
+    if (this->noAtime || (this->relAtime && file->stat.st_atime > file->stat.st_mtime &&
+                          file->stat.st_atime > file->stat.st_ctime &&
+                          now - file->stat.st_atime < RELATIME_INTERVAL))
+    {
+        return;
+    }
+
+    file->stat.st_atime = now;
+    this->rootDir->persist(file); //Update the a_time in the rootDir
+}
+
+/// @brief Helper method to copy a file straight between the mapped container file and buf
+/// @param [isWrite] copy from buf into the blocks if set, from the blocks into buf otherwise
+/// @return 0 on success, -1 on failure
+int MyOnDiskFS::copyMappedFile(int *blocks, int blockCount, int offset, size_t size, char *buf, bool isWrite)
+{
+    size_t copied = 0;
+    for (int i = 0; i < blockCount; i++)
+    {
+        // only the first block may start in the middle
+        size_t blockOffset = (i == 0) ? offset : 0;
+        size_t copySize = std::min(size - copied, (size_t)blockSize - blockOffset);
+
+        // a block in a hole has no data block and reads as zeros
+        if (blocks[i] < 0 && !isWrite)
         {
-            // if remaining data fits in one block
-            if (size < BLOCK_SIZE)
-            {
-                temporarySize = size;
-            }
-            else
-            {
-                temporarySize = BLOCK_SIZE;
-            }
-            memcpy(buf + bufferOffset, buffer, temporarySize);
+            memset(buf + copied, 0, copySize);
+            copied += copySize;
+            continue;
         }
-        // update the remaining bytes to read
-        size -= temporarySize;
 
-        // last block
-        if (i == blockCount - 1)
+        char *block = blockDevice->getBlockPointer(dataOffset + blocks[i]);
+        if (block == nullptr)
         {
-            // and store it in cache
-            openFile->readCacheBlock = blocks[i];
-            memcpy(openFile->readCache, buffer, BLOCK_SIZE);
+            return -1;
         }
-    }
 
-    // if the file could not be read correctly and the size is not set to 0 return error
-    if (size != 0)
-    {
-        return -1;
+        if (isWrite)
+        {
+            memcpy(block + blockOffset, buf + copied, copySize);
+            blockDevice->markDirty(dataOffset + blocks[i], 1);
+        }
+        else
+        {
+            memcpy(buf + copied, block + blockOffset, copySize);
+        }
+        copied += copySize;
     }
 
     return 0;
 }
 
-/// @brief return the next index to track opened files
-int MyOnDiskFS::getNextFreeIndexOpenFiles()
+/// @brief Read the container file or create a new one and set up the file system on it
+///
+/// This is the part of fuseInit() that needs no FUSE context. A new container gets the geometry of the mount options.
+/// @param [path] path of the container file
+/// @return 0 on success, -ERRNO on failure
+int MyOnDiskFS::openContainer(const char *path)
 {
+    // Init the open files array
     for (int i = 0; i < NUM_OPEN_FILES; i++)
     {
-        if (openFiles[i] == nullptr)
-        {
-            return i;
-        }
+        openFiles[i] = nullptr;
     }
-    return -1;
+
+    // the superblock tells how the rest of the container has to be read
+    int ret = this->superBlock.load(path);
+
+    if (ret >= 0)
+    {
+        LOG("Container file does exist, reading");
+
+        if (this->superBlock.isLegacyLayout())
+        {
+            LOG("Container file has no superblock, using the default geometry");
+        }
+        if (this->options.blockSize > 0 || this->options.fsSize > 0 || this->options.dirEntries > 0 ||
+            this->options.useExtents)
+        {
+            LOG("WARNING: The geometry and format options only apply to new container files");
+        }
+
+        ret = setUpContainer(path, false);
+    }
+    else if (ret == -ENOENT)
+    {
+        LOG("Container file does not exist, creating a new one");
+
+        // the size is given in MiB, options that are not set select the default geometry
+        uint32_t newBlockSize = this->options.blockSize > 0 ? this->options.blockSize : BLOCK_SIZE;
+        uint64_t dataBlocks = DATA_BLOCKS;
+        if (this->options.fsSize > 0)
+        {
+            dataBlocks = (uint64_t)this->options.fsSize * 1024 * 1024 / newBlockSize;
+        }
+        uint32_t dirEntries = this->options.dirEntries > 0 ? this->options.dirEntries : NUM_DIR_ENTRIES;
+
+        ret = -EINVAL;
+        if (dataBlocks <= SB_MAX_BLOCKS)
+        {
+            ret = this->superBlock.format(newBlockSize, (uint32_t)dataBlocks, dirEntries,
+                                          SB_FEATURE_DIR_TREE | SB_FEATURE_INODE_TABLE |
+                                          (this->options.useExtents ? SB_FEATURE_EXTENTS : 0));
+        }
+
+        if (ret < 0)
+        {
+            LOGF("ERROR: Unsupported geometry: block size %u, %llu data blocks, %u directory entries",
+                 newBlockSize, (unsigned long long)dataBlocks, dirEntries);
+        }
+        else
+        {
+            ret = setUpContainer(path, true);
+        }
+    }
+    else if (ret == -EINVAL)
+    {
+        LOG("ERROR: The superblock of the container file is damaged");
+    }
+
+    return ret;
+}
+
+/// @brief Open or create the container file with the geometry of the superblock
+///
+/// Creates the block device, the block cache and the DMap, FAT and RootDir sized from the superblock. A new container
+/// is formatted, the regions of an existing one are loaded.
+/// @param [path] path of the container file
+/// @param [create] true to create and format a new container file
+/// @return 0 on success, -ERRNO on failure
+int MyOnDiskFS::setUpContainer(const char *path, bool create)
+{
+    this->blockSize = superBlock.getBlockSize();
+    this->dataOffset = superBlock.getDataOffset();
+    LOGF("Container geometry: block size %u, %u data blocks, %u directory entries", blockSize,
+         superBlock.getDataBlocks(), superBlock.getDirEntries());
+
+    this->blockDevice = new BlockDevice(blockSize);
+    this->blockCache = new BlockCache(blockDevice, blockSize);
+
+    // count the I/O per region of the container
+    static const char *regionNames[] = {"super", "dmap", "fat", "rootdir", "data"};
+    uint32_t regionStarts[] = {SUPERBLOCK_BLOCK, superBlock.getDMapOffset(), superBlock.getFATOffset(),
+                               superBlock.getRootDirOffset(), dataOffset};
+    this->blockDevice->getStats()->setRegions(regionNames, regionStarts, 5);
+
+    int ret = create ? this->blockDevice->create(path) : this->blockDevice->open(path);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    applyMountOptions();
+
+    buffer = new char[2 * blockSize];                //For partially written/read first and last blocks
+    dMap = new DMap(blockCache, &superBlock);       //checks if a block if free or used
+    rootDir = new RootDir(blockCache, &superBlock, dMap); //Metadata for files
+
+    // the files are either mapped by extent trees or by chains in the FAT
+    if (superBlock.hasExtents())
+    {
+        LOG("Files are mapped by extents");
+    }
+    else
+    {
+        fat = new FAT(blockCache, &superBlock); //Location of next block
+    }
+
+    if (create)
+    {
+        // the superblock is written last, it announces the directory tree that gets its root here
+        dMap->initialInitDMap();
+        if (fat != nullptr)
+        {
+            fat->initialInitFAT();
+        }
+        ret = rootDir->initialInitRootDir();
+        if (ret == 0)
+        {
+            dMap->persist();
+            ret = blockCache->waitForCompletion() == 0 ? 0 : -EIO;
+        }
+        if (ret == 0)
+        {
+            ret = superBlock.persist(blockCache);
+        }
+    }
+    else
+    {
+        dMap->initDMap();
+        if (fat != nullptr)
+        {
+            fat->initFAT();
+        }
+
+        // older containers only have the RootDir region, their files are added to a new directory tree
+        bool hasDirTree = superBlock.hasDirTree();
+        ret = rootDir->initRootDir();
+        if (ret != 0)
+        {
+            LOG("ERROR: The directory of the container file cannot be read");
+            return ret;
+        }
+        if (!hasDirTree)
+        {
+            LOG("Indexing the files of the RootDir region in a directory tree");
+        }
+
+        // older containers store one byte per block in the DMap, move it to the bitmap before the superblock
+        // announces the new format
+        if (superBlock.hasByteDMap())
+        {
+            LOG("Converting the DMap to a bitmap");
+            superBlock.upgrade();
+            dMap->convert(&superBlock);
+            ret = blockCache->waitForCompletion();
+            if (ret == 0)
+            {
+                ret = superBlock.persist(blockCache);
+            }
+            if (ret == 0)
+            {
+                ret = blockCache->sync();
+            }
+        }
+        else if (!hasDirTree)
+        {
+            // the nodes of the tree have to be marked in the DMap before the superblock points to them
+            dMap->persist();
+            ret = blockCache->waitForCompletion() == 0 ? 0 : -EIO;
+            if (ret == 0)
+            {
+                ret = superBlock.persist(blockCache);
+            }
+            if (ret == 0)
+            {
+                ret = blockCache->sync();
+            }
+        }
+    }
+
+    return ret;
+}
+
+/// @brief Set up the container access requested by the mount options
+void MyOnDiskFS::applyMountOptions()
+{
+    // the size is given in MiB, a negative size selects the default
+    uint32_t cacheSize = this->options.cacheSize < 0 ? BC_DEFAULT_SIZE_MB : this->options.cacheSize;
+    this->blockCache->setCapacity(cacheSize * (1024 * 1024 / blockSize));
+    LOGF("Block cache size: %u MiB", cacheSize);
+
+    if (this->options.useDirectIO)
+    {
+        int ret = this->blockDevice->setDirectIO(true);
+        if (ret < 0)
+        {
+            LOGF("WARNING: O_DIRECT is not supported for the container file (error %d), using buffered I/O", ret);
+        }
+        else
+        {
+            LOG("Container file is accessed with O_DIRECT");
+        }
+    }
+
+    if (this->options.useMmap)
+    {
+        int ret = this->blockDevice->map(superBlock.getTotalBlocks());
+        if (ret < 0)
+        {
+            LOGF("WARNING: Mapping the container file failed with error %d, using regular I/O", ret);
+        }
+        else
+        {
+            LOG("Container file is mapped into memory");
+        }
+    }
+
+    // noatime takes precedence if both are given
+    this->noAtime = this->options.noAtime != 0;
+    this->relAtime = this->options.relAtime != 0 && !this->noAtime;
+    if (this->noAtime)
+    {
+        LOG("Access times are not updated by reads");
+    }
+    else if (this->relAtime)
+    {
+        LOG("Access times are updated by reads once after a change or once a day");
+    }
+
+    if (this->options.useWriteBack)
+    {
+        if (this->blockDevice->isMapped())
+        {
+            LOG("WARNING: Write-back caching is not used for a mapped container file");
+        }
+        else if (this->blockCache->setWriteBack(true) < 0)
+        {
+            LOG("WARNING: Write-back caching requires the block cache, using write-through");
+        }
+        else
+        {
+            LOG("Block cache is in write-back mode");
+        }
+    }
+}
+
+/// @brief return the next index to track opened files
+int MyOnDiskFS::getNextFreeIndexOpenFiles()
+{
+    for (int i = 0; i < NUM_OPEN_FILES; i++)
+    {
+        if (openFiles[i] == nullptr)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/// @brief Return the map of a file, it is created on the first access and shared by all handles of the file
+///
+/// The map points to the metadata of the file, which is pinned as long as the map exists.
+/// @return nullptr if the extent tree of the file is damaged
+FileMap *MyOnDiskFS::getFileMap(rootFile *file)
+{
+    FileMap *&map = fileMaps[file->rootDirBlock];
+    if (map == nullptr)
+    {
+        rootDir->pinFile(file);
+        if (fat != nullptr)
+        {
+            map = new BlockIndex(fat, dMap, file);
+        }
+        else
+        {
+            map = new ExtentTree(blockCache, dMap, &superBlock, file);
+        }
+        if (map->load() != 0)
+        {
+            LOGF("ERROR: The extent tree of %s is damaged", file->name);
+            delete map;
+            fileMaps.erase(file->rootDirBlock);
+            rootDir->unpinFile(file);
+            return nullptr;
+        }
+    }
+    return map;
+}
+
+/// @brief Check whether the file has a handle that has not been released yet
+bool MyOnDiskFS::isFileOpen(rootFile *file)
+{
+    for (int i = 0; i < NUM_OPEN_FILES; i++)
+    {
+        if (openFiles[i] != nullptr && openFiles[i]->file == file)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Free all blocks of a file that is deleted and drop its map
+///
+/// The data waiting for allocation is dropped together with its reservation. The metadata of the file is left to the
+/// caller, the pin of the map is dropped.
+/// @return 0 on success, -EIO if the extent tree of the file is damaged
+int MyOnDiskFS::freeFileBlocks(rootFile *file)
+{
+    FileMap *map = getFileMap(file);
+    if (map == nullptr)
+    {
+        return -EIO;
+    }
+    dropDelayedBlocks(file, 0);
+    map->truncate(0);
+    map->persist();
+    delete map;
+    fileMaps.erase(file->rootDirBlock);
+    delayedData.erase(file->rootDirBlock);
+    rootDir->unpinFile(file);
+    return 0;
+}
+
+/// @brief Drop the map of a file once it is neither open nor holds data waiting for allocation
+///
+/// The metadata of the file may then be dropped from the cache of the RootDir.
+void MyOnDiskFS::releaseFileMap(rootFile *file)
+{
+    auto map = fileMaps.find(file->rootDirBlock);
+    auto delayed = delayedData.find(file->rootDirBlock);
+    if (map == fileMaps.end() || rootDir->getPinCount(file) > 1 ||
+        (delayed != delayedData.end() && !delayed->second.empty()))
+    {
+        return;
+    }
+    delete map->second;
+    fileMaps.erase(map);
+    if (delayed != delayedData.end())
+    {
+        delayedData.erase(delayed);
+    }
+    rootDir->unpinFile(file);
+}
+
+/// @brief Give the data of a file that waits for allocation its data blocks and write it
+///
+/// The reserved space is allocated at once behind the last block of the file, so the data usually becomes a single run
+/// continuing the file. The data is dropped from memory once it has been written.
+/// @return 0 on success, -ENOSPC if the map of the file needs a block and there is none left, -EIO on write errors
+int MyOnDiskFS::flushDelayedBlocks(rootFile *file)
+{
+    auto entry = delayedData.find(file->rootDirBlock);
+    if (entry == delayedData.end() || entry->second.size() < blockSize)
+    {
+        releaseNodeBlocks(file);
+        return 0;
+    }
+    std::vector<char> &delayed = entry->second;
+    int count = delayed.size() / blockSize;
+
+    FileMap *map = getFileMap(file);
+    if (map == nullptr)
+    {
+        return -EIO;
+    }
+
+    // the reservation turns into data blocks
+    dMap->releaseBlocks(count);
+    int *blocks = dMap->getXAmountOfFreeBlocks(count, map->getGoal());
+    if (blocks == nullptr)
+    {
+        dMap->reserveBlocks(count);
+        return -ENOSPC;
+    }
+    map->map(file->blockCount, blocks, count);
+
+    // the new nodes of an extent tree take the blocks reserved for them, keep the data waiting if they do not suffice
+    releaseNodeBlocks(file);
+    if (map->persist() != 0)
+    {
+        map->truncate(file->blockCount);
+        map->persist();
+        dMap->reserveBlocks(count);
+        reserveNodeBlocks(file, map, count);
+        delete[] blocks;
+        return -ENOSPC;
+    }
+    file->blockCount += count;
+
+    int err = writeFile(blocks, count, 0, delayed.size(), delayed.data(), nullptr);
+    delete[] blocks;
+
+    // persist the changes, the metadata writes are in flight together with the data writes
+    dMap->persist();
+    if (fat != nullptr)
+    {
+        fat->persist();
+    }
+    rootDir->persist(file);
+
+    // the data may only be dropped after it has reached the container
+    if (blockCache->waitForCompletion() != 0)
+    {
+        err = -1;
+    }
+    delayedBlockCount -= count;
+    std::vector<char>().swap(delayed);
+
+    return err == 0 ? 0 : -EIO;
+}
+
+/// @brief Give the data of all files that waits for allocation its data blocks
+/// @return 0 on success, the first error of flushDelayedBlocks() otherwise
+int MyOnDiskFS::flushAllDelayedBlocks()
+{
+    // the files are collected first, a file that is not open drops its entry once its data is written
+    std::vector<int> blocks;
+    for (auto &delayed : delayedData)
+    {
+        if (!delayed.second.empty())
+        {
+            blocks.push_back(delayed.first);
+        }
+    }
+
+    int ret = 0;
+    for (int block : blocks)
+    {
+        rootFile *file = rootDir->getFileByBlock(block);
+        int err = file == nullptr ? -EIO : flushDelayedBlocks(file);
+        if (file != nullptr)
+        {
+            releaseFileMap(file);
+        }
+        ret = ret == 0 ? err : ret;
+    }
+    return ret;
+}
+
+/// @brief Shorten the data of a file that waits for allocation to the given number of blocks
+///
+/// The reservation of the dropped blocks is released.
+void MyOnDiskFS::dropDelayedBlocks(rootFile *file, uint32_t count)
+{
+    auto delayed = delayedData.find(file->rootDirBlock);
+    uint32_t delayedCount = delayed == delayedData.end() ? 0 : delayed->second.size() / blockSize;
+    if (count == 0)
+    {
+        releaseNodeBlocks(file);
+    }
+    if (count >= delayedCount)
+    {
+        return;
+    }
+    dMap->releaseBlocks(delayedCount - count);
+    delayedBlockCount -= delayedCount - count;
+    delayed->second.resize((size_t)count * blockSize);
+}
+
+/// @brief Reserve the blocks the map of a file may need for its nodes once the data waiting for allocation gets its
+/// data blocks
+///
+/// The reservation of a file only grows, it is released when the data is flushed or dropped completely.
+/// @param [count] number of blocks of the file waiting for allocation
+/// @return 0 on success, -ENOSPC if there are not enough free blocks
+int MyOnDiskFS::reserveNodeBlocks(rootFile *file, FileMap *map, uint32_t count)
+{
+    uint32_t needed = map->getNodeReserve(count);
+    auto entry = nodeReservations.find(file->rootDirBlock);
+    uint32_t reserved = entry == nodeReservations.end() ? 0 : entry->second;
+    if (needed <= reserved)
+    {
+        return 0;
+    }
+    if (!dMap->reserveBlocks(needed - reserved))
+    {
+        return -ENOSPC;
+    }
+    nodeReservations[file->rootDirBlock] = needed;
+    return 0;
+}
+
+/// @brief Give the blocks reserved for the map nodes of a file back
+void MyOnDiskFS::releaseNodeBlocks(rootFile *file)
+{
+    auto entry = nodeReservations.find(file->rootDirBlock);
+    if (entry != nodeReservations.end())
+    {
+        dMap->releaseBlocks(entry->second);
+        nodeReservations.erase(entry);
+    }
+}
+
+/// @brief Allocate the blocks of a file up to the given end as unwritten blocks
+///
+/// The holes of the range in front of the allocated end of the file get zeroed data blocks.
+/// @param [keepSize] keep the size of the file, otherwise it grows to end
+/// @return 0 on success, -ENOSPC if there are not enough free blocks, -EIO on write errors
+int MyOnDiskFS::preallocate(rootFile *file, off_t offset, off_t end, bool keepSize, struct fuse_file_info *fileInfo)
+{
+    FileMap *map = getFileMap(file);
+    if (map == nullptr)
+    {
+        return -EIO;
+    }
+
+    uint32_t allocatedBlocks = file->blockCount;
+    uint32_t blockCount = (end + blockSize - 1) / blockSize;
+    uint32_t holesEnd = std::min(blockCount, allocatedBlocks);
+    if (map->supportsHoles() && offset / blockSize < holesEnd)
+    {
+        int ret = mapHoles(file, offset / blockSize, holesEnd, offset, 0);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    if (blockCount > allocatedBlocks)
+    {
+        // best fit finds a single run for the blocks if there is one
+        int count = blockCount - allocatedBlocks;
+        int *blocks = dMap->getXAmountOfFreeBlocks(count, map->getGoal());
+        if (blocks == nullptr)
+        {
+            return -ENOSPC;
+        }
+        map->map(allocatedBlocks, blocks, count);
+        delete[] blocks;
+
+        // an extent tree may need a new node, give the blocks back if there is no space left for it
+        if (map->persist() != 0)
+        {
+            map->truncate(allocatedBlocks);
+            map->persist();
+            return -ENOSPC;
+        }
+
+        file->blockCount = blockCount;
+        if (file->unwrittenBlock == 0)
+        {
+            file->unwrittenBlock = allocatedBlocks + 1;
+        }
+    }
+
+    if (!keepSize && end > file->stat.st_size)
+    {
+        // the rest of the last block becomes part of the file and must not show old data
+        uint32_t lastBlock = file->stat.st_size / blockSize;
+        uint32_t unwritten = file->unwrittenBlock == 0 ? file->blockCount : file->unwrittenBlock - 1;
+        if (file->stat.st_size % blockSize != 0 && lastBlock < unwritten)
+        {
+            off_t blockEnd = (off_t)(lastBlock + 1) * blockSize;
+            if (writeZeros(file->stat.st_size, std::min(end, blockEnd) - file->stat.st_size, fileInfo) != 0)
+            {
+                return -EIO;
+            }
+        }
+        file->stat.st_size = end;
+        file->stat.st_mtime = time(nullptr);
+    }
+    return 0;
+}
+
+/// @brief Make a range of a file read as zeros
+///
+/// With extents, the blocks covered completely become a hole and the partially covered ones are zeroed. A FAT chain
+/// has no holes, there blocks are only freed behind the end of the file. Whole blocks that reach up to the end of the
+/// file are marked as unwritten, everything else is overwritten with zeros.
+/// @return 0 on success, -ERRNO on failure
+int MyOnDiskFS::punchHole(rootFile *file, off_t offset, off_t length, struct fuse_file_info *fileInfo)
+{
+    FileMap *map = getFileMap(file);
+    if (map == nullptr)
+    {
+        return -EIO;
+    }
+
+    off_t end = offset + length;
+    uint32_t firstWhole = (offset + blockSize - 1) / blockSize;  // first block covered completely
+    if (map->supportsHoles())
+    {
+        uint32_t wholeEnd = std::min((uint32_t)(end / blockSize), file->blockCount);
+        off_t zeroEnd = std::min(end, (off_t)file->stat.st_size);
+        int ret = 0;
+        if (firstWhole < wholeEnd)
+        {
+            map->unmap(firstWhole, wholeEnd - firstWhole);
+            if (map->persist() != 0)
+            {
+                return -EIO;
+            }
+
+            // the partially covered blocks in front of and behind the hole
+            off_t headEnd = std::min(zeroEnd, (off_t)firstWhole * blockSize);
+            if (headEnd > offset)
+            {
+                ret = writeZeros(offset, headEnd - offset, fileInfo);
+            }
+            off_t tailStart = (off_t)wholeEnd * blockSize;
+            if (ret == 0 && zeroEnd > tailStart)
+            {
+                ret = writeZeros(tailStart, zeroEnd - tailStart, fileInfo);
+            }
+        }
+        else if (zeroEnd > offset)
+        {
+            ret = writeZeros(offset, zeroEnd - offset, fileInfo);
+        }
+        return ret;
+    }
+
+    uint32_t sizeBlocks = (file->stat.st_size + blockSize - 1) / blockSize;  // blocks holding the data of the file
+
+    // free the preallocated blocks behind the end of the file if the hole covers them up to the last one
+    if (end >= (off_t)file->blockCount * blockSize)
+    {
+        uint32_t keep = std::max(firstWhole, sizeBlocks);
+        if (keep < file->blockCount)
+        {
+            map->truncate(keep);
+            if (map->persist() != 0)
+            {
+                return -EIO;
+            }
+            file->blockCount = keep;
+            if (file->unwrittenBlock > keep)
+            {
+                file->unwrittenBlock = 0;
+            }
+        }
+    }
+
+    if (offset >= file->stat.st_size)
+    {
+        return 0;
+    }
+
+    // the whole blocks up to the end of the file become unwritten, only the part in front of them is zeroed
+    off_t zeroEnd = std::min(end, (off_t)file->stat.st_size);
+    if (zeroEnd == file->stat.st_size && firstWhole < sizeBlocks)
+    {
+        uint32_t unwritten = file->unwrittenBlock == 0 ? file->blockCount : file->unwrittenBlock - 1;
+        if (firstWhole < unwritten)
+        {
+            file->unwrittenBlock = firstWhole + 1;
+        }
+        zeroEnd = std::min(zeroEnd, (off_t)firstWhole * blockSize);
+    }
+
+    if (zeroEnd > offset && writeZeros(offset, zeroEnd - offset, fileInfo) != 0)
+    {
+        return -EIO;
+    }
+    return 0;
+}
+
+/// @brief Overwrite a range of an open file with zeros
+/// @return 0 on success, -ERRNO on failure
+int MyOnDiskFS::writeZeros(off_t offset, off_t size, struct fuse_file_info *fileInfo)
+{
+    const size_t chunkSize = 1024 * 1024;
+    std::vector<char> zeros((size_t)std::min(size, (off_t)chunkSize), 0);
+
+    while (size > 0)
+    {
+        size_t count = (size_t)std::min(size, (off_t)chunkSize);
+        int ret = fuseWrite(nullptr, zeros.data(), count, offset, fileInfo);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        offset += count;
+        size -= count;
+    }
+    return 0;
+}
+
+/// @brief Give the blocks of a range of a file that lie in holes their data blocks
+///
+/// Every hole gets a run of data blocks continuing the block in front of it. The new blocks that the given write does
+/// not cover completely are zeroed, with a size of 0 all of them are.
+/// @param [first] index of the first block of the range inside the file
+/// @param [end] index of the block behind the range
+/// @return 0 on success, -ENOSPC if there are not enough free blocks, -EIO on write errors
+int MyOnDiskFS::mapHoles(rootFile *file, uint32_t first, uint32_t end, off_t offset, size_t size)
+{
+    FileMap *map = getFileMap(file);
+
+    // blocks covered completely by the write
+    uint32_t coveredFirst = (offset + blockSize - 1) / blockSize;
+    uint32_t coveredEnd = std::max((uint32_t)((offset + size) / blockSize), coveredFirst);
+
+    int ret = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> covered;  // new blocks left for the data of the write
+    uint32_t block = map->findBlock(first, false);
+    while (block < end && ret == 0)
+    {
+        uint32_t holeEnd = std::min(map->findBlock(block, true), end);
+        uint32_t count = holeEnd - block;
+
+        int previous = -1;
+        if (block > 0)
+        {
+            map->getBlocks(block - 1, 1, &previous);
+        }
+        int *blocks = dMap->getXAmountOfFreeBlocks(count, previous < 0 ? -1 : previous + 1);
+        if (blocks == nullptr)
+        {
+            ret = -ENOSPC;
+            break;
+        }
+        map->map(block, blocks, count);
+        delete[] blocks;
+
+        // an extent tree may need a new node, keep the hole if there is no space left for it
+        if (map->persist() != 0)
+        {
+            map->unmap(block, count);
+            map->persist();
+            ret = -ENOSPC;
+            break;
+        }
+
+        uint32_t headEnd = std::min(holeEnd, std::max(block, coveredFirst));
+        if (block < headEnd)
+        {
+            ret = zeroBlocks(map, block, headEnd - block) == 0 ? 0 : -EIO;
+        }
+        uint32_t tailStart = std::max(headEnd, std::max(block, coveredEnd));
+        if (ret == 0 && tailStart < holeEnd)
+        {
+            ret = zeroBlocks(map, tailStart, holeEnd - tailStart) == 0 ? 0 : -EIO;
+        }
+        uint32_t coveredHoleEnd = std::min(tailStart, holeEnd);
+        if (headEnd < coveredHoleEnd)
+        {
+            covered.push_back(std::make_pair(headEnd, coveredHoleEnd - headEnd));
+        }
+
+        block = map->findBlock(holeEnd, false);
+    }
+
+    // the holes filled before a failure keep their blocks, the DMap and the root of the tree have to know them. The
+    // write does not happen then, so the blocks left for its data are zeroed as well.
+    dMap->persist();
+    if (ret != 0)
+    {
+        for (size_t i = 0; i < covered.size(); i++)
+        {
+            zeroBlocks(map, covered[i].first, covered[i].second);
+        }
+        rootDir->persist(file);
+    }
+    return ret;
+}
+
+/// @brief Prepare the unwritten blocks of a file for a write
+///
+/// A write only covers whole blocks of the preallocated range if it starts right at the first unwritten block. The
+/// unwritten blocks in front of the write and the partially covered blocks are zeroed first, afterwards all blocks up
+/// to the end of the write hold data.
+/// @return 0 on success, -1 on failure
+int MyOnDiskFS::fillUnwrittenBlocks(rootFile *file, off_t offset, size_t size)
+{
+    FileMap *map = getFileMap(file);
+    uint32_t first = file->unwrittenBlock - 1;
+    uint32_t allocatedBlocks = file->blockCount;
+    uint32_t writeFirst = offset / blockSize;
+    uint32_t writeEnd = (offset + size + blockSize - 1) / blockSize;
+
+    int err = 0;
+    uint32_t gapEnd = std::min(writeFirst, allocatedBlocks);
+    if (first < gapEnd)
+    {
+        err = zeroBlocks(map, first, gapEnd - first);
+    }
+
+    // the partially covered first and last block
+    bool isFirstPartial = offset % blockSize != 0 || (off_t)(offset + size) < (off_t)(writeFirst + 1) * blockSize;
+    if (err == 0 && isFirstPartial && writeFirst >= first && writeFirst < allocatedBlocks)
+    {
+        err = zeroBlocks(map, writeFirst, 1);
+    }
+    uint32_t writeLast = writeEnd - 1;
+    if (err == 0 && writeLast != writeFirst && (offset + size) % blockSize != 0 && writeLast >= first &&
+        writeLast < allocatedBlocks)
+    {
+        err = zeroBlocks(map, writeLast, 1);
+    }
+
+    if (err == 0)
+    {
+        file->unwrittenBlock = writeEnd < allocatedBlocks ? writeEnd + 1 : 0;
+    }
+    return err;
+}
+
+/// @brief Write zeros to a range of blocks of a file and wait for the writes
+/// @return 0 on success, -1 on failure
+int MyOnDiskFS::zeroBlocks(FileMap *map, uint32_t first, uint32_t count)
+{
+    const uint32_t chunkBlocks = 256;
+    std::vector<char> zeros((size_t)std::min(count, chunkBlocks) * blockSize, 0);
+    int *blocks = new int[std::min(count, chunkBlocks)];
+
+    int err = 0;
+    while (count > 0 && err == 0)
+    {
+        uint32_t n = std::min(count, chunkBlocks);
+        err = map->getBlocks(first, n, blocks);
+
+        // the blocks in a hole read as zeros already
+        uint32_t mapped = 0;
+        for (uint32_t i = 0; i < n && err == 0; i++)
+        {
+            if (blocks[i] >= 0)
+            {
+                blocks[mapped++] = blocks[i];
+            }
+        }
+        if (err == 0 && mapped > 0)
+        {
+            err = writeFile(blocks, mapped, 0, (size_t)mapped * blockSize, zeros.data(), nullptr);
+        }
+        if (blockCache->waitForCompletion() != 0)
+        {
+            err = -1;
+        }
+        first += n;
+        count -= n;
+    }
+
+    delete[] blocks;
+    return err == 0 ? 0 : -1;
 }
 
 // DO NOT EDIT ANYTHING BELOW THIS LINE!!!
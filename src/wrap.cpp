@@ -23,6 +23,10 @@ void setInstance(int onDisk) {
     }
 }
 
+void setOptions(const struct MyFsOptions *options) {
+    MyFS::Instance()->setOptions(options);
+}
+
 int wrap_getattr(const char *path, struct stat *statbuf) {
     return MyFS::Instance()->fuseGetattr(path, statbuf);
 }
@@ -127,6 +131,9 @@ int wrap_ftruncate(const char *path, off_t offset, struct fuse_file_info *fileIn
 int wrap_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     return MyFS::Instance()->fuseCreate(path, mode, fi);
 }
+int wrap_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo) {
+    return MyFS::Instance()->fuseFallocate(path, mode, offset, length, fileInfo);
+}
 void wrap_destroy(void *userdata) {
     MyFS::Instance()->fuseDestroy();
 }
@@ -4,6 +4,7 @@
 //
 
 #include <cstdlib>
+#include <cstdio>
 #include <string.h>
 
 #include "catch.hpp"
@@ -21,3 +22,23 @@ void gen_random(char *s, const int len)
         s[i] = alphanum[rand() % (sizeof(alphanum) - 1)];
     }
 }
+
+ContainerFixture::ContainerFixture() : bd(BLOCK_SIZE), cache(&bd, BLOCK_SIZE)
+{
+    remove(CONTAINER_PATH);
+    REQUIRE(bd.create(CONTAINER_PATH) == 0);
+}
+
+ContainerFixture::~ContainerFixture()
+{
+    delete dMap;
+    bd.close();
+    remove(CONTAINER_PATH);
+}
+
+void ContainerFixture::format(uint32_t dataBlocks, uint32_t dirEntries, uint32_t features)
+{
+    REQUIRE(sb.format(BLOCK_SIZE, dataBlocks, dirEntries, features) == 0);
+    dMap = new DMap(&cache, &sb);
+    dMap->initialInitDMap();
+}
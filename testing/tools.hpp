@@ -10,7 +10,31 @@
 #define helper_hpp
 
 #include "blockdevice.h"
+#include "BlockCache.h"
+#include "DMap.h"
+#include "SuperBlock.h"
+
+#define CONTAINER_PATH "/tmp/container.bin"
 
 void gen_random(char *s, const int len);
 
+/// @brief Empty container file with the block cache in front of it, shared by the tests of the on-disk structures.
+///
+/// Used with TEST_CASE_METHOD, so that a test refers to the members directly. The container file is removed again
+/// when the test ends.
+class ContainerFixture {
+protected:
+    SuperBlock sb;
+    BlockDevice bd;
+    BlockCache cache;
+    DMap *dMap = nullptr;  // created by format()
+
+    /// @brief Format the superblock and start with an empty DMap.
+    void format(uint32_t dataBlocks, uint32_t dirEntries, uint32_t features = 0);
+
+public:
+    ContainerFixture();
+    ~ContainerFixture();
+};
+
 #endif /* helper_hpp */
@@ -0,0 +1,127 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include <string.h>
+
+#include "tools.hpp"
+
+#include "BlockCache.h"
+
+#define NUM_TESTBLOCKS 1024
+
+TEST_CASE_METHOD( ContainerFixture, "BC_WRITE_READ_EVICT", "[blockcache]" ) {
+
+    // much smaller than the test data, so that blocks are evicted all the time
+    cache.setCapacity(16);
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    for(int i= 0; i < NUM_TESTBLOCKS; i++) {
+        REQUIRE(cache.write(i, w + i * BD_BLOCK_SIZE) == 0);
+    }
+
+    uint32_t blockNos[NUM_TESTBLOCKS];
+    char* rBuffers[NUM_TESTBLOCKS];
+    for(int i= 0; i < NUM_TESTBLOCKS; i++) {
+        blockNos[i]= i;
+        rBuffers[i]= r + i * BD_BLOCK_SIZE;
+    }
+    REQUIRE(cache.readBlocks(blockNos, NUM_TESTBLOCKS, rBuffers) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+
+    // the second read of a block is served from the cache
+    uint64_t misses= cache.getMisses();
+    uint64_t hits= cache.getHits();
+    REQUIRE(cache.read(0, r) == 0);
+    REQUIRE(cache.read(0, r) == 0);
+    REQUIRE(cache.getMisses() == misses + 1);
+    REQUIRE(cache.getHits() == hits + 1);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+
+    // a queued write is visible right away
+    gen_random(w, BD_BLOCK_SIZE);
+    REQUIRE(cache.submitWriteBlocks(0, 1, w) == 0);
+    REQUIRE(cache.read(0, r) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+    REQUIRE(cache.waitForCompletion() == 0);
+    REQUIRE(bd.read(0, r) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE_METHOD( ContainerFixture, "BC_WRITE_BACK_FLUSH", "[blockcache]" ) {
+
+    const int noBlocks= 8;
+
+    // few dirty blocks, so the flusher does not write them back before they expire
+    cache.setCapacity(64);
+    REQUIRE(cache.setWriteBack(true) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * noBlocks];
+    gen_random(w, BD_BLOCK_SIZE * noBlocks);
+    char* r= new char[BD_BLOCK_SIZE * noBlocks];
+    char* zeros= new char[BD_BLOCK_SIZE * noBlocks];
+    memset(zeros, 0, BD_BLOCK_SIZE * noBlocks);
+
+    REQUIRE(cache.submitWriteBlocks(0, noBlocks, w) == 0);
+    REQUIRE(cache.waitForCompletion() == 0);
+
+    // the blocks only exist in the cache until they are flushed
+    REQUIRE(bd.readBlocks(0, noBlocks, r) == 0);
+    REQUIRE(memcmp(zeros, r, BD_BLOCK_SIZE * noBlocks) == 0);
+    REQUIRE(cache.read(1, r) == 0);
+    REQUIRE(memcmp(w + BD_BLOCK_SIZE, r, BD_BLOCK_SIZE) == 0);
+
+    REQUIRE(cache.flush() == 0);
+    REQUIRE(bd.readBlocks(0, noBlocks, r) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * noBlocks) == 0);
+
+    // switching back to write-through writes back the remaining dirty blocks
+    gen_random(w, BD_BLOCK_SIZE);
+    REQUIRE(cache.write(0, w) == 0);
+    REQUIRE(cache.setWriteBack(false) == 0);
+    REQUIRE(bd.read(0, r) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+
+    delete [] zeros;
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE_METHOD( ContainerFixture, "BC_PREFETCH", "[blockcache]" ) {
+
+    const int noBlocks= 8;
+
+    cache.setCapacity(64);
+
+    char* w= new char[BD_BLOCK_SIZE * noBlocks];
+    gen_random(w, BD_BLOCK_SIZE * noBlocks);
+    char* r= new char[BD_BLOCK_SIZE * noBlocks];
+    memset(r, 0, BD_BLOCK_SIZE * noBlocks);
+    REQUIRE(bd.writeBlocks(0, noBlocks, w) == 0);
+
+    uint32_t blockNos[noBlocks];
+    char* rBuffers[noBlocks];
+    for(int i= 0; i < noBlocks; i++) {
+        blockNos[i]= i;
+        rBuffers[i]= r + i * BD_BLOCK_SIZE;
+    }
+
+    // all blocks are served from the cache after the prefetch
+    REQUIRE(cache.prefetch(blockNos, noBlocks) == 0);
+    REQUIRE(cache.readBlocks(blockNos, noBlocks, rBuffers) == 0);
+    REQUIRE(cache.getMisses() == 0);
+    REQUIRE(cache.getHits() == noBlocks);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * noBlocks) == 0);
+
+    delete [] r;
+    delete [] w;
+}
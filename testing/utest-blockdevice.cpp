@@ -82,6 +82,241 @@ TEST_CASE( "BD_OPEN_NON-EXISTING_FILE", "[blockdevice]" ) {
     REQUIRE(bd.open(BD_PATH) < 0);
 }
 
+TEST_CASE( "BD_WRITE_READ_MULTIPLE_BLOCKS", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    SECTION("contiguous range") {
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+        REQUIRE(bd.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+    }
+
+    SECTION("block list with adjacent and scattered blocks") {
+        // runs of adjacent block numbers, each block with its own buffer in reverse memory order
+        uint32_t blockNos[]= { 7, 8, 9, 3, 100, 101, 50 };
+        const uint32_t count= sizeof(blockNos) / sizeof(blockNos[0]);
+        char* wBuffers[count];
+        char* rBuffers[count];
+        for(uint32_t i= 0; i < count; i++) {
+            wBuffers[i]= w + (count - 1 - i) * BD_BLOCK_SIZE;
+            rBuffers[i]= r + (count - 1 - i) * BD_BLOCK_SIZE;
+        }
+
+        REQUIRE(bd.writeBlocks(blockNos, count, wBuffers) == 0);
+
+        // single block access must see the same content
+        char* b= new char[BD_BLOCK_SIZE];
+        for(uint32_t i= 0; i < count; i++) {
+            REQUIRE(bd.read(blockNos[i], b) == 0);
+            REQUIRE(memcmp(b, wBuffers[i], BD_BLOCK_SIZE) == 0);
+        }
+        delete [] b;
+
+        REQUIRE(bd.readBlocks(blockNos, count, rBuffers) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * count) == 0);
+    }
+
+    SECTION("read beyond end of container") {
+        REQUIRE(bd.write(0, w) == 0);
+        memset(r, 1, BD_BLOCK_SIZE * 2);
+        REQUIRE(bd.readBlocks(0, 2, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        for(int i= 0; i < BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[BD_BLOCK_SIZE + i] == 0);
+        }
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_SUBMIT_WAIT_MULTIPLE_BLOCKS", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    // every second block, so that each block becomes a request of its own
+    uint32_t blockNos[NUM_TESTBLOCKS / 2];
+    char* wBuffers[NUM_TESTBLOCKS / 2];
+    char* rBuffers[NUM_TESTBLOCKS / 2];
+    for(int i= 0; i < NUM_TESTBLOCKS / 2; i++) {
+        blockNos[i]= 2 * i;
+        wBuffers[i]= w + i * BD_BLOCK_SIZE;
+        rBuffers[i]= r + i * BD_BLOCK_SIZE;
+    }
+
+    REQUIRE(bd.submitWriteBlocks(blockNos, NUM_TESTBLOCKS / 2, wBuffers) == 0);
+    REQUIRE(bd.submitWriteBlocks(NUM_TESTBLOCKS, NUM_TESTBLOCKS / 2, w + BD_BLOCK_SIZE * NUM_TESTBLOCKS / 2) == 0);
+    REQUIRE(bd.waitForCompletion() == 0);
+
+    REQUIRE(bd.submitReadBlocks(blockNos, NUM_TESTBLOCKS / 2, rBuffers) == 0);
+    REQUIRE(bd.submitReadBlocks(NUM_TESTBLOCKS, NUM_TESTBLOCKS / 2, r + BD_BLOCK_SIZE * NUM_TESTBLOCKS / 2) == 0);
+    REQUIRE(bd.waitForCompletion() == 0);
+
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_MAPPED_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+    REQUIRE(bd.map(NUM_TESTBLOCKS) == 0);
+    REQUIRE(bd.isMapped());
+
+    // regular access works on the mapping
+    bdWriteRead(&bd, NUM_TESTBLOCKS);
+
+    // blocks can be modified in place
+    char* w= new char[BD_BLOCK_SIZE];
+    gen_random(w, BD_BLOCK_SIZE);
+    char* block= bd.getBlockPointer(NUM_TESTBLOCKS - 1);
+    REQUIRE(block != NULL);
+    REQUIRE(bd.getBlockPointer(NUM_TESTBLOCKS) == NULL);
+    memcpy(block, w, BD_BLOCK_SIZE);
+    bd.markDirty(NUM_TESTBLOCKS - 1, 1);
+    REQUIRE(bd.sync() == 0);
+
+    REQUIRE(bd.close() == 0);
+
+    // the content must be visible without the mapping
+    BlockDevice bd2(BLOCK_SIZE);
+    REQUIRE(bd2.open(BD_PATH) == 0);
+    REQUIRE_FALSE(bd2.isMapped());
+    char* r= new char[BD_BLOCK_SIZE];
+    REQUIRE(bd2.read(NUM_TESTBLOCKS - 1, r) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+    REQUIRE(bd2.close() == 0);
+
+    delete [] r;
+    delete [] w;
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_DIRECT_IO_LARGE_BLOCKS", "[blockdevice]" ) {
+
+    const uint32_t largeBlockSize= 4096;
+    const int noBlocks= 64;
+
+    remove(BD_PATH);
+
+    BlockDevice bd(largeBlockSize);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    // the host file system may not support O_DIRECT, buffered I/O must work either way
+    bool directIO= bd.setDirectIO(true) == 0;
+    REQUIRE(bd.isDirectIO() == directIO);
+
+    // unaligned buffers are bounced
+    char* w= new char[largeBlockSize * noBlocks + 1];
+    gen_random(w, largeBlockSize * noBlocks + 1);
+    char* r= new char[largeBlockSize * noBlocks + 1];
+    memset(r, 0, largeBlockSize * noBlocks + 1);
+
+    REQUIRE(bd.writeBlocks(0, noBlocks, w + 1) == 0);
+    REQUIRE(bd.readBlocks(0, noBlocks, r + 1) == 0);
+    REQUIRE(memcmp(w + 1, r + 1, largeBlockSize * noBlocks) == 0);
+
+    uint32_t blockNos[]= { 70, 71, 5 };
+    char* rBuffers[]= { r + 1, r + 1 + largeBlockSize, r + 1 + 2 * largeBlockSize };
+    char* wBuffers[]= { w + 1, w + 1 + largeBlockSize, w + 1 + 2 * largeBlockSize };
+    REQUIRE(bd.writeBlocks(blockNos, 3, wBuffers) == 0);
+    memset(r, 0, largeBlockSize * noBlocks + 1);
+    REQUIRE(bd.readBlocks(blockNos, 3, rBuffers) == 0);
+    REQUIRE(memcmp(w + 1, r + 1, 3 * largeBlockSize) == 0);
+
+    // the transfers do not switch to buffered I/O on their own
+    REQUIRE(bd.isDirectIO() == directIO);
+
+    REQUIRE(bd.setDirectIO(false) == 0);
+    REQUIRE_FALSE(bd.isDirectIO());
+    memset(r, 0, largeBlockSize * noBlocks + 1);
+    REQUIRE(bd.read(71, r) == 0);
+    REQUIRE(memcmp(w + 1 + largeBlockSize, r, largeBlockSize) == 0);
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_IO_STATS", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    const char* names[]= { "meta", "data" };
+    const uint32_t starts[]= { 0, 4 };
+    IOStats* stats= bd.getStats();
+    stats->setRegions(names, starts, 2);
+    REQUIRE(stats->getRegionCount() == 2);
+    REQUIRE(strcmp(stats->getRegionName(1), "data") == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * 8];
+    gen_random(w, BD_BLOCK_SIZE * 8);
+
+    // one request spanning both regions, one inside the data region
+    REQUIRE(bd.writeBlocks(2, 4, w) == 0);
+    REQUIRE(bd.read(6, w) == 0);
+    REQUIRE(bd.sync() == 0);
+
+    REQUIRE(stats->getRequests(IOS_WRITE, 0) == 1);
+    REQUIRE(stats->getBytes(IOS_WRITE, 0) == 2 * BD_BLOCK_SIZE);
+    REQUIRE(stats->getRequests(IOS_WRITE, 1) == 1);
+    REQUIRE(stats->getBytes(IOS_WRITE, 1) == 2 * BD_BLOCK_SIZE);
+    REQUIRE(stats->getRequests(IOS_READ, 0) == 0);
+    REQUIRE(stats->getRequests(IOS_READ, 1) == 1);
+    REQUIRE(stats->getBytes(IOS_READ, 1) == BD_BLOCK_SIZE);
+
+    uint64_t writes= 0, reads= 0, syncs= 0;
+    for(int i= 0; i < IOS_LATENCY_BUCKETS; i++) {
+        writes+= stats->getLatencyCount(IOS_WRITE, i);
+        reads+= stats->getLatencyCount(IOS_READ, i);
+        syncs+= stats->getLatencyCount(IOS_SYNC, i);
+    }
+    REQUIRE(writes == 1);
+    REQUIRE(reads == 1);
+    REQUIRE(syncs == 1);
+
+    stats->reset();
+    REQUIRE(stats->getRequests(IOS_WRITE, 0) == 0);
+    REQUIRE(stats->getBytes(IOS_READ, 1) == 0);
+
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
 // ***
 // *** Helper functions
 // ***
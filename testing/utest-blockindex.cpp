@@ -0,0 +1,239 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include "tools.hpp"
+
+#include <string.h>
+
+#include "BlockIndex.h"
+
+TEST_CASE_METHOD( ContainerFixture, "BLOCK_INDEX_FAT_CHAIN", "[blockindex]" ) {
+
+    format(5000, 4);
+    FAT* fat= new FAT(&cache, &sb);
+    fat->initialInitFAT();
+
+    // the chain grows in two appends, the second one links to the end of the first
+    rootFile file= {};
+    file.firstBlock= -1;
+    BlockIndex* index= new BlockIndex(fat, dMap, &file);
+    REQUIRE(index->load() == 0);
+    int first[]= {10, 11, 12};
+    int second[]= {500, 20, 21};
+    for(int i= 0; i < 3; i++) {
+        dMap->setBlockState(first[i], true);
+        dMap->setBlockState(second[i], true);
+    }
+    index->append(first, 3);
+    index->append(second, 3);
+    REQUIRE(file.firstBlock == 10);
+    REQUIRE(fat->getNextBlock(12) == 500);
+    REQUIRE(fat->getNextBlock(500) == 20);
+    REQUIRE(fat->getNextBlock(21) == FAT_EOF);
+    REQUIRE(file.tailBlock == 22);
+    delete index;
+
+    // the last block is known from the metadata, appending does not walk the chain
+    int found[7];
+    int third[]= {30};
+    dMap->setBlockState(30, true);
+    file.blockCount= 6;
+    index= new BlockIndex(fat, dMap, &file);
+    REQUIRE(index->load() == 0);
+    index->append(third, 1);
+    REQUIRE(fat->getNextBlock(21) == 30);
+    REQUIRE(index->getBlocks(5, 2, found) == 0);
+    REQUIRE(found[0] == 21);
+    REQUIRE(found[1] == 30);
+    file.blockCount= 7;
+    delete index;
+
+    // a new index only follows the chain as far as it is asked for
+    index= new BlockIndex(fat, dMap, &file);
+    REQUIRE(index->load() == 0);
+    REQUIRE(index->getBlocks(3, 2, found) == 0);
+    REQUIRE(found[0] == 500);
+    REQUIRE(found[1] == 20);
+    REQUIRE(index->getBlocks(5, 3, found) == -EINVAL);
+    REQUIRE(index->getBlockCount() == 7);
+
+    // truncating ends the chain at the new last block and frees the rest
+    index->truncate(4);
+    REQUIRE(fat->getNextBlock(500) == FAT_EOF);
+    REQUIRE(file.tailBlock == 501);
+    REQUIRE(dMap->getBlockState(500));
+    REQUIRE_FALSE(dMap->getBlockState(20));
+    REQUIRE_FALSE(dMap->getBlockState(30));
+    REQUIRE(index->getBlocks(0, 4, found) == 0);
+    REQUIRE(found[3] == 500);
+
+    index->truncate(0);
+    REQUIRE(file.firstBlock == -1);
+    REQUIRE(file.tailBlock == 0);
+    REQUIRE(index->getBlockCount() == 0);
+    REQUIRE_FALSE(dMap->getBlockState(10));
+    delete index;
+    delete fat;
+}
+
+TEST_CASE_METHOD( ContainerFixture, "BLOCK_INDEX_TAIL_TRUNCATE", "[blockindex]" ) {
+
+    format(5000, 4);
+    FAT* fat= new FAT(&cache, &sb);
+    fat->initialInitFAT();
+
+    rootFile file= {};
+    file.firstBlock= -1;
+    BlockIndex* index= new BlockIndex(fat, dMap, &file);
+    REQUIRE(index->load() == 0);
+    int first[]= {10, 11, 12, 13};
+    int second[]= {40, 41};
+    int third[]= {50};
+    for(int i= 0; i < 4; i++) {
+        dMap->setBlockState(first[i], true);
+    }
+    index->append(first, 4);
+    file.blockCount= 4;
+    delete index;
+
+    // the lookup reaches the last block without seeing the end of the chain, the append goes through the tail
+    int found[6];
+    index= new BlockIndex(fat, dMap, &file);
+    REQUIRE(index->load() == 0);
+    REQUIRE(index->getBlocks(0, 4, found) == 0);
+    dMap->setBlockState(40, true);
+    dMap->setBlockState(41, true);
+    index->append(second, 2);
+    file.blockCount= 6;
+
+    // truncating drops the blocks behind the new end from the tail as well
+    index->truncate(2);
+    file.blockCount= 2;
+    REQUIRE(index->getBlockCount() == 2);
+    REQUIRE(index->getBlocks(3, 1, found) == -EINVAL);
+    REQUIRE_FALSE(dMap->getBlockState(13));
+    REQUIRE_FALSE(dMap->getBlockState(40));
+
+    // the freed blocks are not handed out as part of the file
+    dMap->setBlockState(50, true);
+    index->append(third, 1);
+    file.blockCount= 3;
+    REQUIRE(index->getBlocks(0, 3, found) == 0);
+    REQUIRE(found[1] == 11);
+    REQUIRE(found[2] == 50);
+    REQUIRE(index->getBlocks(3, 1, found) == -EINVAL);
+    delete index;
+
+    // the chain read from the FAT matches
+    index= new BlockIndex(fat, dMap, &file);
+    REQUIRE(index->load() == 0);
+    REQUIRE(index->getBlocks(0, 3, found) == 0);
+    REQUIRE(found[0] == 10);
+    REQUIRE(found[2] == 50);
+    REQUIRE(index->getBlockCount() == 3);
+    REQUIRE(fat->getNextBlock(50) == FAT_EOF);
+    delete index;
+    delete fat;
+}
+
+TEST_CASE_METHOD( ContainerFixture, "BLOCK_INDEX_INCOMPLETE_MIXED", "[blockindex]" ) {
+
+    format(5000, 4);
+    FAT* fat= new FAT(&cache, &sb);
+    fat->initialInitFAT();
+
+    // a chain of ten blocks, 100 to 109
+    rootFile file= {};
+    file.firstBlock= -1;
+    BlockIndex* index= new BlockIndex(fat, dMap, &file);
+    REQUIRE(index->load() == 0);
+    int chain[10];
+    for(int i= 0; i < 10; i++) {
+        chain[i]= 100 + i;
+        dMap->setBlockState(chain[i], true);
+    }
+    index->append(chain, 10);
+    file.blockCount= 10;
+    delete index;
+
+    int found[20];
+    int more[]= {200, 201, 202};
+    int last[]= {300, 301};
+    for(int i= 0; i < 3; i++) {
+        dMap->setBlockState(more[i], true);
+    }
+    dMap->setBlockState(300, true);
+    dMap->setBlockState(301, true);
+
+    SECTION("appending and reading the tail before the walk reaches it") {
+        index= new BlockIndex(fat, dMap, &file);
+        REQUIRE(index->load() == 0);
+        REQUIRE(index->getBlocks(2, 2, found) == 0);
+        REQUIRE(found[1] == 103);
+        index->append(more, 3);
+        file.blockCount= 13;
+        index->append(last, 2);
+        file.blockCount= 15;
+
+        // the new blocks are served from the tail, the walk joins it later
+        REQUIRE(index->getBlocks(9, 4, found) == 0);
+        REQUIRE(found[0] == 109);
+        REQUIRE(found[3] == 202);
+        REQUIRE(index->getBlocks(5, 10, found) == 0);
+        REQUIRE(found[0] == 105);
+        REQUIRE(found[9] == 301);
+        REQUIRE(index->getBlockCount() == 15);
+
+        // cutting into the old chain frees the appended blocks
+        index->truncate(7);
+        file.blockCount= 7;
+        REQUIRE(fat->getNextBlock(106) == FAT_EOF);
+        REQUIRE(file.tailBlock == 107);
+        REQUIRE_FALSE(dMap->getBlockState(200));
+        REQUIRE_FALSE(dMap->getBlockState(301));
+        REQUIRE(index->getBlocks(7, 1, found) == -EINVAL);
+    }
+
+    SECTION("truncating inside the tail without a lookup") {
+        index= new BlockIndex(fat, dMap, &file);
+        REQUIRE(index->load() == 0);
+        index->append(more, 3);
+        file.blockCount= 13;
+        index->truncate(11);
+        file.blockCount= 11;
+        REQUIRE(fat->getNextBlock(200) == FAT_EOF);
+        REQUIRE(file.tailBlock == 201);
+        REQUIRE_FALSE(dMap->getBlockState(201));
+        REQUIRE(index->getBlocks(9, 2, found) == 0);
+        REQUIRE(found[0] == 109);
+        REQUIRE(found[1] == 200);
+        REQUIRE(index->getBlocks(11, 1, found) == -EINVAL);
+
+        // the next append links to the new end
+        index->append(last, 2);
+        file.blockCount= 13;
+        REQUIRE(fat->getNextBlock(200) == 300);
+    }
+    delete index;
+
+    // a fresh index reads the same chain from the FAT
+    uint32_t count= file.blockCount;
+    int expected[20];
+    index= new BlockIndex(fat, dMap, &file);
+    REQUIRE(index->load() == 0);
+    REQUIRE(index->getBlockCount() == count);
+    int block= file.firstBlock;
+    for(uint32_t i= 0; i < count; i++) {
+        expected[i]= block;
+        block= fat->getNextBlock(block);
+    }
+    REQUIRE(block == FAT_EOF);
+    REQUIRE(index->getBlocks(0, count, found) == 0);
+    REQUIRE(memcmp(found, expected, count * sizeof(int)) == 0);
+    REQUIRE(file.tailBlock == (uint32_t) expected[count - 1] + 1);
+    delete index;
+    delete fat;
+}
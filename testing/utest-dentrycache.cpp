@@ -0,0 +1,57 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include "tools.hpp"
+
+#include <string>
+
+#include "DentryCache.h"
+
+TEST_CASE( "DENTRY_CACHE_NEGATIVE_EVICT", "[dentrycache]" ) {
+
+    DentryCache cache(100);
+    int block= 0;
+    REQUIRE_FALSE(cache.find(0, "a", 1, &block));
+
+    // the same name in different directories are different entries, only the given length of a name counts
+    cache.insert(0, "a", 10);
+    cache.insert(7, "a", 20);
+    cache.insert(7, "b", DENTRY_NEGATIVE);
+    REQUIRE(cache.find(0, "a/b", 1, &block));
+    REQUIRE(block == 10);
+    REQUIRE(cache.find(7, "a", 1, &block));
+    REQUIRE(block == 20);
+    REQUIRE(cache.find(7, "b", 1, &block));
+    REQUIRE(block == DENTRY_NEGATIVE);
+
+    // a created name replaces its negative entry
+    cache.insert(7, "b", 30);
+    REQUIRE(cache.find(7, "b", 1, &block));
+    REQUIRE(block == 30);
+
+    cache.removeChildren(7);
+    REQUIRE_FALSE(cache.find(7, "a", 1, &block));
+    REQUIRE_FALSE(cache.find(7, "b", 1, &block));
+    REQUIRE(cache.find(0, "a", 1, &block));
+
+    // the cache never holds more than its capacity
+    for(int i= 0; i < 1000; i++) {
+        std::string name= "n" + std::to_string(i);
+        cache.insert(1, name, i);
+        REQUIRE(cache.find(1, name.c_str(), name.size(), &block));
+        REQUIRE(block == i);
+    }
+    int cached= 0;
+    for(int i= 0; i < 1000; i++) {
+        std::string name= "n" + std::to_string(i);
+        cached+= cache.find(1, name.c_str(), name.size(), &block) ? 1 : 0;
+    }
+    REQUIRE(cached <= 100);
+    REQUIRE(cached >= 50);
+
+    cache.clear();
+    REQUIRE_FALSE(cache.find(1, "n999", 4, &block));
+}
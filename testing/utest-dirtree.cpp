@@ -0,0 +1,74 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include "tools.hpp"
+
+#include <string>
+#include <vector>
+
+#include "DirTree.h"
+
+TEST_CASE_METHOD( ContainerFixture, "DIR_TREE_INSERT_REMOVE_RELOAD", "[dirtree]" ) {
+
+    format(20000, 4, SB_FEATURE_DIR_TREE);
+    uint32_t free0= dMap->getFreeBlockCount();
+
+    DirTree* tree= new DirTree(&cache, dMap, &sb);
+    REQUIRE(tree->create() == 0);
+    REQUIRE(tree->find("file0") == -ENOENT);
+
+    // every tenth name is long, so that leaves of the smallest block size split into three
+    const int count= 5000;
+    std::vector<std::string> names(count);
+    for(int i= 0; i < count; i++) {
+        names[i]= "file" + std::to_string(i);
+        if(i % 10 == 0) {
+            names[i]+= std::string(NAME_LENGTH - 1 - names[i].size(), 'x');
+        }
+        REQUIRE(tree->insert(names[i].c_str(), 100000 + i) == 0);
+    }
+    REQUIRE(tree->insert(names[7].c_str(), 1) == -EEXIST);
+    for(int i= 0; i < count; i++) {
+        REQUIRE(tree->find(names[i].c_str()) == 100000 + i);
+    }
+    REQUIRE(tree->find("file") == -ENOENT);
+
+    // the tree keeps its root and is found again from it
+    uint32_t root= tree->getRoot();
+    delete tree;
+    tree= new DirTree(&cache, dMap, &sb);
+    tree->open(root);
+
+    for(int i= 0; i < count; i+= 2) {
+        REQUIRE(tree->remove(names[i].c_str()) == 0);
+    }
+    REQUIRE(tree->remove(names[0].c_str()) == -ENOENT);
+
+    // the remaining entries are visited once each in the order of their keys
+    uint64_t key= 0;
+    uint64_t last= 0;
+    uint32_t block;
+    std::string name;
+    int visited= 0;
+    while(tree->next(key, &key, &block, &name) == 0) {
+        REQUIRE((visited == 0 || key > last));
+        REQUIRE(block % 2 == 1);
+        REQUIRE(name == names[block - 100000]);
+        last= key++;
+        visited++;
+    }
+    REQUIRE(visited == count / 2);
+
+    // an emptied tree gives back all nodes except its root
+    for(int i= 1; i < count; i+= 2) {
+        REQUIRE(tree->find(names[i].c_str()) == 100000 + i);
+        REQUIRE(tree->remove(names[i].c_str()) == 0);
+    }
+    REQUIRE(tree->next(0, &key, &block, &name) == -ENOENT);
+    REQUIRE(dMap->getFreeBlockCount() == free0 - 1);
+
+    delete tree;
+}
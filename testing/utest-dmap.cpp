@@ -0,0 +1,164 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include "tools.hpp"
+
+#include "DMap.h"
+
+TEST_CASE_METHOD( ContainerFixture, "DMAP_ALLOCATE_FREE_RELOAD", "[dmap]" ) {
+
+    // 5000 blocks take two DMap blocks and do not fill the last word of the bitmap
+    format(5000, 4);
+
+    int* blocks= dMap->getXAmountOfFreeBlocks(150);
+    REQUIRE(blocks != NULL);
+    for(int i= 0; i < 150; i++) {
+        REQUIRE(blocks[i] == i);
+    }
+    delete [] blocks;
+
+    // best fit: a request is served by the smallest run of free blocks that is large enough
+    dMap->setBlockState(10, false);
+    dMap->setBlockState(70, false);
+    for(int i= 100; i < 105; i++) {
+        dMap->setBlockState(i, false);
+    }
+    blocks= dMap->getXAmountOfFreeBlocks(3);
+    REQUIRE(blocks != NULL);
+    REQUIRE(blocks[0] == 100);
+    REQUIRE(blocks[2] == 102);
+    delete [] blocks;
+    REQUIRE(dMap->getNextFreeBlock() == 10);
+
+    // without a run that is large enough, the largest runs are used first
+    REQUIRE(dMap->getXAmountOfFreeBlocks(4854) == NULL);
+    blocks= dMap->getXAmountOfFreeBlocks(4853);
+    REQUIRE(blocks != NULL);
+    REQUIRE(blocks[0] == 150);
+    REQUIRE(blocks[4849] == 4999);
+    REQUIRE(blocks[4850] == 103);
+    REQUIRE(blocks[4851] == 104);
+    REQUIRE(blocks[4852] == 70);
+    delete [] blocks;
+    REQUIRE(dMap->getNextFreeBlock() == -1);
+
+    // freed blocks join the runs next to them
+    dMap->setBlockState(201, false);
+    dMap->setBlockState(203, false);
+    dMap->setBlockState(202, false);
+    blocks= dMap->getXAmountOfFreeBlocks(3);
+    REQUIRE(blocks[0] == 201);
+    REQUIRE(blocks[2] == 203);
+    delete [] blocks;
+
+    // a goal block is taken even if a smaller run would fit, the rest comes from the best fitting run
+    dMap->setBlockState(10, false);
+    dMap->setBlockState(300, false);
+    dMap->setBlockState(301, false);
+    dMap->setBlockState(302, false);
+    blocks= dMap->getXAmountOfFreeBlocks(2, 302);
+    REQUIRE(blocks[0] == 302);
+    REQUIRE(blocks[1] == 10);
+    delete [] blocks;
+    blocks= dMap->getXAmountOfFreeBlocks(2, 10);
+    REQUIRE(blocks[0] == 300);
+    REQUIRE(blocks[1] == 301);
+    delete [] blocks;
+
+    // only the modified DMap block is written
+    dMap->persist();
+    REQUIRE(cache.waitForCompletion() == 0);
+    bd.getStats()->reset();
+    dMap->setBlockState(123, false);
+    dMap->persist();
+    REQUIRE(cache.waitForCompletion() == 0);
+    REQUIRE(bd.getStats()->getBytes(IOS_WRITE, 0) == BLOCK_SIZE);
+    delete dMap;
+
+    // the free block count is derived from the stored bitmap
+    dMap= new DMap(&cache, &sb);
+    dMap->initDMap();
+    REQUIRE_FALSE(dMap->getBlockState(123));
+    REQUIRE(dMap->getBlockState(4999));
+    REQUIRE(dMap->getNextFreeBlock() == 123);
+    REQUIRE(dMap->getNextFreeBlock() == -1);
+}
+
+TEST_CASE_METHOD( ContainerFixture, "DMAP_FREE_SPACE_SUMMARY", "[dmap]" ) {
+
+    // 100000 blocks make 25 groups, the last one is not full
+    format(100000, 4);
+    REQUIRE(dMap->getFreeBlockCount() == 100000);
+
+    // fill the container to 95%, every 20th block stays free
+    int* blocks= dMap->getXAmountOfFreeBlocks(100000);
+    REQUIRE(blocks != NULL);
+    delete [] blocks;
+    REQUIRE(dMap->getFreeBlockCount() == 0);
+    REQUIRE(dMap->getNextFreeBlock() == -1);
+    for(int i= 0; i < 100000; i+= 20) {
+        dMap->setBlockState(i, false);
+    }
+    REQUIRE(dMap->getFreeBlockCount() == 5000);
+
+    blocks= dMap->getXAmountOfFreeBlocks(3);
+    REQUIRE(blocks != NULL);
+    delete [] blocks;
+    REQUIRE(dMap->getFreeBlockCount() == 4997);
+    REQUIRE(dMap->getXAmountOfFreeBlocks(4998) == NULL);
+
+    // setting a state twice does not change the count
+    dMap->setBlockState(20000, true);
+    dMap->setBlockState(20000, true);
+    dMap->setBlockState(99999, false);
+    dMap->setBlockState(99999, false);
+    REQUIRE(dMap->getFreeBlockCount() == 4997);
+    dMap->persist();
+    REQUIRE(cache.waitForCompletion() == 0);
+    delete dMap;
+
+    // the summary of a loaded DMap skips the full groups
+    dMap= new DMap(&cache, &sb);
+    dMap->initDMap();
+    REQUIRE(dMap->getFreeBlockCount() == 4997);
+    blocks= dMap->getXAmountOfFreeBlocks(4997);
+    REQUIRE(blocks != NULL);
+    for(int i= 0; i < 4997; i++) {
+        REQUIRE((blocks[i] == 99999 || (blocks[i] % 20 == 0 && blocks[i] != 20000)));
+    }
+    delete [] blocks;
+    REQUIRE(dMap->getFreeBlockCount() == 0);
+    dMap->setBlockState(40000, false);
+    dMap->setBlockState(99999, false);
+    REQUIRE(dMap->getNextFreeBlock() == 40000);
+    REQUIRE(dMap->getNextFreeBlock() == 99999);
+    REQUIRE(dMap->getFreeBlockCount() == 0);
+}
+
+TEST_CASE_METHOD( ContainerFixture, "DMAP_RESERVE_BLOCKS", "[dmap]" ) {
+
+    format(1000, 4);
+
+    // reserved blocks are not handed out to other requests
+    REQUIRE(dMap->reserveBlocks(600));
+    REQUIRE(dMap->getFreeBlockCount() == 400);
+    REQUIRE_FALSE(dMap->reserveBlocks(401));
+    REQUIRE(dMap->getXAmountOfFreeBlocks(401) == NULL);
+    int* blocks= dMap->getXAmountOfFreeBlocks(400);
+    REQUIRE(blocks != NULL);
+    delete [] blocks;
+    REQUIRE(dMap->getNextFreeBlock() == -1);
+
+    // a released reservation can be allocated
+    dMap->releaseBlocks(600);
+    REQUIRE(dMap->getFreeBlockCount() == 600);
+    blocks= dMap->getXAmountOfFreeBlocks(600);
+    REQUIRE(blocks != NULL);
+    REQUIRE(blocks[0] == 400);
+    REQUIRE(blocks[599] == 999);
+    delete [] blocks;
+    REQUIRE(dMap->getFreeBlockCount() == 0);
+}
@@ -0,0 +1,172 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include "tools.hpp"
+
+#include "ExtentTree.h"
+
+TEST_CASE_METHOD( ContainerFixture, "EXTENT_TREE_APPEND_TRUNCATE_RELOAD", "[extents]" ) {
+
+    // containers with extents have no FAT region
+    format(5000, 4, SB_FEATURE_EXTENTS);
+    REQUIRE(sb.hasExtents());
+    REQUIRE(sb.getFATSize() == 0);
+    REQUIRE(sb.getRootDirOffset() == sb.getFATOffset());
+
+    // every second block belongs to the file, so each block is an extent of its own
+    rootFile file= {};
+    ExtentTree* tree= new ExtentTree(&cache, dMap, &sb, &file);
+    REQUIRE(tree->load() == 0);
+    // 200 runs of one block need 5 leaves and an index node at worst
+    REQUIRE(tree->getNodeReserve(0) == 0);
+    REQUIRE(tree->getNodeReserve(200) == 6);
+    int* blocks= dMap->getXAmountOfFreeBlocks(400);
+    for(int i= 0; i < 400; i+= 2) {
+        tree->append(blocks + i, 1);
+        dMap->setBlockState(blocks[i + 1], false);
+    }
+    // these continue the last extent
+    int next[]= {399, 400, 401};
+    for(int i= 0; i < 3; i++) {
+        dMap->setBlockState(next[i], true);
+    }
+    tree->append(next, 3);
+    delete[] blocks;
+
+    REQUIRE(tree->getBlockCount() == 203);
+    REQUIRE(tree->getExtentCount() == 200);
+
+    // 42 extents per node: 5 leaves below an index node
+    REQUIRE(tree->persist() == 0);
+    REQUIRE(file.extentRoot.depth == 2);
+    REQUIRE(file.extentRoot.count == 1);
+    // another run may add a node to both levels and overflow the full root
+    REQUIRE(tree->getNodeReserve(1) == 3);
+    delete tree;
+
+    int found[203];
+    tree= new ExtentTree(&cache, dMap, &sb, &file);
+    REQUIRE(tree->load() == 0);
+    REQUIRE(tree->getExtentCount() == 200);
+    REQUIRE(tree->getBlocks(0, 203, found) == 0);
+    REQUIRE(found[0] == 0);
+    REQUIRE(found[100] == 200);
+    REQUIRE(found[199] == 398);
+    REQUIRE(found[200] == 399);
+    REQUIRE(found[202] == 401);
+    // the block behind the last extent is a hole
+    REQUIRE(tree->getBlocks(150, 54, found) == 0);
+    REQUIRE(found[52] == 401);
+    REQUIRE(found[53] == -1);
+
+    // a shorter file fits into two leaves below the root, the blocks behind the end are freed
+    tree->truncate(50);
+    REQUIRE(dMap->getBlockState(98));
+    REQUIRE_FALSE(dMap->getBlockState(100));
+    REQUIRE_FALSE(dMap->getBlockState(401));
+    REQUIRE(tree->persist() == 0);
+    REQUIRE(file.extentRoot.depth == 1);
+    REQUIRE(file.extentRoot.count == 2);
+    delete tree;
+
+    tree= new ExtentTree(&cache, dMap, &sb, &file);
+    REQUIRE(tree->load() == 0);
+    REQUIRE(tree->getBlockCount() == 50);
+    REQUIRE(tree->getBlocks(49, 1, found) == 0);
+    REQUIRE(found[0] == 98);
+
+    // without blocks the nodes are freed as well
+    tree->truncate(0);
+    REQUIRE(tree->persist() == 0);
+    REQUIRE(file.extentRoot.depth == 0);
+    REQUIRE(file.extentRoot.count == 0);
+    for(int i= 0; i < 5000; i++) {
+        REQUIRE_FALSE(dMap->getBlockState(i));
+    }
+    delete tree;
+}
+
+TEST_CASE_METHOD( ContainerFixture, "EXTENT_TREE_HOLES", "[extents]" ) {
+
+    format(5000, 4, SB_FEATURE_EXTENTS);
+
+    rootFile file= {};
+    ExtentTree* tree= new ExtentTree(&cache, dMap, &sb, &file);
+    REQUIRE(tree->load() == 0);
+    REQUIRE(tree->supportsHoles());
+    REQUIRE(tree->findBlock(0, true) == UINT32_MAX);
+
+    // blocks 10-19 and 30-39 of the file, the rest is a hole
+    int* blocks= dMap->getXAmountOfFreeBlocks(30);
+    tree->map(30, blocks + 20, 10);
+    tree->map(10, blocks, 10);
+    for(int i= 10; i < 20; i++) {
+        dMap->setBlockState(blocks[i], false);
+    }
+    delete[] blocks;
+    REQUIRE(tree->getBlockCount() == 40);
+    REQUIRE(tree->getExtentCount() == 2);
+    REQUIRE(tree->getMappedBlockCount() == 20);
+
+    int found[40];
+    REQUIRE(tree->getBlocks(0, 40, found) == 0);
+    REQUIRE(found[9] == -1);
+    REQUIRE(found[10] == 0);
+    REQUIRE(found[25] == -1);
+    REQUIRE(found[39] == 29);
+    REQUIRE(tree->findBlock(0, true) == 10);
+    REQUIRE(tree->findBlock(12, false) == 20);
+    REQUIRE(tree->findBlock(20, true) == 30);
+    REQUIRE(tree->findBlock(35, false) == 40);
+    REQUIRE(tree->findBlock(40, true) == UINT32_MAX);
+
+    // filling the hole with the blocks that continue both neighbours merges all of them into one extent
+    int fill[10];
+    for(int i= 0; i < 10; i++) {
+        fill[i]= 10 + i;
+        dMap->setBlockState(fill[i], true);
+    }
+    tree->map(20, fill, 10);
+    REQUIRE(tree->getExtentCount() == 1);
+    REQUIRE(tree->findBlock(10, false) == 40);
+
+    // punching a hole splits the extent and frees its blocks
+    REQUIRE(tree->unmap(15, 10) == 0);
+    REQUIRE(tree->getExtentCount() == 2);
+    REQUIRE(tree->getMappedBlockCount() == 20);
+    REQUIRE_FALSE(dMap->getBlockState(5));
+    REQUIRE_FALSE(dMap->getBlockState(14));
+    REQUIRE(dMap->getBlockState(15));
+    REQUIRE(tree->persist() == 0);
+    delete tree;
+
+    tree= new ExtentTree(&cache, dMap, &sb, &file);
+    REQUIRE(tree->load() == 0);
+    REQUIRE(tree->getBlocks(14, 12, found) == 0);
+    REQUIRE(found[0] == 4);
+    REQUIRE(found[1] == -1);
+    REQUIRE(found[10] == -1);
+    REQUIRE(found[11] == 15);
+    REQUIRE(dMap->getBlockState(29));
+    REQUIRE(tree->getMappedBlockCount() == 20);
+
+    // unmapping the last blocks shortens the file to the end of the extent in front
+    REQUIRE(tree->unmap(25, 100) == 0);
+    REQUIRE(tree->getBlockCount() == 15);
+    REQUIRE(tree->getExtentCount() == 1);
+    REQUIRE(tree->getMappedBlockCount() == 5);
+    REQUIRE(tree->persist() == 0);
+    delete tree;
+
+    // a file written before the count was kept gets it from its extents
+    file.mappedBlocks= 0;
+    tree= new ExtentTree(&cache, dMap, &sb, &file);
+    REQUIRE(tree->load() == 0);
+    REQUIRE(file.mappedBlocks == 6);
+    tree->truncate(12);
+    REQUIRE(tree->getMappedBlockCount() == 2);
+    delete tree;
+}
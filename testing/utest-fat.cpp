@@ -0,0 +1,52 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include "tools.hpp"
+
+#include "FAT.h"
+
+TEST_CASE_METHOD( ContainerFixture, "FAT_PERSIST_DIRTY_BLOCKS", "[fat]" ) {
+
+    // 128 FAT entries per block
+    format(5000, 4);
+
+    FAT* fat= new FAT(&cache, &sb);
+    fat->initialInitFAT();
+
+    // a chain through 8 FAT blocks is written as one request of 8 blocks
+    bd.getStats()->reset();
+    for(int i= 0; i < 999; i++) {
+        REQUIRE(fat->setNextBlock(i, i + 1) == 0);
+    }
+    fat->persist();
+    REQUIRE(cache.waitForCompletion() == 0);
+    REQUIRE(bd.getStats()->getRequests(IOS_WRITE, 0) == 1);
+    REQUIRE(bd.getStats()->getBytes(IOS_WRITE, 0) == 8 * BLOCK_SIZE);
+
+    // blocks that are not adjacent need a request each, unmodified blocks are not written again
+    bd.getStats()->reset();
+    fat->freeBlock(5);
+    fat->freeBlock(600);
+    fat->freeBlock(601);
+    fat->persist();
+    REQUIRE(cache.waitForCompletion() == 0);
+    REQUIRE(bd.getStats()->getRequests(IOS_WRITE, 0) == 2);
+    REQUIRE(bd.getStats()->getBytes(IOS_WRITE, 0) == 2 * BLOCK_SIZE);
+
+    fat->persist();
+    REQUIRE(cache.waitForCompletion() == 0);
+    REQUIRE(bd.getStats()->getRequests(IOS_WRITE, 0) == 2);
+    delete fat;
+
+    fat= new FAT(&cache, &sb);
+    fat->initFAT();
+    REQUIRE(fat->getNextBlock(4) == 5);
+    REQUIRE(fat->getNextBlock(5) == FAT_EOF);
+    REQUIRE(fat->getNextBlock(998) == 999);
+    REQUIRE(fat->getNextBlock(999) == FAT_EOF);
+    REQUIRE(fat->getNextBlock(4999) == FAT_EOF);
+    delete fat;
+}
@@ -10,3 +10,579 @@
 
 #include "tools.hpp"
 #include "myfs.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "myondiskfs.h"
+
+#define LOG_PATH "/tmp/myfs-test.log"
+
+/// @brief The on-disk file system on a new container file, mounted without FUSE.
+///
+/// The options are set before mount() and apply to every mount of the test. The container file is removed again when
+/// the test ends.
+class FSFixture {
+protected:
+    // the file system keeps its log file, mounted by FUSE it would open it in fuseInit()
+    class TestFS : public MyOnDiskFS {
+    public:
+        TestFS() { this->logFile = fopen(LOG_PATH, "w"); }
+        ~TestFS() override { fclose(this->logFile); }
+
+        /// @brief Set the times of a file as if they were taken at an earlier point.
+        void setTimes(const char *path, time_t atime, time_t mtime, time_t ctime) {
+            rootFile *file;
+            REQUIRE(rootDir->findFile(path, &file) == 0);
+            file->stat.st_atime = atime;
+            file->stat.st_mtime = mtime;
+            file->stat.st_ctime = ctime;
+            rootDir->persist(file);
+        }
+
+        IOStats *getStats() { return blockDevice->getStats(); }
+        uint32_t getFreeBlockCount() { return dMap->getFreeBlockCount(); }
+    };
+
+    MyFsOptions options = {0, 0, 0, -1};
+    TestFS *fs = nullptr;
+
+    /// @brief Mount the container file, a new one is created on the first mount.
+    void mount() {
+        fs = new TestFS();
+        fs->setOptions(&options);
+        REQUIRE(fs->openContainer(CONTAINER_PATH) == 0);
+    }
+
+    void unmount() {
+        fs->fuseDestroy();
+        delete fs;
+        fs = nullptr;
+    }
+
+    /// @brief Create a regular file and open it.
+    void create(const char *path, struct fuse_file_info *fileInfo) {
+        REQUIRE(fs->fuseMknod(path, S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseOpen(path, fileInfo) == 0);
+    }
+
+    /// @brief Read a range of a file through a handle of its own.
+    std::vector<char> read(const char *path, size_t size, off_t offset = 0) {
+        struct fuse_file_info fileInfo = {};
+        std::vector<char> buf(size, 'x');
+        REQUIRE(fs->fuseOpen(path, &fileInfo) == 0);
+        int ret = fs->fuseRead(path, buf.data(), size, offset, &fileInfo);
+        REQUIRE(fs->fuseRelease(path, &fileInfo) == 0);
+        REQUIRE(ret >= 0);
+        buf.resize(ret);
+        return buf;
+    }
+
+    struct stat getattr(const char *path) {
+        struct stat statbuf = {};
+        REQUIRE(fs->fuseGetattr(path, &statbuf) == 0);
+        return statbuf;
+    }
+
+public:
+    FSFixture() {
+        remove(CONTAINER_PATH);
+    }
+
+    ~FSFixture() {
+        if (fs != nullptr) {
+            unmount();
+        }
+        remove(CONTAINER_PATH);
+        remove(LOG_PATH);
+    }
+};
+
+TEST_CASE_METHOD( FSFixture, "MYFS_ST_BLOCKS_UNITS", "[myfs]" ) {
+
+    // st_blocks counts 512 byte units whatever the block size of the container is
+    uint32_t blockSize= 512;
+    SECTION("default block size") {
+    }
+    SECTION("4 KiB blocks") {
+        blockSize= 4096;
+    }
+    options.blockSize= blockSize;
+    options.fsSize= 8;
+    mount();
+
+    struct fuse_file_info fileInfo= {};
+    char buf[10000];
+    gen_random(buf, sizeof(buf));
+    create("/file", &fileInfo);
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 0, &fileInfo) == sizeof(buf));
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+
+    blkcnt_t expected= (sizeof(buf) + blockSize - 1) / blockSize * (blockSize / 512);
+    struct stat statbuf= getattr("/file");
+    REQUIRE(statbuf.st_size == sizeof(buf));
+    REQUIRE(statbuf.st_blocks == expected);
+
+    // the block count survives a remount and a truncate
+    unmount();
+    mount();
+    REQUIRE(getattr("/file").st_blocks == expected);
+    REQUIRE(fs->fuseTruncate("/file", 1) == 0);
+    REQUIRE(getattr("/file").st_blocks == blockSize / 512);
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_WRITE_ENOSPC_KEEPS_FILE", "[myfs]" ) {
+
+    // 1 MiB of data blocks
+    options.fsSize= 1;
+    SECTION("FAT") {
+    }
+    SECTION("extents") {
+        options.useExtents= 1;
+    }
+    mount();
+
+    struct fuse_file_info fileInfo= {};
+    char buf[100];
+    gen_random(buf, sizeof(buf));
+    create("/file", &fileInfo);
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 0, &fileInfo) == sizeof(buf));
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+
+    // a write behind the end of the file that does not fit leaves its size as it was
+    std::vector<char> big(3 * 512 * 1024, 'x');
+    REQUIRE(fs->fuseWrite("/file", big.data(), big.size(), 1000, &fileInfo) == -ENOSPC);
+    REQUIRE(getattr("/file").st_size == sizeof(buf));
+
+    // the space is not held by the failed write
+    REQUIRE(fs->fuseWrite("/file", big.data(), 512 * 1024, 1000, &fileInfo) == 512 * 1024);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(getattr("/file").st_size == 1000 + 512 * 1024);
+
+    char data[1000];
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseRead("/file", data, sizeof(data), 0, &fileInfo) == sizeof(data));
+    REQUIRE(memcmp(data, buf, sizeof(buf)) == 0);
+    for(size_t i= sizeof(buf); i < sizeof(data); i++) {
+        REQUIRE(data[i] == 0);
+    }
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_WRITE_ENOSPC_EXTENT_NODES", "[myfs]" ) {
+
+    // 1024 data blocks, an extent tree node takes 84 extents
+    options.fsSize= 1;
+    options.blockSize= 1024;
+    options.useExtents= 1;
+    mount();
+
+    // the free space is split into runs of a single block by the blocks of a deleted file
+    struct fuse_file_info fileInfo= {};
+    struct fuse_file_info otherInfo= {};
+    char block[1024];
+    gen_random(block, sizeof(block));
+    create("/file", &fileInfo);
+    create("/other", &otherInfo);
+    for(int i= 0; i < 400; i++) {
+        REQUIRE(fs->fuseWrite("/file", block, sizeof(block), i * sizeof(block), &fileInfo) == sizeof(block));
+        REQUIRE(fs->fuseFsync("/file", 0, &fileInfo) == 0);
+        REQUIRE(fs->fuseWrite("/other", block, sizeof(block), i * sizeof(block), &otherInfo) == sizeof(block));
+        REQUIRE(fs->fuseFsync("/other", 0, &otherInfo) == 0);
+    }
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseRelease("/other", &otherInfo) == 0);
+    REQUIRE(fs->fuseUnlink("/other") == 0);
+
+    // the data waiting for allocation fills the container, its blocks become hundreds of extents
+    std::vector<char> buf;
+    create("/new", &fileInfo);
+    int ret;
+    do {
+        gen_random(block, sizeof(block));
+        ret= fs->fuseWrite("/new", block, sizeof(block), buf.size(), &fileInfo);
+        if(ret > 0) {
+            REQUIRE(ret == sizeof(block));
+            buf.insert(buf.end(), block, block + sizeof(block));
+        }
+    } while(ret > 0 && buf.size() < 1024 * sizeof(block));
+    REQUIRE(ret == -ENOSPC);
+    REQUIRE(buf.size() > 400 * sizeof(block));
+
+    // the tree nodes were reserved with the data, the accepted data reaches the container
+    REQUIRE(fs->fuseRelease("/new", &fileInfo) == 0);
+    REQUIRE(getattr("/new").st_size == (off_t) buf.size());
+    REQUIRE(read("/new", buf.size() + 1) == buf);
+
+    unmount();
+    mount();
+    REQUIRE(read("/new", buf.size() + 1) == buf);
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_ST_BLOCKS_SPARSE", "[myfs]" ) {
+
+    options.fsSize= 8;
+    options.useExtents= 1;
+    mount();
+
+    struct fuse_file_info fileInfo= {};
+    char buf[512];
+    gen_random(buf, sizeof(buf));
+    create("/file", &fileInfo);
+
+    // the data waiting for allocation counts, the hole in front of a write far behind the end does not
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 0, &fileInfo) == sizeof(buf));
+    REQUIRE(getattr("/file").st_blocks == 1);
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 100 * 512, &fileInfo) == sizeof(buf));
+    REQUIRE(getattr("/file").st_blocks == 2);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(getattr("/file").st_size == 101 * 512);
+    REQUIRE(getattr("/file").st_blocks == 2);
+
+    // a punched hole gives its blocks back, a truncate that grows the file adds none
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseFallocate("/file", FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, 512, &fileInfo) == 0);
+    REQUIRE(getattr("/file").st_blocks == 1);
+    REQUIRE(fs->fuseTruncate("/file", 200 * 512, &fileInfo) == 0);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+
+    unmount();
+    mount();
+    REQUIRE(getattr("/file").st_size == 200 * 512);
+    REQUIRE(getattr("/file").st_blocks == 1);
+
+    // every second block is written, the extents do not fit into the root of the tree
+    create("/sparse", &fileInfo);
+    for(int i= 0; i < 64; i++) {
+        REQUIRE(fs->fuseWrite("/sparse", buf, sizeof(buf), i * 2 * 512, &fileInfo) == sizeof(buf));
+    }
+    REQUIRE(fs->fuseRelease("/sparse", &fileInfo) == 0);
+    REQUIRE(getattr("/sparse").st_blocks == 64);
+
+    // the count of a closed file is kept in its metadata, its extent tree is not read
+    unmount();
+    mount();
+    REQUIRE(getattr("/file").st_blocks == 1);
+    fs->getStats()->reset();
+    REQUIRE(getattr("/sparse").st_blocks == 64);
+    REQUIRE(fs->getStats()->getBytes(IOS_READ, 4) == 0);
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_FALLOCATE_SIZE", "[myfs]" ) {
+
+    options.fsSize= 8;
+    SECTION("FAT") {
+    }
+    SECTION("extents") {
+        options.useExtents= 1;
+    }
+    mount();
+
+    struct fuse_file_info fileInfo= {};
+    char buf[100];
+    gen_random(buf, sizeof(buf));
+    create("/file", &fileInfo);
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 0, &fileInfo) == sizeof(buf));
+
+    // without flags the file grows to the end of the range, the new part reads as zeros
+    REQUIRE(fs->fuseFallocate("/file", 0, 0, 5000, &fileInfo) == 0);
+    struct stat statbuf= getattr("/file");
+    REQUIRE(statbuf.st_size == 5000);
+    REQUIRE(statbuf.st_blocks == 10);
+    std::vector<char> data= read("/file", 6000);
+    REQUIRE(data.size() == 5000);
+    REQUIRE(memcmp(data.data(), buf, sizeof(buf)) == 0);
+    for(size_t i= sizeof(buf); i < data.size(); i++) {
+        REQUIRE(data[i] == 0);
+    }
+
+    // FALLOC_FL_KEEP_SIZE only allocates, the blocks behind the end count in st_blocks
+    REQUIRE(fs->fuseFallocate("/file", FALLOC_FL_KEEP_SIZE, 4000, 6240, &fileInfo) == 0);
+    statbuf= getattr("/file");
+    REQUIRE(statbuf.st_size == 5000);
+    REQUIRE(statbuf.st_blocks == 20);
+    REQUIRE(read("/file", 20000).size() == 5000);
+
+    // a range inside the file changes neither its size nor its blocks
+    REQUIRE(fs->fuseFallocate("/file", 0, 0, 1000, &fileInfo) == 0);
+    REQUIRE(getattr("/file").st_size == 5000);
+    REQUIRE(getattr("/file").st_blocks == 20);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+
+    // the file can grow into the preallocated blocks without new ones
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 10000, &fileInfo) == sizeof(buf));
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    statbuf= getattr("/file");
+    REQUIRE(statbuf.st_size == 10100);
+    REQUIRE(statbuf.st_blocks == 20);
+    data= read("/file", 10100);
+    for(size_t i= sizeof(buf); i < 10000; i++) {
+        REQUIRE(data[i] == 0);
+    }
+    REQUIRE(memcmp(data.data() + 10000, buf, sizeof(buf)) == 0);
+
+    // unsupported modes and empty ranges
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseFallocate("/file", FALLOC_FL_PUNCH_HOLE, 0, 512, &fileInfo) == -EOPNOTSUPP);
+    REQUIRE(fs->fuseFallocate("/file", 0, 0, 0, &fileInfo) == -EINVAL);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_FALLOCATE_PUNCH_HOLE", "[myfs]" ) {
+
+    options.fsSize= 8;
+    SECTION("FAT") {
+    }
+    SECTION("extents") {
+        options.useExtents= 1;
+    }
+    mount();
+
+    struct fuse_file_info fileInfo= {};
+    std::vector<char> buf(8 * 512);
+    gen_random(buf.data(), buf.size());
+    create("/file", &fileInfo);
+    REQUIRE(fs->fuseWrite("/file", buf.data(), buf.size(), 0, &fileInfo) == (int) buf.size());
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+
+    // the range reads as zeros, partially covered blocks keep the rest of their data
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseFallocate("/file", FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 300, 5 * 512, &fileInfo) == 0);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(getattr("/file").st_size == (off_t) buf.size());
+    memset(buf.data() + 300, 0, 5 * 512);
+
+    // with extents the blocks covered completely become a hole
+    blkcnt_t blocks= options.useExtents ? 4 : 8;
+    REQUIRE(getattr("/file").st_blocks == blocks);
+
+    std::vector<char> data= read("/file", buf.size());
+    REQUIRE(data == buf);
+    unmount();
+    mount();
+    REQUIRE(read("/file", buf.size()) == buf);
+    REQUIRE(getattr("/file").st_blocks == blocks);
+
+    // a hole behind the end of the file changes nothing
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseFallocate("/file", FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 20000, 512, &fileInfo) == 0);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(getattr("/file").st_size == (off_t) buf.size());
+    REQUIRE(read("/file", buf.size()) == buf);
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_FALLOCATE_UNWRITTEN_ZEROS", "[myfs]" ) {
+
+    options.fsSize= 1;
+    SECTION("FAT") {
+    }
+    SECTION("extents") {
+        options.useExtents= 1;
+    }
+    mount();
+
+    // the freed blocks of another file still hold its data
+    struct fuse_file_info fileInfo= {};
+    std::vector<char> junk(256 * 1024);
+    gen_random(junk.data(), junk.size());
+    create("/junk", &fileInfo);
+    REQUIRE(fs->fuseWrite("/junk", junk.data(), junk.size(), 0, &fileInfo) == (int) junk.size());
+    REQUIRE(fs->fuseRelease("/junk", &fileInfo) == 0);
+    REQUIRE(fs->fuseUnlink("/junk") == 0);
+
+    std::vector<char> zeros(junk.size(), 0);
+    create("/file", &fileInfo);
+    REQUIRE(fs->fuseFallocate("/file", 0, 0, junk.size(), &fileInfo) == 0);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(read("/file", junk.size()) == zeros);
+
+    // the blocks stay unwritten across a remount
+    unmount();
+    mount();
+    REQUIRE(read("/file", junk.size()) == zeros);
+
+    // a partial write only fills in its own bytes, also in the blocks it covers partially
+    char buf[700];
+    gen_random(buf, sizeof(buf));
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 3000, &fileInfo) == sizeof(buf));
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    memcpy(zeros.data() + 3000, buf, sizeof(buf));
+    REQUIRE(read("/file", junk.size()) == zeros);
+
+    unmount();
+    mount();
+    REQUIRE(getattr("/file").st_size == (off_t) junk.size());
+    REQUIRE(read("/file", junk.size()) == zeros);
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_FALLOCATE_ENOSPC", "[myfs]" ) {
+
+    options.fsSize= 1;
+    options.useExtents= 1;
+    mount();
+
+    // most of the container is in use, the free blocks still hold the data of a deleted file
+    struct fuse_file_info fileInfo= {};
+    std::vector<char> fill(700 * 1024);
+    gen_random(fill.data(), fill.size());
+    create("/fill", &fileInfo);
+    REQUIRE(fs->fuseWrite("/fill", fill.data(), fill.size(), 0, &fileInfo) == (int) fill.size());
+    REQUIRE(fs->fuseRelease("/fill", &fileInfo) == 0);
+    std::vector<char> junk(200 * 1024);
+    gen_random(junk.data(), junk.size());
+    create("/junk", &fileInfo);
+    REQUIRE(fs->fuseWrite("/junk", junk.data(), junk.size(), 0, &fileInfo) == (int) junk.size());
+    REQUIRE(fs->fuseRelease("/junk", &fileInfo) == 0);
+    REQUIRE(fs->fuseUnlink("/junk") == 0);
+
+    // a sparse file with more holes than free blocks, the first hole still fits
+    std::vector<char> data(600 * 1024, 0);
+    data[100 * 1024]= 'x';
+    data.back()= 'x';
+    create("/file", &fileInfo);
+    REQUIRE(fs->fuseWrite("/file", &data.back(), 1, data.size() - 1, &fileInfo) == 1);
+    REQUIRE(fs->fuseWrite("/file", &data.back(), 1, 100 * 1024, &fileInfo) == 1);
+    REQUIRE(fs->fuseFallocate("/file", FALLOC_FL_KEEP_SIZE, 0, data.size(), &fileInfo) == -ENOSPC);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(read("/file", data.size()) == data);
+
+    // the blocks filled in before the call failed stay with the file
+    unmount();
+    mount();
+    REQUIRE(read("/file", data.size()) == data);
+    REQUIRE(read("/fill", fill.size()) == fill);
+    create("/other", &fileInfo);
+    REQUIRE(fs->fuseWrite("/other", junk.data(), 100 * 1024, 0, &fileInfo) == 100 * 1024);
+    REQUIRE(fs->fuseRelease("/other", &fileInfo) == 0);
+    REQUIRE(read("/file", data.size()) == data);
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_ATIME", "[myfs]" ) {
+
+    SECTION("default") {
+    }
+    SECTION("noatime") {
+        options.noAtime= 1;
+    }
+    SECTION("relatime") {
+        options.relAtime= 1;
+    }
+    SECTION("noatime and relatime") {
+        options.noAtime= 1;
+        options.relAtime= 1;
+    }
+    mount();
+
+    struct fuse_file_info fileInfo= {};
+    char buf[100];
+    gen_random(buf, sizeof(buf));
+    create("/file", &fileInfo);
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 0, &fileInfo) == sizeof(buf));
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+
+    time_t now= time(nullptr);
+    time_t day= 24 * 60 * 60;
+    struct {
+        time_t atime, mtime, ctime;
+        bool relatimeUpdates;
+    } cases[]= {
+        {now - 10, now - 100, now - 100, false},  // read after the last change
+        {now - 100, now - 100, now - 200, true},  // atime equal to mtime
+        {now - 100, now - 200, now - 100, true},  // atime equal to ctime
+        {now - 100, now - 10, now - 100, true},  // modified since the last read
+        {now - 100, now - 200, now - 10, true},  // changed since the last read
+        {now - day + 60, now - 2 * day, now - 2 * day, false},  // read less than a day ago
+        {now - day - 60, now - 2 * day, now - 2 * day, true},  // read more than a day ago
+    };
+
+    for(size_t i= 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        fs->setTimes("/file", cases[i].atime, cases[i].mtime, cases[i].ctime);
+        REQUIRE(read("/file", sizeof(buf)).size() == sizeof(buf));
+
+        time_t atime= getattr("/file").st_atime;
+        if(options.noAtime || (options.relAtime && !cases[i].relatimeUpdates)) {
+            REQUIRE(atime == cases[i].atime);
+        } else {
+            REQUIRE(atime >= now);
+        }
+        REQUIRE(getattr("/file").st_mtime == cases[i].mtime);
+        REQUIRE(getattr("/file").st_ctime == cases[i].ctime);
+    }
+
+    // the access time of the last read is stored in the container
+    time_t atime= getattr("/file").st_atime;
+    unmount();
+    mount();
+    REQUIRE(getattr("/file").st_atime == atime);
+
+    // a write makes the next read update the access time with relatime
+    fs->setTimes("/file", now - 10, now - 100, now - 100);
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite("/file", buf, sizeof(buf), 0, &fileInfo) == sizeof(buf));
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(getattr("/file").st_atime == now - 10);
+    REQUIRE(read("/file", sizeof(buf)).size() == sizeof(buf));
+    if(options.noAtime) {
+        REQUIRE(getattr("/file").st_atime == now - 10);
+    } else {
+        REQUIRE(getattr("/file").st_atime >= now);
+    }
+}
+
+TEST_CASE_METHOD( FSFixture, "MYFS_UNLINK_OPEN", "[myfs]" ) {
+
+    options.fsSize= 8;
+    SECTION("FAT") {
+    }
+    SECTION("extents") {
+        options.useExtents= 1;
+    }
+    mount();
+    uint32_t freeBlocks= fs->getFreeBlockCount();
+
+    // part of the data has its blocks, the rest waits for allocation
+    struct fuse_file_info fileInfo= {};
+    struct fuse_file_info otherInfo= {};
+    std::vector<char> buf(64 * 1024);
+    gen_random(buf.data(), buf.size());
+    create("/file", &fileInfo);
+    REQUIRE(fs->fuseWrite("/file", buf.data(), 32 * 1024, 0, &fileInfo) == 32 * 1024);
+    REQUIRE(fs->fuseFsync("/file", 0, &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite("/file", buf.data() + 32 * 1024, 32 * 1024, 32 * 1024, &fileInfo) == 32 * 1024);
+    REQUIRE(fs->fuseOpen("/file", &otherInfo) == 0);
+
+    // the name is gone, the handles still reach the data
+    REQUIRE(fs->fuseUnlink("/file") == 0);
+    struct stat statbuf;
+    REQUIRE(fs->fuseGetattr("/file", &statbuf) == -ENOENT);
+    std::vector<char> data(buf.size());
+    REQUIRE(fs->fuseRead("/file", data.data(), data.size(), 0, &otherInfo) == (int) data.size());
+    REQUIRE(data == buf);
+
+    // a new file does not get the inode or the blocks of the open one
+    struct fuse_file_info newInfo= {};
+    create("/file", &newInfo);
+    REQUIRE(fs->fuseWrite("/file", buf.data(), 512, 0, &newInfo) == 512);
+    REQUIRE(fs->fuseRelease("/file", &newInfo) == 0);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite("/file", buf.data(), 512, buf.size(), &otherInfo) == 512);
+    REQUIRE(fs->fuseRead("/file", data.data(), data.size(), 0, &otherInfo) == (int) data.size());
+    REQUIRE(data == buf);
+    REQUIRE(fs->getFreeBlockCount() < freeBlocks - 128);
+
+    // the last handle frees the blocks of the unlinked file
+    REQUIRE(fs->fuseRelease("/file", &otherInfo) == 0);
+    REQUIRE(read("/file", 1024).size() == 512);
+    REQUIRE(fs->fuseUnlink("/file") == 0);
+    REQUIRE(fs->getFreeBlockCount() == freeBlocks);
+
+    unmount();
+    mount();
+    REQUIRE(fs->getFreeBlockCount() == freeBlocks);
+    REQUIRE(fs->fuseGetattr("/file", &statbuf) == -ENOENT);
+}
@@ -0,0 +1,61 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include "tools.hpp"
+
+#include <string>
+#include <vector>
+
+#include "NameIndex.h"
+
+TEST_CASE( "NAME_INDEX_FIND_REMOVE_GROW", "[nameindex]" ) {
+
+    // the names are stored outside of the index, like the names of the directory entries
+    const int count= 1000;
+    std::vector<std::string> names(count);
+    NameIndex index(4);
+    for(int i= 0; i < count; i++) {
+        names[i]= "file" + std::to_string(i);
+        index.insert(names[i].c_str(), i);
+    }
+    for(int i= 0; i < count; i++) {
+        REQUIRE(index.find(names[i].c_str()) == i);
+    }
+    REQUIRE(index.find("file") == -1);
+    REQUIRE(index.find("file1000") == -1);
+    REQUIRE(index.find("") == -1);
+
+    // removed names are not found anymore, the names behind them in their probe sequence still are
+    for(int i= 0; i < count; i+= 2) {
+        index.remove(names[i].c_str(), i);
+    }
+    for(int i= 0; i < count; i++) {
+        REQUIRE(index.find(names[i].c_str()) == (i % 2 == 0 ? -1 : i));
+    }
+
+    // a rename removes the old name before it changes
+    index.remove(names[1].c_str(), 1);
+    names[1]= "renamed";
+    index.insert(names[1].c_str(), 1);
+    REQUIRE(index.find("renamed") == 1);
+    REQUIRE(index.find("file1") == -1);
+
+    // slots of removed names are reused without losing any name
+    for(int round= 0; round < 20; round++) {
+        for(int i= 0; i < count; i+= 2) {
+            index.insert(names[i].c_str(), i);
+        }
+        for(int i= 0; i < count; i+= 2) {
+            index.remove(names[i].c_str(), i);
+        }
+    }
+    for(int i= 1; i < count; i+= 2) {
+        REQUIRE(index.find(names[i].c_str()) == i);
+    }
+
+    index.clear();
+    REQUIRE(index.find("renamed") == -1);
+}
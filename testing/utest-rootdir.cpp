@@ -0,0 +1,135 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include "tools.hpp"
+
+#include <string>
+#include <vector>
+
+#include "RootDir.h"
+
+TEST_CASE_METHOD( ContainerFixture, "INODE_TABLE_PACK_RELOAD", "[rootdir]" ) {
+
+    // the region of four inodes takes a single block
+    REQUIRE(sb.format(BLOCK_SIZE, 5000, 4, SB_FEATURE_INODE_TABLE) == -EINVAL);
+    format(5000, 4, SB_FEATURE_DIR_TREE | SB_FEATURE_INODE_TABLE);
+    REQUIRE(sb.getRootDirSize() == 1);
+    REQUIRE(sb.getInodesPerBlock() == BLOCK_SIZE / INODE_SIZE);
+    RootDir* rootDir= new RootDir(&cache, &sb, dMap);
+    REQUIRE(rootDir->initialInitRootDir() == 0);
+    uint32_t free0= dMap->getFreeBlockCount();
+
+    // the first files fill the region, the following ones share inode blocks taken from the data blocks
+    const int count= 10;
+    rootFile* file;
+    std::vector<uint32_t> blocks(count);
+    for(int i= 0; i < count; i++) {
+        std::string path= "/file" + std::to_string(i);
+        REQUIRE(rootDir->createFile(path.c_str(), S_IFREG | 0644, &file) == 0);
+        blocks[i]= file->rootDirBlock / 4;
+        REQUIRE((i < 4 ? blocks[i] == sb.getRootDirOffset() : blocks[i] >= sb.getDataOffset()));
+        REQUIRE((i % 4 == 0 || blocks[i] == blocks[i - 1]));
+        file->stat.st_size= i;
+        file->blockCount= 1;
+        file->firstBlock= 100 + i;
+        REQUIRE(rootDir->persist(file));
+    }
+    REQUIRE(rootDir->createFile("/dir", S_IFDIR | 0755, &file) == 0);
+    REQUIRE(rootDir->persist(file));
+    REQUIRE(rootDir->createFile("/dir/sub", S_IFREG | 0644, &file) == 0);
+    REQUIRE(rootDir->persist(file));
+    REQUIRE(file->rootDirBlock / 4 == blocks[8]);
+    REQUIRE(blocks[8] != blocks[4]);
+    REQUIRE(dMap->getFreeBlockCount() == free0 - 3);  // two inode blocks and the tree of the directory
+
+    // the inodes hold no names, a file gets its name when it is found by path
+    delete rootDir;
+    rootDir= new RootDir(&cache, &sb, dMap);
+    REQUIRE(rootDir->initRootDir() == 0);
+    for(int i= 0; i < count; i++) {
+        std::string path= "/file" + std::to_string(i);
+        REQUIRE(rootDir->findFile(path.c_str(), &file) == 0);
+        REQUIRE(std::string(file->name) == path.substr(1));
+        REQUIRE(file->stat.st_size == i);
+        REQUIRE(file->firstBlock == 100 + i);
+        REQUIRE(S_ISREG(file->stat.st_mode));
+    }
+    REQUIRE(rootDir->findFile("/dir/sub", &file) == 0);
+    REQUIRE(std::string(file->name) == "sub");
+    REQUIRE(rootDir->findFile("/dir", &file) == 0);
+    REQUIRE(file->stat.st_nlink == 2);
+
+    // an inode block among the data blocks is freed with its last inode, a region inode is used again
+    REQUIRE(rootDir->findFile("/dir", &file) == 0);
+    REQUIRE(rootDir->deleteFile(file) == -ENOTEMPTY);
+    REQUIRE(rootDir->findFile("/dir/sub", &file) == 0);
+    REQUIRE(rootDir->deleteFile(file) == 0);
+    REQUIRE(rootDir->findFile("/dir", &file) == 0);
+    REQUIRE(rootDir->deleteFile(file) == 0);
+    for(int i= 0; i < count; i++) {
+        std::string path= "/file" + std::to_string(i);
+        REQUIRE(rootDir->findFile(path.c_str(), &file) == 0);
+        REQUIRE(rootDir->deleteFile(file) == 0);
+        REQUIRE(rootDir->findFile(path.c_str(), &file) == -ENOENT);
+    }
+    REQUIRE(dMap->getFreeBlockCount() == free0);
+
+    delete rootDir;
+    rootDir= new RootDir(&cache, &sb, dMap);
+    REQUIRE(rootDir->initRootDir() == 0);
+    REQUIRE(rootDir->createFile("/again", S_IFREG | 0644, &file) == 0);
+    REQUIRE((uint32_t) file->rootDirBlock == sb.getRootDirOffset() * 4);
+    REQUIRE(dMap->getFreeBlockCount() == free0);
+
+    delete rootDir;
+}
+
+TEST_CASE_METHOD( ContainerFixture, "ROOTDIR_DELETE_PINNED", "[rootdir]" ) {
+
+    format(5000, 4, SB_FEATURE_DIR_TREE | SB_FEATURE_INODE_TABLE);
+    RootDir* rootDir= new RootDir(&cache, &sb, dMap);
+    REQUIRE(rootDir->initialInitRootDir() == 0);
+
+    rootFile* file;
+    REQUIRE(rootDir->createFile("/open", S_IFREG | 0644, &file) == 0);
+    REQUIRE(rootDir->persist(file));
+    uint32_t inode= (uint32_t) file->rootDirBlock;
+
+    // a pinned file loses its name, but its metadata stays valid and its inode is not handed out again
+    rootDir->pinFile(file);
+    rootDir->pinFile(file);
+    REQUIRE(rootDir->deleteFile(file) == 0);
+    REQUIRE(rootDir->getPinCount(file) == 2);
+    REQUIRE(file->stat.st_nlink == 0);
+    rootFile* found;
+    REQUIRE(rootDir->findFile("/open", &found) == -ENOENT);
+    REQUIRE(rootDir->getFileByBlock(inode) == file);
+    file->stat.st_size= 1000;
+    REQUIRE(rootDir->persist(file));
+
+    rootFile* other;
+    REQUIRE(rootDir->createFile("/other", S_IFREG | 0644, &other) == 0);
+    REQUIRE((uint32_t) other->rootDirBlock != inode);
+    REQUIRE(rootDir->persist(other));
+
+    // the last pin frees the inode
+    REQUIRE(rootDir->unpinFile(file) == 1);
+    REQUIRE(rootDir->unpinFile(file) == 0);
+    REQUIRE(rootDir->createFile("/again", S_IFREG | 0644, &file) == 0);
+    REQUIRE((uint32_t) file->rootDirBlock == inode);
+    REQUIRE(rootDir->persist(file));
+
+    // a file that is not pinned is freed right away
+    REQUIRE(rootDir->deleteFile(other) == 0);
+    delete rootDir;
+    rootDir= new RootDir(&cache, &sb, dMap);
+    REQUIRE(rootDir->initRootDir() == 0);
+    REQUIRE(rootDir->findFile("/again", &file) == 0);
+    REQUIRE(file->stat.st_size == 0);
+    REQUIRE(rootDir->findFile("/other", &file) == -ENOENT);
+
+    delete rootDir;
+}
@@ -0,0 +1,79 @@
+//
+// Created by user on 18.10.26.
+//
+
+#include "catch.hpp"
+
+#include <string.h>
+
+#include "tools.hpp"
+
+#include "SuperBlock.h"
+
+TEST_CASE( "SB_FORMAT_PERSIST_LOAD", "[superblock]" ) {
+
+    remove(CONTAINER_PATH);
+
+    SuperBlock sb;
+    REQUIRE(sb.format(1000, 10000, 100) == -EINVAL);
+    REQUIRE(sb.format(4096, 0, 100) == -EINVAL);
+    REQUIRE(sb.format(4096, 10000, 100) == 0);
+
+    // the regions follow the superblock without gaps
+    REQUIRE(sb.getDMapOffset() == 1);
+    REQUIRE(sb.getDMapSize() == 1);
+    REQUIRE(sb.getFATOffset() == 2);
+    REQUIRE(sb.getFATSize() == 10);
+    REQUIRE(sb.getRootDirOffset() == 12);
+    REQUIRE(sb.getRootDirSize() == 100);
+    REQUIRE(sb.getDataOffset() == 112);
+    REQUIRE(sb.getTotalBlocks() == 10112);
+
+    BlockDevice bd(4096);
+    REQUIRE(bd.create(CONTAINER_PATH) == 0);
+    BlockCache cache(&bd, 4096);
+    cache.setCapacity(16);
+    REQUIRE(sb.persist(&cache) == 0);
+    REQUIRE(bd.close() == 0);
+
+    SuperBlock loaded;
+    REQUIRE(loaded.load(CONTAINER_PATH) == 0);
+    REQUIRE_FALSE(loaded.isLegacyLayout());
+    REQUIRE(loaded.getBlockSize() == 4096);
+    REQUIRE(loaded.getDataBlocks() == 10000);
+    REQUIRE(loaded.getDirEntries() == 100);
+    REQUIRE(loaded.getDataOffset() == 112);
+    REQUIRE(loaded.getTotalBlocks() == 10112);
+
+    // a container without superblock keeps the layout it was created with
+    char* zero= new char[BD_BLOCK_SIZE];
+    memset(zero, 0, BD_BLOCK_SIZE);
+    BlockDevice bd2(BLOCK_SIZE);
+    REQUIRE(bd2.create(CONTAINER_PATH) == 0);
+    REQUIRE(bd2.write(0, zero) == 0);
+    REQUIRE(bd2.close() == 0);
+
+    SuperBlock legacy;
+    REQUIRE(legacy.load(CONTAINER_PATH) == 0);
+    REQUIRE(legacy.isLegacyLayout());
+    REQUIRE(legacy.getBlockSize() == 512);
+    REQUIRE(legacy.getDMapOffset() == 0);
+    REQUIRE(legacy.getFATOffset() == 512);
+    REQUIRE(legacy.getRootDirOffset() == 2560);
+    REQUIRE(legacy.getDataOffset() == 2624);
+
+    // the upgrade only shrinks the DMap to a bitmap behind the new superblock
+    REQUIRE(legacy.hasByteDMap());
+    legacy.upgrade();
+    REQUIRE_FALSE(legacy.hasByteDMap());
+    REQUIRE_FALSE(legacy.isLegacyLayout());
+    REQUIRE(legacy.getDMapOffset() == 1);
+    REQUIRE(legacy.getDMapSize() == 64);
+    REQUIRE(legacy.getFATOffset() == 512);
+    REQUIRE(legacy.getDataOffset() == 2624);
+
+    delete [] zero;
+    remove(CONTAINER_PATH);
+
+    REQUIRE(legacy.load(CONTAINER_PATH) == -ENOENT);
+}